@@ -0,0 +1,202 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Local transform of one joint relative to its parent
+struct JointPose
+{
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+// The joint hierarchy, parents stored before their children so a pose converts to model
+// space in one forward pass. Model makes every imported node a joint, so parts attached
+// to a node animate the same way as vertices weighted to a bone.
+struct Skeleton
+{
+    std::vector<std::string> names;
+    std::vector<int> parents;            // -1 for roots
+    std::vector<JointPose> bindPose;
+
+    size_t size() const { return parents.size(); }
+
+    int find(const std::string &name) const
+    {
+        for (size_t i = 0; i < names.size(); i++) {
+            if (names[i] == name)
+                return (int)i;
+        }
+        return -1;
+    }
+};
+
+template <typename T>
+struct Keyframe
+{
+    float time;   // seconds
+    T value;
+};
+
+// Keyframes of one joint; a component without keys keeps the bind pose
+struct JointTrack
+{
+    std::vector<Keyframe<glm::vec3>> translations;
+    std::vector<Keyframe<glm::quat>> rotations;
+    std::vector<Keyframe<glm::vec3>> scales;
+};
+
+// Shortest-arc normalized lerp. Close enough to slerp for neighbouring keys and blend
+// weights, and it has no trigonometry.
+inline glm::quat nlerp(const glm::quat &a, const glm::quat &b, float t)
+{
+    float sign = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w < 0.0f ? -1.0f : 1.0f;
+    float s = 1.0f - t, u = t * sign;
+    glm::quat q(s * a.w + u * b.w, s * a.x + u * b.x, s * a.y + u * b.y, s * a.z + u * b.z);
+    float length = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    float inv = length > 0.0f ? 1.0f / length : 0.0f;
+    return glm::quat(q.w * inv, q.x * inv, q.y * inv, q.z * inv);
+}
+
+// Imported keyframe animation, sampled into a pose by time
+class AnimationClip
+{
+public:
+    std::string name;
+    float duration = 0.0f;             // seconds
+    std::vector<JointTrack> tracks;    // indexed by joint; joints past the end have no keys
+
+    // The pose at time seconds, which wraps around the clip's duration. Joints without keys
+    // take their bind pose.
+    void sample(const Skeleton &skeleton, float time, std::vector<JointPose> &pose) const
+    {
+        if (duration > 0.0f) {
+            time = std::fmod(time, duration);
+            if (time < 0.0f)
+                time += duration;
+        }
+        pose.resize(skeleton.size());
+        for (size_t j = 0; j < skeleton.size(); j++) {
+            const JointPose &bind = skeleton.bindPose[j];
+            JointPose &out = pose[j];
+            if (j >= tracks.size()) {
+                out = bind;
+                continue;
+            }
+            const JointTrack &track = tracks[j];
+            out.translation = sample_vec3(track.translations, time, bind.translation);
+            out.rotation = sample_quat(track.rotations, time, bind.rotation);
+            out.scale = sample_vec3(track.scales, time, bind.scale);
+        }
+    }
+
+    // Bytes of track data
+    size_t size_bytes() const
+    {
+        size_t bytes = tracks.size() * sizeof(JointTrack);
+        for (const JointTrack &track: tracks) {
+            bytes += track.translations.size() * sizeof(Keyframe<glm::vec3>) +
+                     track.rotations.size() * sizeof(Keyframe<glm::quat>) +
+                     track.scales.size() * sizeof(Keyframe<glm::vec3>);
+        }
+        return bytes;
+    }
+
+    size_t key_count() const
+    {
+        size_t count = 0;
+        for (const JointTrack &track: tracks)
+            count += track.translations.size() + track.rotations.size() + track.scales.size();
+        return count;
+    }
+
+private:
+    // Index of the last key at or before time, and the blend factor towards the next
+    template <typename T>
+    static size_t find_key(const std::vector<Keyframe<T>> &keys, float time, float &t)
+    {
+        auto after = std::upper_bound(keys.begin(), keys.end(), time,
+                                      [](float value, const Keyframe<T> &key) { return value < key.time; });
+        if (after == keys.begin()) {
+            t = 0.0f;
+            return 0;
+        }
+        size_t i = (size_t)(after - keys.begin()) - 1;
+        if (i + 1 >= keys.size()) {
+            t = 0.0f;
+            return i;
+        }
+        float span = keys[i + 1].time - keys[i].time;
+        t = span > 0.0f ? (time - keys[i].time) / span : 0.0f;
+        return i;
+    }
+
+    static glm::vec3 sample_vec3(const std::vector<Keyframe<glm::vec3>> &keys, float time, const glm::vec3 &fallback)
+    {
+        if (keys.empty())
+            return fallback;
+        float t;
+        size_t i = find_key(keys, time, t);
+        if (t == 0.0f)
+            return keys[i].value;
+        return keys[i].value + (keys[i + 1].value - keys[i].value) * t;
+    }
+
+    static glm::quat sample_quat(const std::vector<Keyframe<glm::quat>> &keys, float time, const glm::quat &fallback)
+    {
+        if (keys.empty())
+            return fallback;
+        float t;
+        size_t i = find_key(keys, time, t);
+        if (t == 0.0f)
+            return keys[i].value;
+        return nlerp(keys[i].value, keys[i + 1].value, t);
+    }
+};
+
+// out = a weighted towards b; weight 0 gives a and 1 gives b. out may alias a or b.
+inline void blend_poses(const std::vector<JointPose> &a, const std::vector<JointPose> &b, float weight,
+                        std::vector<JointPose> &out)
+{
+    size_t count = std::min(a.size(), b.size());
+    out.resize(count);
+    for (size_t j = 0; j < count; j++) {
+        out[j].translation = a[j].translation + (b[j].translation - a[j].translation) * weight;
+        out[j].rotation = nlerp(a[j].rotation, b[j].rotation, weight);
+        out[j].scale = a[j].scale + (b[j].scale - a[j].scale) * weight;
+    }
+}
+
+// Translation * rotation * scale
+inline glm::mat4 joint_matrix(const JointPose &p)
+{
+    const glm::quat &q = p.rotation;
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    glm::mat4 m;
+    m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * p.scale.x;
+    m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * p.scale.y;
+    m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * p.scale.z;
+    m[3] = glm::vec4(p.translation, 1.0f);
+    return m;
+}
+
+// Each joint's transform relative to the model's origin
+inline void pose_to_model(const Skeleton &skeleton, const std::vector<JointPose> &pose, std::vector<glm::mat4> &model)
+{
+    model.resize(skeleton.size());
+    for (size_t j = 0; j < skeleton.size(); j++) {
+        glm::mat4 local = joint_matrix(pose[j]);
+        int parent = skeleton.parents[j];
+        model[j] = parent < 0 ? local : model[parent] * local;
+    }
+}
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef ANIMATION_COMPRESSION_H
+#define ANIMATION_COMPRESSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "Animation.h"
+
+// A unit quaternion in 48 bits, "smallest three": the largest component is left out, since
+// it follows from the other three once the quaternion is negated to make it positive (q and
+// -q are the same rotation). The other three lie within +-1/sqrt(2) and take 15 bits each;
+// the index of the one left out goes in the top bits of the first two.
+inline void quantize_rotation(const glm::quat &q, uint16_t out[3])
+{
+    float c[4] = {q.x, q.y, q.z, q.w};
+    float length = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3]);
+    int largest = 0;
+    for (int i = 1; i < 4; i++) {
+        if (std::fabs(c[i]) > std::fabs(c[largest]))
+            largest = i;
+    }
+    float scale = (c[largest] < 0.0f ? -1.0f : 1.0f) / (length > 0.0f ? length : 1.0f);
+    int k = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i == largest)
+            continue;
+        float unit = glm::clamp((c[i] * scale * 1.41421356f + 1.0f) * 0.5f, 0.0f, 1.0f);
+        out[k++] = (uint16_t)(unit * 32767.0f + 0.5f);
+    }
+    out[0] |= (uint16_t)((largest >> 1) << 15);
+    out[1] |= (uint16_t)((largest & 1) << 15);
+}
+
+inline glm::quat dequantize_rotation(const uint16_t in[3])
+{
+    const float scale = 2.0f / 32767.0f * 0.70710678f, offset = -0.70710678f;
+    float a = (in[0] & 0x7fff) * scale + offset;
+    float b = (in[1] & 0x7fff) * scale + offset;
+    float c = (in[2] & 0x7fff) * scale + offset;
+    float d = std::sqrt(std::max(0.0f, 1.0f - a * a - b * b - c * c));
+    switch (((in[0] >> 15) << 1) | (in[1] >> 15)) {
+    case 0: return glm::quat(c, d, a, b);
+    case 1: return glm::quat(c, a, d, b);
+    case 2: return glm::quat(c, a, b, d);
+    default: return glm::quat(d, a, b, c);
+    }
+}
+
+// Angle between two rotations. Twice the angle between the quaternions as 4D vectors, from
+// atan2 rather than acos of their dot product, which loses small angles to rounding.
+inline float rotation_error(const glm::quat &a, const glm::quat &b)
+{
+    float s = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w < 0.0f ? -1.0f : 1.0f;
+    float dx = a.x - s * b.x, dy = a.y - s * b.y, dz = a.z - s * b.z, dw = a.w - s * b.w;
+    float sx = a.x + s * b.x, sy = a.y + s * b.y, sz = a.z + s * b.z, sw = a.w + s * b.w;
+    return 4.0f * std::atan2(std::sqrt(dx * dx + dy * dy + dz * dz + dw * dw),
+                             std::sqrt(sx * sx + sy * sy + sz * sz + sw * sw));
+}
+
+// How far a compressed track may stray from the imported one at its keys. Errors are per
+// joint, in its parent's space, so they add up along a chain of joints; rounding key times
+// adds a little more for tracks that move fast.
+struct AnimationTolerance
+{
+    float rotation = 0.0005f;      // radians
+    float translation = 0.0001f;   // model units
+    float scale = 0.0001f;
+};
+
+// An AnimationClip in a fraction of the memory. Every key is eight bytes, against 16 or 20
+// imported: a 16-bit time, as a fraction of the clip's duration, and three 16-bit values.
+// Rotations use smallest three; translations and scales are quantized within each track's
+// own range. Keys that linear interpolation between their neighbours reproduces within the
+// tolerance are dropped, and tracks that stay within it of their bind pose store no keys
+// at all.
+//
+// The tracks are laid out in joint order, translation, rotation then scale, with each
+// track's keys following the last track's, so sampling a pose walks forward through two
+// arrays once.
+class CompressedClip
+{
+public:
+    std::string name;
+    float duration = 0.0f;    // seconds
+
+    CompressedClip() {}
+
+    CompressedClip(const AnimationClip &clip, const Skeleton &skeleton,
+                   const AnimationTolerance &tolerance = AnimationTolerance())
+        : name(clip.name), duration(clip.duration)
+    {
+        static const JointTrack noKeys;
+        channels.resize(skeleton.size() * 3);
+        for (size_t j = 0; j < skeleton.size(); j++) {
+            const JointTrack &track = j < clip.tracks.size() ? clip.tracks[j] : noKeys;
+            const JointPose &bind = skeleton.bindPose[j];
+            compress_vec3(track.translations, bind.translation, tolerance.translation, channels[j * 3]);
+            compress_rotation(track.rotations, bind.rotation, tolerance.rotation, channels[j * 3 + 1]);
+            compress_vec3(track.scales, bind.scale, tolerance.scale, channels[j * 3 + 2]);
+        }
+    }
+
+    // Same result as AnimationClip::sample, within the tolerance
+    void sample(const Skeleton &skeleton, float time, std::vector<JointPose> &pose) const
+    {
+        if (duration > 0.0f) {
+            time = std::fmod(time, duration);
+            if (time < 0.0f)
+                time += duration;
+        }
+        float u = duration > 0.0f ? time / duration * 65535.0f : 0.0f;
+        pose.resize(skeleton.size());
+        for (size_t j = 0; j < skeleton.size(); j++) {
+            const JointPose &bind = skeleton.bindPose[j];
+            JointPose &out = pose[j];
+            if (j * 3 >= channels.size()) {
+                out = bind;
+                continue;
+            }
+            const Channel *channel = &channels[j * 3];
+            out.translation = sample_vec3(channel[0], u, bind.translation);
+            out.rotation = sample_rotation(channel[1], u, bind.rotation);
+            out.scale = sample_vec3(channel[2], u, bind.scale);
+        }
+    }
+
+    size_t key_count() const { return keys.size(); }
+
+    // Bytes of track data, comparable with AnimationClip::size_bytes()
+    size_t size_bytes() const { return channels.size() * sizeof(Channel) + keys.size() * sizeof(Key); }
+
+private:
+    struct Key
+    {
+        uint16_t time;      // 0 is the clip's start, 65535 its end
+        uint16_t value[3];
+    };
+
+    // A track's keys are keys[first, first + count); none means the bind pose. Translations
+    // and scales decode as origin + value * step.
+    struct Channel
+    {
+        uint32_t first = 0;
+        uint32_t count = 0;
+        glm::vec3 origin;
+        glm::vec3 step;
+    };
+
+    std::vector<Channel> channels;    // translation, rotation and scale of each joint
+    std::vector<Key> keys;
+
+    uint16_t quantize_time(float time) const
+    {
+        if (duration <= 0.0f)
+            return 0;
+        return (uint16_t)(glm::clamp(time / duration, 0.0f, 1.0f) * 65535.0f + 0.5f);
+    }
+
+    // The key at or before u and the blend factor towards the next
+    const Key *find_key(const Channel &channel, float u, float &t) const
+    {
+        const Key *first = keys.data() + channel.first, *last = first + channel.count;
+        uint16_t now = (uint16_t)u;
+        const Key *after = std::upper_bound(first, last, now, [](uint16_t value, const Key &key) { return value < key.time; });
+        t = 0.0f;
+        if (after == first)
+            return first;
+        const Key *key = after - 1;
+        if (after != last && after->time > key->time)
+            t = (u - key->time) / (float)(after->time - key->time);
+        return key;
+    }
+
+    static glm::vec3 decode_vec3(const Channel &channel, const Key &key)
+    {
+        return channel.origin + glm::vec3(key.value[0], key.value[1], key.value[2]) * channel.step;
+    }
+
+    glm::vec3 sample_vec3(const Channel &channel, float u, const glm::vec3 &bind) const
+    {
+        if (channel.count == 0)
+            return bind;
+        float t;
+        const Key *key = find_key(channel, u, t);
+        glm::vec3 a = decode_vec3(channel, key[0]);
+        if (t == 0.0f)
+            return a;
+        return a + (decode_vec3(channel, key[1]) - a) * t;
+    }
+
+    glm::quat sample_rotation(const Channel &channel, float u, const glm::quat &bind) const
+    {
+        if (channel.count == 0)
+            return bind;
+        float t;
+        const Key *key = find_key(channel, u, t);
+        glm::quat a = dequantize_rotation(key[0].value);
+        if (t == 0.0f)
+            return a;
+        return nlerp(a, dequantize_rotation(key[1].value), t);
+    }
+
+    // Appends the keys of a track worth keeping to `keys`. `decoded` holds what each
+    // quantized key decodes to. The error bound is the tolerance, or the quantization error
+    // if that is larger. Since the imported track is also interpolated linearly, checking
+    // at its key times bounds the error in between.
+    template <typename T, typename Lerp, typename Error>
+    void reduce(const std::vector<Keyframe<T>> &raw, const std::vector<Key> &quantized,
+                const std::vector<T> &decoded, const T &bind, float tolerance, Lerp lerp, Error error,
+                Channel &channel)
+    {
+        size_t n = raw.size();
+        float bound = tolerance;
+        bool atBind = true;
+        for (size_t i = 0; i < n; i++) {
+            bound = std::max(bound, error(decoded[i], raw[i].value) * 1.001f);
+            atBind = atBind && error(bind, raw[i].value) <= tolerance;
+        }
+        channel.first = (uint32_t)keys.size();
+        if (atBind) {
+            channel.count = 0;
+            return;
+        }
+        auto fits = [&](size_t a, size_t b) {
+            float span = (float)(quantized[b].time - quantized[a].time);
+            for (size_t k = a + 1; k < b; k++) {
+                float t = span > 0.0f ? (quantized[k].time - quantized[a].time) / span : 0.0f;
+                if (error(lerp(decoded[a], decoded[b], t), raw[k].value) > bound)
+                    return false;
+            }
+            return true;
+        };
+        size_t a = 0;
+        keys.push_back(quantized[0]);
+        bool constant = true;
+        for (size_t i = 1; i < n && constant; i++)
+            constant = error(decoded[0], raw[i].value) <= bound;
+        if (!constant) {
+            while (a + 1 < n) {
+                size_t b = a + 1;
+                while (b + 1 < n && fits(a, b + 1))
+                    b++;
+                keys.push_back(quantized[b]);
+                a = b;
+            }
+        }
+        channel.count = (uint32_t)keys.size() - channel.first;
+    }
+
+    void compress_vec3(const std::vector<Keyframe<glm::vec3>> &raw, const glm::vec3 &bind, float tolerance,
+                       Channel &channel)
+    {
+        if (raw.empty())
+            return;
+        glm::vec3 low = raw[0].value, high = raw[0].value;
+        for (const Keyframe<glm::vec3> &key: raw) {
+            low = glm::min(low, key.value);
+            high = glm::max(high, key.value);
+        }
+        channel.origin = low;
+        channel.step = (high - low) / 65535.0f;
+        std::vector<Key> quantized(raw.size());
+        std::vector<glm::vec3> decoded(raw.size());
+        for (size_t i = 0; i < raw.size(); i++) {
+            Key &key = quantized[i];
+            key.time = quantize_time(raw[i].time);
+            for (int c = 0; c < 3; c++) {
+                float step = channel.step[c];
+                key.value[c] = step > 0.0f ? (uint16_t)glm::clamp((raw[i].value[c] - low[c]) / step + 0.5f, 0.0f, 65535.0f) : 0;
+            }
+            decoded[i] = decode_vec3(channel, key);
+        }
+        reduce(raw, quantized, decoded, bind, tolerance,
+               [](const glm::vec3 &a, const glm::vec3 &b, float t) { return a + (b - a) * t; },
+               [](const glm::vec3 &a, const glm::vec3 &b) { return glm::length(a - b); }, channel);
+    }
+
+    void compress_rotation(const std::vector<Keyframe<glm::quat>> &raw, const glm::quat &bind, float tolerance,
+                           Channel &channel)
+    {
+        if (raw.empty())
+            return;
+        std::vector<Key> quantized(raw.size());
+        std::vector<glm::quat> decoded(raw.size());
+        for (size_t i = 0; i < raw.size(); i++) {
+            quantized[i].time = quantize_time(raw[i].time);
+            quantize_rotation(raw[i].value, quantized[i].value);
+            decoded[i] = dequantize_rotation(quantized[i].value);
+        }
+        reduce(raw, quantized, decoded, bind, tolerance, nlerp, rotation_error, channel);
+    }
+};
+
+#endif
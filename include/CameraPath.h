@@ -0,0 +1,139 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "camera.h"
+
+struct CameraKey
+{
+    float time;
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+    float fov;
+};
+
+// A camera spline for repeatable benchmarks. Keys are interpolated with Catmull-Rom and the
+// path loops once it runs past the last key. The text format is one key per line,
+// "time x y z yaw pitch fov", with '#' starting a comment.
+class CameraPath
+{
+public:
+    std::vector<CameraKey> keys;
+
+    float duration() const { return keys.empty() ? 0.0f : keys.back().time; }
+
+    bool load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file) {
+            std::cout << "ERROR::CAMERA_PATH::FILE_NOT_SUCCESSFULLY_READ " << path << std::endl;
+            return false;
+        }
+        keys.clear();
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream stream(line);
+            CameraKey key;
+            if (stream >> key.time >> key.position.x >> key.position.y >> key.position.z
+                       >> key.yaw >> key.pitch >> key.fov)
+                keys.push_back(key);
+        }
+        return keys.size() >= 2;
+    }
+
+    bool save(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+        file << "# time x y z yaw pitch fov\n";
+        for (const CameraKey &key: keys) {
+            file << key.time << ' ' << key.position.x << ' ' << key.position.y << ' '
+                 << key.position.z << ' ' << key.yaw << ' ' << key.pitch << ' ' << key.fov << '\n';
+        }
+        return true;
+    }
+
+    void record(float time, const Camera &camera)
+    {
+        CameraKey key = {time, camera.position, camera.yaw, camera.pitch, camera.fov};
+        keys.push_back(key);
+    }
+
+    // The default benchmark: two laps around the origin at changing height and zoom
+    static CameraPath orbit(float radius, float height, float seconds)
+    {
+        CameraPath path;
+        const int steps = 32;
+        for (int i = 0; i <= steps; i++) {
+            float t = (float)i / steps;
+            float angle = t * 4.0f * glm::radians(180.0f);
+            CameraKey key;
+            key.time = t * seconds;
+            key.position = glm::vec3(radius * std::cos(angle), height + 2.0f * std::sin(angle * 0.5f),
+                                     radius * std::sin(angle));
+            glm::vec3 front = glm::normalize(-key.position);
+            key.yaw = glm::degrees(std::atan2(front.z, front.x));
+            // Unwrap so interpolation never spins the long way round
+            if (!path.keys.empty()) {
+                float previous = path.keys.back().yaw;
+                while (key.yaw - previous > 180.0f) key.yaw -= 360.0f;
+                while (key.yaw - previous < -180.0f) key.yaw += 360.0f;
+            }
+            key.pitch = glm::degrees(std::asin(front.y));
+            key.fov = 45.0f - 10.0f * std::sin(angle);
+            path.keys.push_back(key);
+        }
+        return path;
+    }
+
+    CameraKey sample(float time) const
+    {
+        if (keys.size() == 1 || duration() <= 0.0f)
+            return keys.front();
+        time = std::fmod(time, duration());
+        unsigned int i = 0;
+        while (i + 2 < keys.size() && keys[i + 1].time <= time)
+            i++;
+        const CameraKey &k0 = keys[i > 0 ? i - 1 : i];
+        const CameraKey &k1 = keys[i];
+        const CameraKey &k2 = keys[i + 1];
+        const CameraKey &k3 = keys[i + 2 < keys.size() ? i + 2 : i + 1];
+        float span = k2.time - k1.time;
+        float t = span > 0.0f ? (time - k1.time) / span : 0.0f;
+
+        CameraKey result;
+        result.time = time;
+        result.position = catmull_rom(k0.position, k1.position, k2.position, k3.position, t);
+        result.yaw = catmull_rom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, t);
+        result.pitch = glm::clamp(catmull_rom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, t), -89.0f, 89.0f);
+        result.fov = glm::clamp(catmull_rom(k0.fov, k1.fov, k2.fov, k3.fov, t), 1.0f, 45.0f);
+        return result;
+    }
+
+    void apply(float time, Camera &camera) const
+    {
+        CameraKey key = sample(time);
+        camera.set_pose(key.position, key.yaw, key.pitch, key.fov);
+    }
+
+private:
+    template <typename T>
+    static T catmull_rom(const T &p0, const T &p1, const T &p2, const T &p3, float t)
+    {
+        float t2 = t * t, t3 = t2 * t;
+        return (p1 * 2.0f + (p2 - p0) * t + (p0 * 2.0f - p1 * 5.0f + p2 * 4.0f - p3) * t2 +
+                (p1 * 3.0f - p0 - p2 * 3.0f + p3) * t3) * 0.5f;
+    }
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// Calls to the global operator new. openglGame.cpp only replaces the operator to count
+// them when built with TRACK_ALLOCATIONS; otherwise this stays at zero.
+inline std::atomic<uint64_t> &allocation_count()
+{
+    static std::atomic<uint64_t> count{0};
+    return count;
+}
+
+// A bump allocator: allocating moves an offset and reset() frees everything at once.
+// Whatever doesn't fit goes into overflow blocks from the heap, and the next reset
+// replaces the block with one big enough for all of it, so a steady workload stops
+// touching the heap after its first few frames.
+class LinearArena
+{
+public:
+    static const size_t MIN_CAPACITY = 64 * 1024;
+
+    LinearArena() {}
+    LinearArena(const LinearArena &) = delete;
+    LinearArena &operator=(const LinearArena &) = delete;
+
+    ~LinearArena()
+    {
+        free_overflow();
+        ::operator delete(base);
+    }
+
+    // alignment must be a power of two
+    void *allocate(size_t size, size_t alignment)
+    {
+        size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if (offset + size <= capacity) {
+            used = offset + size;
+            return base + offset;
+        }
+        size_t bytes = sizeof(Overflow) + size + alignment;
+        Overflow *block = static_cast<Overflow *>(::operator new(bytes));
+        block->next = overflow;
+        overflow = block;
+        overflowBytes += size + alignment;
+        uintptr_t start = reinterpret_cast<uintptr_t>(block + 1);
+        return reinterpret_cast<void *>((start + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+
+    // Frees everything. The block grows to hold all that was allocated since the last reset
+    // if some of it overflowed, and to at least minimum bytes.
+    void reset(size_t minimum = 0)
+    {
+        size_t wanted = overflow ? peak() + peak() / 2 : 0;
+        wanted = std::max(wanted, minimum);
+        free_overflow();
+        if (wanted > capacity) {
+            ::operator delete(base);
+            capacity = std::max(wanted, (size_t)MIN_CAPACITY);
+            base = static_cast<char *>(::operator new(capacity));
+        }
+        used = 0;
+    }
+
+    // Bytes handed out since the last reset, counting alignment padding
+    size_t peak() const { return used + overflowBytes; }
+
+private:
+    struct Overflow
+    {
+        Overflow *next;
+        std::max_align_t padding;   // keeps what follows the header aligned
+    };
+
+    char *base = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    Overflow *overflow = nullptr;
+    size_t overflowBytes = 0;
+
+    void free_overflow()
+    {
+        while (overflow) {
+            Overflow *next = overflow->next;
+            ::operator delete(overflow);
+            overflow = next;
+        }
+        overflowBytes = 0;
+    }
+};
+
+// Transient memory that lives for a few frames, for render lists, culling results and other
+// per-frame scratch. Every thread allocates from arenas of its own, so allocating takes no
+// lock, and keeps one arena per frame in flight: memory allocated in frame N stays valid
+// until frame N + FRAMES, long enough to hand results from a job to the main thread or
+// to the next frame. A thread resets its arena for a slot the first time it allocates in
+// a newer frame that maps to it, so workers need no call at frame boundaries; the main
+// loop only calls begin_frame(). Every arena grows to the most any arena has needed, since
+// work stealing moves a job to a different thread and slot from one frame to the next.
+namespace FrameArena
+{
+    static const unsigned int FRAMES = 3;
+
+    struct ThreadArenas
+    {
+        LinearArena arenas[FRAMES];
+        uint64_t frames[FRAMES] = {~0ull, ~0ull, ~0ull};   // frame each arena was reset for
+    };
+
+    inline std::atomic<uint64_t> &frame_counter()
+    {
+        static std::atomic<uint64_t> frame{0};
+        return frame;
+    }
+
+    // The most any arena has needed in a frame
+    inline std::atomic<size_t> &peak()
+    {
+        static std::atomic<size_t> bytes{0};
+        return bytes;
+    }
+
+    inline void begin_frame() { frame_counter().fetch_add(1, std::memory_order_release); }
+
+    inline uint64_t current_frame() { return frame_counter().load(std::memory_order_acquire); }
+
+    inline ThreadArenas &thread_arenas()
+    {
+        static thread_local ThreadArenas arenas;
+        return arenas;
+    }
+
+    inline void *allocate(size_t size, size_t alignment)
+    {
+        uint64_t frame = current_frame();
+        ThreadArenas &t = thread_arenas();
+        unsigned int slot = (unsigned int)(frame % FRAMES);
+        if (t.frames[slot] != frame) {
+            size_t used = t.arenas[slot].peak();
+            size_t most = peak().load(std::memory_order_relaxed);
+            while (used > most && !peak().compare_exchange_weak(most, used, std::memory_order_relaxed)) {}
+            most = std::max(most, used);
+            // Arenas this thread has never used are sized along with the first, so a
+            // worker's first frame jobs are its only ones that allocate
+            for (unsigned int i = 0; i < FRAMES; i++) {
+                if (i == slot || t.frames[i] == ~0ull)
+                    t.arenas[i].reset(most + most / 2);
+            }
+            t.frames[slot] = frame;
+        }
+        return t.arenas[slot].allocate(size, alignment);
+    }
+}
+
+// Standard allocator over the frame arenas. It is stateless, so containers using it move
+// and swap freely between threads, and deallocate() does nothing. A container kept across
+// frames must be replaced, not just cleared, before its storage is reused.
+template <typename T>
+struct FrameAllocator
+{
+    typedef T value_type;
+
+    FrameAllocator() {}
+    template <typename U> FrameAllocator(const FrameAllocator<U> &) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(FrameArena::allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T *, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T> &, const FrameAllocator<U> &) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T> &, const FrameAllocator<U> &) { return false; }
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+#endif
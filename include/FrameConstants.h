@@ -0,0 +1,114 @@
+#ifndef FRAME_CONSTANTS_H
+#define FRAME_CONSTANTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "camera.h"
+
+// The six planes of a view-projection frustum, normals pointing inwards
+struct Frustum
+{
+    enum { PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR };
+    glm::vec4 planes[6];
+
+    // Gribb and Hartmann: each plane is a sum or difference of rows of the matrix
+    static Frustum from_matrix(const glm::mat4 &m)
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        Frustum f;
+        f.planes[PLANE_LEFT] = row3 + row0;
+        f.planes[PLANE_RIGHT] = row3 - row0;
+        f.planes[PLANE_BOTTOM] = row3 + row1;
+        f.planes[PLANE_TOP] = row3 - row1;
+        f.planes[PLANE_NEAR] = row3 + row2;
+        f.planes[PLANE_FAR] = row3 - row2;
+        for (glm::vec4 &p: f.planes)
+            p /= glm::length(glm::vec3(p));
+        return f;
+    }
+
+    bool intersects_sphere(const glm::vec3 &center, float radius) const
+    {
+        for (const glm::vec4 &p: planes) {
+            if (glm::dot(glm::vec3(p), center) + p.w < -radius)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Camera and light matrices shared by every pass of a frame. update() compares the
+// camera's version counter, the aspect ratio and the light direction with what the cached
+// values were built from and only recomputes what changed, so a still camera costs a few
+// comparisons per frame and the passes never rebuild matrices themselves.
+class FrameConstants
+{
+public:
+    float nearPlane = 0.1f;
+    float farPlane = 100.0f;
+
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 lightSpace;
+    Frustum frustum;
+    Frustum lightFrustum;             // what the shadow map covers
+    glm::vec3 viewPosition;
+    unsigned int cameraUpdates = 0;   // recomputations, for checking the caching works
+    unsigned int lightUpdates = 0;
+
+    void update(const Camera &camera, float aspect, const glm::vec3 &lightDirection)
+    {
+        bool viewDirty = !valid || camera.version != cameraVersion;
+        bool projectionDirty = viewDirty || aspect != cachedAspect;
+        if (viewDirty) {
+            view = camera.get_view();
+            viewPosition = camera.position;
+            cameraVersion = camera.version;
+        }
+        if (projectionDirty) {
+            projection = glm::perspective(glm::radians(camera.fov), aspect, nearPlane, farPlane);
+            cachedAspect = aspect;
+            viewProjection = projection * view;
+            frustum = Frustum::from_matrix(viewProjection);
+            cameraUpdates++;
+        }
+        if (!valid || lightDirection != cachedLight) {
+            glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 1.0f, 50.0f);
+            glm::mat4 lightView = glm::lookAt(glm::vec3(-10, -10, -10) * lightDirection,
+                                              glm::vec3(0.0f, 0.0f, 0.0f),
+                                              glm::vec3(0.0f, 1.0f, 0.0f));
+            lightSpace = lightProjection * lightView;
+            lightFrustum = Frustum::from_matrix(lightSpace);
+            cachedLight = lightDirection;
+            lightUpdates++;
+        }
+        valid = true;
+    }
+
+    // A 24-bit depth buffer resolves about z * z / (nearPlane * 2^24) at distance z, so seeing
+    // further also pushes the near plane out, keeping farPlane / nearPlane within 8192: for
+    // the default 4 km terrain the near plane moves from 0.1 m to 0.5 m, and depth steps at
+    // 1 km shrink from 0.6 m to 0.12 m.
+    void set_view_distance(float distance)
+    {
+        farPlane = std::max(farPlane, distance);
+        nearPlane = std::max(nearPlane, farPlane / 8192.0f);
+        invalidate();
+    }
+
+    void invalidate() { valid = false; }
+
+private:
+    bool valid = false;
+    unsigned int cameraVersion = 0;
+    float cachedAspect = 0.0f;
+    glm::vec3 cachedLight;
+};
+
+#endif
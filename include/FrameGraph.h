@@ -0,0 +1,475 @@
+#ifndef FRAME_GRAPH_H
+#define FRAME_GRAPH_H
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include "GpuProfiler.h"
+#include "RenderStats.h"
+
+struct TextureDesc
+{
+    GLsizei width;
+    GLsizei height;
+    GLenum internalFormat;
+
+    bool is_depth() const
+    {
+        return internalFormat == GL_DEPTH_COMPONENT || internalFormat == GL_DEPTH_COMPONENT16 ||
+               internalFormat == GL_DEPTH_COMPONENT24 || internalFormat == GL_DEPTH_COMPONENT32F;
+    }
+
+    bool operator<(const TextureDesc &other) const
+    {
+        if (internalFormat != other.internalFormat)
+            return internalFormat < other.internalFormat;
+        if (width != other.width)
+            return width < other.width;
+        return height < other.height;
+    }
+};
+
+// Owns every render target texture and framebuffer. Textures are handed out by format and
+// size, so two passes whose outputs are never alive at the same time share one texture.
+class RenderTargetPool
+{
+public:
+    RenderTargetPool() {}
+    RenderTargetPool(const RenderTargetPool &) = delete;
+    RenderTargetPool &operator=(const RenderTargetPool &) = delete;
+
+    ~RenderTargetPool() { clear(); }
+
+    GLuint acquire(const TextureDesc &desc)
+    {
+        auto it = available.find(desc);
+        if (it != available.end()) {
+            GLuint texture = it->second;
+            available.erase(it);
+            return texture;
+        }
+        GLuint texture = create_texture(desc);
+        textures.push_back(texture);
+        return texture;
+    }
+
+    void release(const TextureDesc &desc, GLuint texture)
+    {
+        available.insert(std::make_pair(desc, texture));
+    }
+
+    // Framebuffers are cached by their attachments, so aliased textures also share FBOs
+    GLuint get_framebuffer(const std::vector<GLuint> &colors, GLuint depth)
+    {
+        std::vector<GLuint> key(colors);
+        key.push_back(depth);
+        auto it = framebuffers.find(key);
+        if (it != framebuffers.end())
+            return it->second;
+
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        std::vector<GLenum> drawBuffers;
+        for (unsigned int i = 0; i < colors.size(); i++) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colors[i], 0);
+            drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+        }
+        if (depth != 0)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        if (drawBuffers.empty()) {
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        } else {
+            glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+        }
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        framebuffers[key] = fbo;
+        return fbo;
+    }
+
+    unsigned int texture_count() const { return textures.size(); }
+    unsigned int framebuffer_count() const { return framebuffers.size(); }
+
+    void clear()
+    {
+        for (auto &f: framebuffers)
+            glDeleteFramebuffers(1, &f.second);
+        if (!textures.empty())
+            glDeleteTextures((GLsizei)textures.size(), textures.data());
+        framebuffers.clear();
+        textures.clear();
+        available.clear();
+    }
+
+private:
+    std::multimap<TextureDesc, GLuint> available;
+    std::vector<GLuint> textures;
+    std::map<std::vector<GLuint>, GLuint> framebuffers;
+
+    GLuint create_texture(const TextureDesc &desc)
+    {
+        GLenum format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+        if (desc.is_depth()) {
+            format = GL_DEPTH_COMPONENT;
+            type = GL_FLOAT;
+        } else if (desc.internalFormat == GL_RGBA16F || desc.internalFormat == GL_RGBA32F) {
+            type = GL_FLOAT;
+        } else if (desc.internalFormat == GL_R11F_G11F_B10F || desc.internalFormat == GL_RGB16F) {
+            format = GL_RGB;
+            type = GL_FLOAT;
+        }
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0, format, type, NULL);
+        if (desc.is_depth()) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+            float borderColor[] = {1.0, 1.0, 1.0, 1.0};
+            glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+        } else {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+};
+
+// Passes declare the render targets they create, read and write during setup. compile()
+// culls passes whose outputs nobody reads, orders the rest, and assigns pooled textures to
+// transient targets for exactly the span of passes that use them. The graph is built and
+// compiled once; execute() only binds and runs.
+class FrameGraph
+{
+public:
+    typedef int Resource;
+
+    FrameGraph() {}
+    FrameGraph(const FrameGraph &) = delete;
+    FrameGraph &operator=(const FrameGraph &) = delete;
+
+    // Pass framebuffers and transient textures all come from the pool; imported targets
+    // belong to whoever imported them and are left alone
+    ~FrameGraph() { pool.clear(); }
+
+    class Builder
+    {
+    public:
+        Builder(FrameGraph &graph, int pass): graph(graph), pass(pass) {}
+
+        Resource create(const std::string &name, const TextureDesc &desc)
+        {
+            ResourceNode node;
+            node.name = name;
+            node.desc = desc;
+            graph.resources.push_back(node);
+            return write((Resource)graph.resources.size() - 1);
+        }
+
+        Resource read(Resource r)
+        {
+            graph.passes[pass].reads.push_back(r);
+            return r;
+        }
+
+        Resource write(Resource r)
+        {
+            graph.passes[pass].writes.push_back(r);
+            return r;
+        }
+
+        // The pass has effects outside the graph and must never be culled
+        void side_effect() { graph.passes[pass].sideEffect = true; }
+
+    private:
+        FrameGraph &graph;
+        int pass;
+    };
+
+    class Context
+    {
+    public:
+        Context(const FrameGraph &graph, int pass): graph(graph), pass(pass) {}
+
+        GLuint texture(Resource r) const { return graph.resources[r].texture; }
+
+        const TextureDesc &desc(Resource r) const { return graph.resources[r].desc; }
+
+        // Binds the framebuffer holding everything this pass writes and sizes the viewport
+        void bind_target() const
+        {
+            const PassNode &node = graph.passes[pass];
+            glBindFramebuffer(GL_FRAMEBUFFER, node.framebuffer);
+            render_stats().stateChanges++;
+            if (!node.writes.empty()) {
+                const TextureDesc &d = graph.resources[node.writes[0]].desc;
+                glViewport(0, 0, d.width, d.height);
+            }
+        }
+
+    private:
+        const FrameGraph &graph;
+        int pass;
+    };
+
+    typedef std::function<void(const Context &)> ExecuteFunction;
+    // Runs immediately to declare the pass's targets and returns what to run each frame
+    typedef std::function<ExecuteFunction(Builder &)> SetupFunction;
+
+    // Targets owned outside the graph, e.g. the default framebuffer. Writing one is a side effect.
+    Resource import_target(const std::string &name, const TextureDesc &desc, GLuint framebuffer)
+    {
+        ResourceNode node;
+        node.name = name;
+        node.desc = desc;
+        node.imported = true;
+        node.framebuffer = framebuffer;
+        resources.push_back(node);
+        return (Resource)resources.size() - 1;
+    }
+
+    void add_pass(const std::string &name, SetupFunction setup)
+    {
+        PassNode node;
+        node.name = name;
+        passes.push_back(node);
+        Builder builder(*this, (int)passes.size() - 1);
+        ExecuteFunction execute = setup(builder);
+        passes.back().execute = execute;
+    }
+
+    // Every texture goes back to the pool at its last use, so recompiling starts from a full pool
+    void compile()
+    {
+        cull();
+        sort();
+        assign_targets();
+    }
+
+    // Each pass is timed under its own name when a profiler is given
+    void execute(GpuProfiler *profiler = nullptr) const
+    {
+        for (int p: order) {
+            Context context(*this, p);
+            int zone = profiler ? profiler->begin(passes[p].name) : -1;
+            passes[p].execute(context);
+            if (profiler)
+                profiler->end(zone);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Drops all passes and resources; pooled textures are kept for the next build
+    void reset()
+    {
+        passes.clear();
+        resources.clear();
+        order.clear();
+    }
+
+    const TextureDesc &desc(Resource r) const { return resources[r].desc; }
+
+    bool is_culled(const std::string &pass) const
+    {
+        for (const PassNode &node: passes) {
+            if (node.name == pass)
+                return node.culled;
+        }
+        return true;
+    }
+
+    void print_summary() const
+    {
+        for (const PassNode &node: passes)
+            std::cout << node.name << (node.culled ? " (culled)" : "") << std::endl;
+        std::cout << pool.texture_count() << " pooled textures, " << pool.framebuffer_count()
+                  << " framebuffers" << std::endl;
+    }
+
+private:
+    struct ResourceNode
+    {
+        std::string name;
+        TextureDesc desc;
+        bool imported = false;
+        GLuint texture = 0;
+        GLuint framebuffer = 0;
+        int refCount = 0;
+        int firstUse = -1;
+        int lastUse = -1;
+    };
+
+    struct PassNode
+    {
+        std::string name;
+        ExecuteFunction execute;
+        std::vector<Resource> reads;
+        std::vector<Resource> writes;
+        bool sideEffect = false;
+        bool culled = false;
+        int refCount = 0;
+        GLuint framebuffer = 0;
+    };
+
+    std::vector<PassNode> passes;
+    std::vector<ResourceNode> resources;
+    std::vector<int> order;
+    RenderTargetPool pool;
+
+    // Reference-count culling: a pass survives if something reads one of its outputs,
+    // it writes an imported target, or it is flagged as having side effects.
+    void cull()
+    {
+        for (ResourceNode &r: resources)
+            r.refCount = 0;
+        for (PassNode &p: passes) {
+            p.culled = false;
+            p.refCount = (int)p.writes.size();
+            for (Resource r: p.reads)
+                resources[r].refCount++;
+            for (Resource r: p.writes) {
+                if (resources[r].imported)
+                    p.sideEffect = true;
+            }
+        }
+        std::vector<Resource> unreferenced;
+        for (unsigned int r = 0; r < resources.size(); r++) {
+            if (resources[r].refCount == 0 && !resources[r].imported)
+                unreferenced.push_back(r);
+        }
+        while (!unreferenced.empty()) {
+            Resource r = unreferenced.back();
+            unreferenced.pop_back();
+            for (PassNode &p: passes) {
+                if (p.culled || p.sideEffect || !writes_resource(p, r))
+                    continue;
+                if (--p.refCount == 0) {
+                    p.culled = true;
+                    for (Resource read: p.reads) {
+                        if (--resources[read].refCount == 0 && !resources[read].imported)
+                            unreferenced.push_back(read);
+                    }
+                }
+            }
+        }
+    }
+
+    // Topological sort over write -> read edges, ties broken by declaration order
+    void sort()
+    {
+        order.clear();
+        std::vector<std::vector<int>> dependents(passes.size());
+        std::vector<int> inDegree(passes.size(), 0);
+        for (unsigned int reader = 0; reader < passes.size(); reader++) {
+            if (passes[reader].culled)
+                continue;
+            for (unsigned int writer = 0; writer < passes.size(); writer++) {
+                if (writer == reader || passes[writer].culled)
+                    continue;
+                bool depends = false;
+                for (Resource r: passes[reader].reads)
+                    depends = depends || writes_resource(passes[writer], r);
+                // Passes writing the same target keep their declared order
+                if (writer < reader) {
+                    for (Resource r: passes[reader].writes)
+                        depends = depends || writes_resource(passes[writer], r);
+                }
+                if (depends) {
+                    dependents[writer].push_back(reader);
+                    inDegree[reader]++;
+                }
+            }
+        }
+        std::vector<bool> done(passes.size(), false);
+        for (;;) {
+            int next = -1;
+            for (unsigned int p = 0; p < passes.size(); p++) {
+                if (!passes[p].culled && !done[p] && inDegree[p] == 0) {
+                    next = p;
+                    break;
+                }
+            }
+            if (next == -1)
+                break;
+            done[next] = true;
+            order.push_back(next);
+            for (int d: dependents[next])
+                inDegree[d]--;
+        }
+    }
+
+    // Walks the execution order acquiring each transient target at its first use and
+    // returning it to the pool after its last, so later passes can alias the same texture.
+    void assign_targets()
+    {
+        for (ResourceNode &r: resources) {
+            if (!r.imported)
+                r.texture = 0;
+            r.firstUse = -1;
+            r.lastUse = -1;
+        }
+        for (unsigned int i = 0; i < order.size(); i++) {
+            const PassNode &p = passes[order[i]];
+            for (const std::vector<Resource> *list: {&p.reads, &p.writes}) {
+                for (Resource r: *list) {
+                    if (resources[r].firstUse == -1)
+                        resources[r].firstUse = i;
+                    resources[r].lastUse = i;
+                }
+            }
+        }
+        for (unsigned int i = 0; i < order.size(); i++) {
+            for (ResourceNode &r: resources) {
+                if (!r.imported && r.firstUse == (int)i)
+                    r.texture = pool.acquire(r.desc);
+            }
+            for (ResourceNode &r: resources) {
+                if (!r.imported && r.lastUse == (int)i)
+                    pool.release(r.desc, r.texture);
+            }
+        }
+        for (int p: order)
+            passes[p].framebuffer = get_framebuffer(passes[p]);
+    }
+
+    GLuint get_framebuffer(const PassNode &p)
+    {
+        std::vector<GLuint> colors;
+        GLuint depth = 0;
+        for (Resource r: p.writes) {
+            const ResourceNode &node = resources[r];
+            if (node.imported)
+                return node.framebuffer;
+            if (node.desc.is_depth())
+                depth = node.texture;
+            else
+                colors.push_back(node.texture);
+        }
+        if (colors.empty() && depth == 0)
+            return 0;
+        return pool.get_framebuffer(colors, depth);
+    }
+
+    static bool writes_resource(const PassNode &p, Resource r)
+    {
+        for (Resource w: p.writes) {
+            if (w == r)
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif
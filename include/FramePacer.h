@@ -0,0 +1,49 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <vector>
+#include <glad/glad.h>
+
+// Limits how many frames the CPU may queue ahead of the GPU. Each frame ends with a fence
+// and the next frame using the same slot waits for it, so with N frames in flight input
+// sampled for a frame is at most N frames old when it reaches the screen. One frame in
+// flight gives the lowest latency, more give the GPU slack to absorb CPU hitches.
+class FramePacer
+{
+public:
+    explicit FramePacer(int framesInFlight = 2): fences(framesInFlight > 0 ? framesInFlight : 1, (GLsync)0) {}
+
+    int frames_in_flight() const { return (int)fences.size(); }
+
+    // Blocks until the frame that last used this slot has finished on the GPU
+    void wait()
+    {
+        GLsync &fence = fences[index % fences.size()];
+        if (fence) {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+
+    void end_frame()
+    {
+        fences[index % fences.size()] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        index++;
+    }
+
+    void destroy()
+    {
+        for (GLsync &fence: fences) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+
+private:
+    std::vector<GLsync> fences;
+    unsigned int index = 0;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Summary of a series of per-frame timings in milliseconds
+struct FrameStats
+{
+    unsigned int count = 0;
+    double mean = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+
+    static FrameStats compute(std::vector<double> samples)
+    {
+        FrameStats stats;
+        if (samples.empty())
+            return stats;
+        std::sort(samples.begin(), samples.end());
+        double sum = 0.0;
+        for (double s: samples)
+            sum += s;
+        stats.count = samples.size();
+        stats.mean = sum / samples.size();
+        stats.min = samples.front();
+        stats.max = samples.back();
+        stats.p50 = percentile(samples, 0.50);
+        stats.p95 = percentile(samples, 0.95);
+        stats.p99 = percentile(samples, 0.99);
+        return stats;
+    }
+
+    void print(const std::string &label) const
+    {
+        std::cout << label << ": " << count << " frames, mean " << mean << " ms, min " << min
+                  << " ms, p50 " << p50 << " ms, p95 " << p95 << " ms, p99 " << p99
+                  << " ms, max " << max << " ms" << std::endl;
+    }
+
+private:
+    // Nearest-rank percentile of already sorted samples
+    static double percentile(const std::vector<double> &sorted, double p)
+    {
+        unsigned int rank = (unsigned int)(p * sorted.size() + 0.5);
+        rank = std::max(1u, std::min(rank, (unsigned int)sorted.size()));
+        return sorted[rank - 1];
+    }
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef GAME_LOOP_H
+#define GAME_LOOP_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <glm/glm.hpp>
+#include "camera.h"
+#include "CameraPath.h"
+
+// Accumulates real frame time and hands it out in fixed steps. Time beyond maxSteps steps
+// per advance is dropped rather than simulated, so a long stall (or updates that cost more
+// than a step) slows the simulation down instead of snowballing.
+class FixedTimestep
+{
+public:
+    double step;
+    int maxSteps;
+    double droppedTime = 0.0;   // total time discarded by the clamp
+
+    FixedTimestep(double step = 1.0 / 60.0, int maxSteps = 5): step(step), maxSteps(maxSteps) {}
+
+    // Returns how many steps to run for frameTime seconds of real time
+    int advance(double frameTime)
+    {
+        double limit = step * maxSteps;
+        if (frameTime > limit) {
+            droppedTime += frameTime - limit;
+            frameTime = limit;
+        }
+        accumulator += frameTime;
+        int steps = (int)(accumulator / step);
+        accumulator -= steps * step;
+        return steps;
+    }
+
+    // How far the leftover time is into the next step, for interpolation
+    float alpha() const { return (float)(accumulator / step); }
+
+    double remaining() const { return step - accumulator; }
+
+private:
+    double accumulator = 0.0;
+};
+
+// Input gathered on the main thread, where GLFW must be polled, and consumed by ticks
+struct InputState
+{
+    bool move[6] = {};     // held keys, indexed by Camera_Direction
+    float mouseX = 0.0f;   // mouse movement since the last tick
+    float mouseY = 0.0f;
+};
+
+// Runs the camera at a fixed tick rate, either from the frame loop with update() or on
+// its own thread with start(). Rendering never sees the simulated camera directly: it
+// blends the last two ticks with sample(), which keeps motion smooth when the frame rate
+// and tick rate differ and means rendering and simulation only share two small states.
+class Simulation
+{
+public:
+    Simulation(): simCamera(glm::vec3(0.0f)) {}
+
+    ~Simulation() { stop(); }
+
+    void reset(const Camera &camera, double tickRate)
+    {
+        stop();
+        timestep = FixedTimestep(1.0 / tickRate);
+        simCamera = camera;
+        sensitivity = camera.sensitivity;
+        current = key(0.0);
+        previous = current;
+        lastUpdate = -1.0;
+        ticks = 0;
+    }
+
+    void set_keys(const bool move[6])
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        std::copy(move, move + 6, input.move);
+    }
+
+    void add_mouse(float x_offset, float y_offset)
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        input.mouseX += x_offset;
+        input.mouseY += y_offset;
+    }
+
+    // Single-threaded mode: runs the ticks that are due by now (in seconds, any clock)
+    void update(double now)
+    {
+        if (lastUpdate < 0.0)
+            lastUpdate = now;
+        int steps = timestep.advance(now - lastUpdate);
+        lastUpdate = now;
+        for (int i = 0; i < steps; i++)
+            tick(now);
+    }
+
+    // Single-threaded mode: forgets time spent blocked, e.g. while idle, so the next update
+    // neither simulates it nor reports it as dropped
+    void skip_to(double now) { lastUpdate = now; }
+
+    void start()
+    {
+        if (running)
+            return;
+        running = true;
+        thread = std::thread([this]() { run(); });
+    }
+
+    void stop()
+    {
+        if (!running)
+            return;
+        running = false;
+        thread.join();
+    }
+
+    bool threaded() const { return running; }
+
+    unsigned int tick_count() const { return ticks; }
+
+    double dropped_time() const { return timestep.droppedTime; }
+
+    // The camera to render now. Position and zoom blend the last two ticks; the update
+    // thread stamps ticks with its own clock, so the blend factor is measured against that.
+    // Orientation instead takes the latest tick plus any mouse movement no tick has
+    // consumed yet, so looking around is never held back by the tick rate.
+    CameraKey sample()
+    {
+        float pendingX, pendingY;
+        {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            pendingX = input.mouseX;
+            pendingY = input.mouseY;
+        }
+        double now = now_seconds();
+        std::lock_guard<std::mutex> lock(stateMutex);
+        float alpha = running ? (float)((now - current.time) / timestep.step) : timestep.alpha();
+        alpha = glm::clamp(alpha, 0.0f, 1.0f);
+        CameraKey result;
+        result.time = now;
+        result.position = glm::mix(previous.position, current.position, alpha);
+        result.yaw = current.yaw + pendingX * sensitivity;
+        result.pitch = glm::clamp(current.pitch + pendingY * sensitivity, -89.0f, 89.0f);
+        result.fov = glm::mix(previous.fov, current.fov, alpha);
+        return result;
+    }
+
+private:
+    FixedTimestep timestep;
+    Camera simCamera;               // only touched by whoever runs tick()
+    float sensitivity = SENSITIVTY;
+    InputState input;
+    std::mutex inputMutex;
+    CameraKey previous;
+    CameraKey current;
+    std::mutex stateMutex;
+    double lastUpdate = -1.0;
+    std::atomic<unsigned int> ticks{0};
+    std::atomic<bool> running{false};
+    std::thread thread;
+
+    static double now_seconds()
+    {
+        static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    CameraKey key(double time) const
+    {
+        CameraKey k = {(float)time, simCamera.position, simCamera.yaw, simCamera.pitch, simCamera.fov};
+        return k;
+    }
+
+    void tick(double now)
+    {
+        InputState frame;
+        {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            frame = input;
+            input.mouseX = input.mouseY = 0.0f;
+        }
+        if (frame.mouseX != 0.0f || frame.mouseY != 0.0f)
+            simCamera.process_mouse_movement(frame.mouseX, frame.mouseY);
+        for (int d = FORWARD; d <= DOWN; d++) {
+            if (frame.move[d])
+                simCamera.process_keyboard_input((Camera_Direction)d, (float)timestep.step);
+        }
+        std::lock_guard<std::mutex> lock(stateMutex);
+        previous = current;
+        current = key(now);
+        ticks++;
+    }
+
+    void run()
+    {
+        double last = now_seconds();
+        while (running) {
+            double now = now_seconds();
+            int steps = timestep.advance(now - last);
+            last = now;
+            for (int i = 0; i < steps; i++)
+                tick(now);
+            std::this_thread::sleep_for(std::chrono::duration<double>(timestep.remaining()));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,506 @@
+#ifndef GL_CAPTURE_H
+#define GL_CAPTURE_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+// Records the GL command stream, including buffer, texture and shader contents, into a
+// compact binary file that the glReplay tool re-issues in isolation. Capture works by
+// swapping glad's function pointers for recording wrappers, so it must be installed right
+// after the loader runs to see every resource being created.
+//
+// Only the entry points listed in install() are recorded; anything else still reaches the
+// driver but is missing from the capture, so new GL calls in the renderer need a wrapper
+// here too. Queries, syncs and state reads are deliberately left out: they do not change
+// what is drawn and the replay tool measures time itself.
+//
+// File layout: "GLCAP" magic, u32 version, u32 width, u32 height of the default framebuffer,
+// then records of u16 opcode, u8 argument count, and tagged arguments.
+namespace GlCapture
+{
+    const uint32_t VERSION = 1;
+
+    enum Op : uint16_t
+    {
+        OP_FRAME_BEGIN, OP_FRAME_END,
+        OP_ACTIVE_TEXTURE, OP_ATTACH_SHADER, OP_BIND_BUFFER, OP_BIND_BUFFER_BASE,
+        OP_BIND_FRAMEBUFFER, OP_BIND_RENDERBUFFER, OP_BIND_TEXTURE, OP_BIND_VERTEX_ARRAY,
+        OP_BLEND_FUNC, OP_BUFFER_DATA, OP_BUFFER_SUB_DATA, OP_CLEAR, OP_CLEAR_COLOR,
+        OP_COLOR_MASK, OP_COMPILE_SHADER, OP_CREATE_PROGRAM, OP_CREATE_SHADER, OP_CULL_FACE,
+        OP_DELETE_BUFFERS, OP_DELETE_FRAMEBUFFERS, OP_DELETE_PROGRAM, OP_DELETE_RENDERBUFFERS,
+        OP_DELETE_SHADER, OP_DELETE_TEXTURES, OP_DELETE_VERTEX_ARRAYS, OP_DEPTH_FUNC,
+        OP_DEPTH_MASK, OP_DISABLE, OP_DISABLE_VERTEX_ATTRIB_ARRAY, OP_DRAW_ARRAYS,
+        OP_DRAW_BUFFER, OP_DRAW_BUFFERS, OP_DRAW_ELEMENTS, OP_DRAW_ELEMENTS_INSTANCED,
+        OP_ENABLE, OP_ENABLE_VERTEX_ATTRIB_ARRAY, OP_FINISH, OP_FLUSH,
+        OP_FRAMEBUFFER_RENDERBUFFER, OP_FRAMEBUFFER_TEXTURE_2D, OP_GEN_BUFFERS,
+        OP_GEN_FRAMEBUFFERS, OP_GEN_RENDERBUFFERS, OP_GEN_TEXTURES, OP_GEN_VERTEX_ARRAYS,
+        OP_GET_UNIFORM_BLOCK_INDEX, OP_GET_UNIFORM_LOCATION, OP_LINK_PROGRAM, OP_PIXEL_STOREI,
+        OP_POLYGON_OFFSET, OP_READ_BUFFER, OP_RENDERBUFFER_STORAGE, OP_SCISSOR, OP_SHADER_SOURCE,
+        OP_TEX_IMAGE_2D, OP_TEX_PARAMETERF, OP_TEX_PARAMETERFV, OP_TEX_PARAMETERI,
+        OP_TEX_SUB_IMAGE_2D, OP_UNIFORM_1F, OP_UNIFORM_1FV, OP_UNIFORM_1I, OP_UNIFORM_1IV,
+        OP_UNIFORM_2F, OP_UNIFORM_2FV, OP_UNIFORM_3F, OP_UNIFORM_3FV, OP_UNIFORM_4F,
+        OP_UNIFORM_4FV, OP_UNIFORM_BLOCK_BINDING, OP_UNIFORM_MATRIX_3FV, OP_UNIFORM_MATRIX_4FV,
+        OP_USE_PROGRAM, OP_VERTEX_ATTRIB_DIVISOR, OP_VERTEX_ATTRIB_IPOINTER,
+        OP_VERTEX_ATTRIB_POINTER, OP_VIEWPORT,
+        OP_COUNT
+    };
+
+    enum Tag : uint8_t { TAG_INT, TAG_UINT, TAG_INT64, TAG_FLOAT, TAG_NAME, TAG_BLOB };
+
+    // Object names are remapped per namespace on replay; shaders share the program namespace
+    enum Namespace : uint8_t
+    {
+        NS_BUFFER, NS_TEXTURE, NS_FRAMEBUFFER, NS_RENDERBUFFER, NS_VERTEX_ARRAY, NS_PROGRAM,
+        NS_COUNT
+    };
+
+    struct Int { int32_t v; };
+    struct Uint { uint32_t v; };
+    struct Int64 { int64_t v; };
+    struct Float { float v; };
+    struct Name { Namespace ns; uint32_t v; };
+    struct Blob { const void *data; uint32_t size; };
+
+    // Real entry points, called by the wrappers and by the replay tool
+    struct Functions
+    {
+        PFNGLACTIVETEXTUREPROC ActiveTexture;
+        PFNGLATTACHSHADERPROC AttachShader;
+        PFNGLBINDBUFFERPROC BindBuffer;
+        PFNGLBINDBUFFERBASEPROC BindBufferBase;
+        PFNGLBINDFRAMEBUFFERPROC BindFramebuffer;
+        PFNGLBINDRENDERBUFFERPROC BindRenderbuffer;
+        PFNGLBINDTEXTUREPROC BindTexture;
+        PFNGLBINDVERTEXARRAYPROC BindVertexArray;
+        PFNGLBLENDFUNCPROC BlendFunc;
+        PFNGLBUFFERDATAPROC BufferData;
+        PFNGLBUFFERSUBDATAPROC BufferSubData;
+        PFNGLCLEARPROC Clear;
+        PFNGLCLEARCOLORPROC ClearColor;
+        PFNGLCOLORMASKPROC ColorMask;
+        PFNGLCOMPILESHADERPROC CompileShader;
+        PFNGLCREATEPROGRAMPROC CreateProgram;
+        PFNGLCREATESHADERPROC CreateShader;
+        PFNGLCULLFACEPROC CullFace;
+        PFNGLDELETEBUFFERSPROC DeleteBuffers;
+        PFNGLDELETEFRAMEBUFFERSPROC DeleteFramebuffers;
+        PFNGLDELETEPROGRAMPROC DeleteProgram;
+        PFNGLDELETERENDERBUFFERSPROC DeleteRenderbuffers;
+        PFNGLDELETESHADERPROC DeleteShader;
+        PFNGLDELETETEXTURESPROC DeleteTextures;
+        PFNGLDELETEVERTEXARRAYSPROC DeleteVertexArrays;
+        PFNGLDEPTHFUNCPROC DepthFunc;
+        PFNGLDEPTHMASKPROC DepthMask;
+        PFNGLDISABLEPROC Disable;
+        PFNGLDISABLEVERTEXATTRIBARRAYPROC DisableVertexAttribArray;
+        PFNGLDRAWARRAYSPROC DrawArrays;
+        PFNGLDRAWBUFFERPROC DrawBuffer;
+        PFNGLDRAWBUFFERSPROC DrawBuffers;
+        PFNGLDRAWELEMENTSPROC DrawElements;
+        PFNGLDRAWELEMENTSINSTANCEDPROC DrawElementsInstanced;
+        PFNGLENABLEPROC Enable;
+        PFNGLENABLEVERTEXATTRIBARRAYPROC EnableVertexAttribArray;
+        PFNGLFINISHPROC Finish;
+        PFNGLFLUSHPROC Flush;
+        PFNGLFRAMEBUFFERRENDERBUFFERPROC FramebufferRenderbuffer;
+        PFNGLFRAMEBUFFERTEXTURE2DPROC FramebufferTexture2D;
+        PFNGLGENBUFFERSPROC GenBuffers;
+        PFNGLGENFRAMEBUFFERSPROC GenFramebuffers;
+        PFNGLGENRENDERBUFFERSPROC GenRenderbuffers;
+        PFNGLGENTEXTURESPROC GenTextures;
+        PFNGLGENVERTEXARRAYSPROC GenVertexArrays;
+        PFNGLGETUNIFORMBLOCKINDEXPROC GetUniformBlockIndex;
+        PFNGLGETUNIFORMLOCATIONPROC GetUniformLocation;
+        PFNGLLINKPROGRAMPROC LinkProgram;
+        PFNGLPIXELSTOREIPROC PixelStorei;
+        PFNGLPOLYGONOFFSETPROC PolygonOffset;
+        PFNGLREADBUFFERPROC ReadBuffer;
+        PFNGLRENDERBUFFERSTORAGEPROC RenderbufferStorage;
+        PFNGLSCISSORPROC Scissor;
+        PFNGLSHADERSOURCEPROC ShaderSource;
+        PFNGLTEXIMAGE2DPROC TexImage2D;
+        PFNGLTEXPARAMETERFPROC TexParameterf;
+        PFNGLTEXPARAMETERFVPROC TexParameterfv;
+        PFNGLTEXPARAMETERIPROC TexParameteri;
+        PFNGLTEXSUBIMAGE2DPROC TexSubImage2D;
+        PFNGLUNIFORM1FPROC Uniform1f;
+        PFNGLUNIFORM1FVPROC Uniform1fv;
+        PFNGLUNIFORM1IPROC Uniform1i;
+        PFNGLUNIFORM1IVPROC Uniform1iv;
+        PFNGLUNIFORM2FPROC Uniform2f;
+        PFNGLUNIFORM2FVPROC Uniform2fv;
+        PFNGLUNIFORM3FPROC Uniform3f;
+        PFNGLUNIFORM3FVPROC Uniform3fv;
+        PFNGLUNIFORM4FPROC Uniform4f;
+        PFNGLUNIFORM4FVPROC Uniform4fv;
+        PFNGLUNIFORMBLOCKBINDINGPROC UniformBlockBinding;
+        PFNGLUNIFORMMATRIX3FVPROC UniformMatrix3fv;
+        PFNGLUNIFORMMATRIX4FVPROC UniformMatrix4fv;
+        PFNGLUSEPROGRAMPROC UseProgram;
+        PFNGLVERTEXATTRIBDIVISORPROC VertexAttribDivisor;
+        PFNGLVERTEXATTRIBIPOINTERPROC VertexAttribIPointer;
+        PFNGLVERTEXATTRIBPOINTERPROC VertexAttribPointer;
+        PFNGLVIEWPORTPROC Viewport;
+    };
+
+    struct State
+    {
+        Functions real;
+        bool installed = false;
+        bool recording = false;
+        std::vector<uint8_t> data;
+        size_t argCountOffset = 0;
+        uint8_t argCount = 0;
+        GLint unpackAlignment = 4;
+        std::string path;
+        int framesLeft = 0;
+    };
+
+    inline State &state()
+    {
+        static State instance;
+        return instance;
+    }
+
+    inline void put(const void *bytes, size_t size)
+    {
+        const uint8_t *p = (const uint8_t *)bytes;
+        state().data.insert(state().data.end(), p, p + size);
+    }
+
+    inline void put_tag(Tag tag)
+    {
+        state().data.push_back(tag);
+        state().argCount++;
+    }
+
+    inline void write_arg(Int a) { put_tag(TAG_INT); put(&a.v, 4); }
+    inline void write_arg(Uint a) { put_tag(TAG_UINT); put(&a.v, 4); }
+    inline void write_arg(Int64 a) { put_tag(TAG_INT64); put(&a.v, 8); }
+    inline void write_arg(Float a) { put_tag(TAG_FLOAT); put(&a.v, 4); }
+    inline void write_arg(Name a) { put_tag(TAG_NAME); put(&a.ns, 1); put(&a.v, 4); }
+    inline void write_arg(Blob a)
+    {
+        put_tag(TAG_BLOB);
+        put(&a.size, 4);
+        if (a.size)
+            put(a.data, a.size);
+    }
+
+    inline void begin_record(Op op)
+    {
+        State &s = state();
+        uint16_t code = op;
+        put(&code, 2);
+        s.argCountOffset = s.data.size();
+        s.data.push_back(0);
+        s.argCount = 0;
+    }
+
+    inline void end_record()
+    {
+        State &s = state();
+        s.data[s.argCountOffset] = s.argCount;
+    }
+
+    inline void write_args() {}
+
+    template <typename T, typename... Rest>
+    inline void write_args(T first, Rest... rest)
+    {
+        write_arg(first);
+        write_args(rest...);
+    }
+
+    template <typename... Args>
+    inline void record(Op op, Args... args)
+    {
+        if (!state().recording)
+            return;
+        begin_record(op);
+        write_args(args...);
+        end_record();
+    }
+
+    inline Blob names_blob(GLsizei n, const GLuint *names) { Blob b = {names, (uint32_t)(n * 4)}; return b; }
+
+    inline uint32_t pixel_bytes(GLsizei width, GLsizei height, GLenum format, GLenum type)
+    {
+        uint32_t components = 4;
+        if (format == GL_RED || format == GL_DEPTH_COMPONENT || format == GL_RED_INTEGER)
+            components = 1;
+        else if (format == GL_RG || format == GL_DEPTH_STENCIL)
+            components = 2;
+        else if (format == GL_RGB || format == GL_BGR)
+            components = 3;
+        uint32_t size = 1;
+        if (type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT)
+            size = 4;
+        else if (type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || type == GL_SHORT)
+            size = 2;
+        if (type == GL_UNSIGNED_INT_24_8)
+            components = 1, size = 4;
+        uint32_t alignment = state().unpackAlignment;
+        uint32_t row = width * components * size;
+        row = (row + alignment - 1) / alignment * alignment;
+        return row * height;
+    }
+
+    inline const Functions &real() { return state().real; }
+
+    // Wrappers installed in place of glad's pointers
+    inline void APIENTRY ActiveTexture(GLenum t) { record(OP_ACTIVE_TEXTURE, Uint{t}); real().ActiveTexture(t); }
+    inline void APIENTRY AttachShader(GLuint p, GLuint s) { record(OP_ATTACH_SHADER, Name{NS_PROGRAM, p}, Name{NS_PROGRAM, s}); real().AttachShader(p, s); }
+    inline void APIENTRY BindBuffer(GLenum t, GLuint b) { record(OP_BIND_BUFFER, Uint{t}, Name{NS_BUFFER, b}); real().BindBuffer(t, b); }
+    inline void APIENTRY BindBufferBase(GLenum t, GLuint i, GLuint b) { record(OP_BIND_BUFFER_BASE, Uint{t}, Uint{i}, Name{NS_BUFFER, b}); real().BindBufferBase(t, i, b); }
+    inline void APIENTRY BindFramebuffer(GLenum t, GLuint f) { record(OP_BIND_FRAMEBUFFER, Uint{t}, Name{NS_FRAMEBUFFER, f}); real().BindFramebuffer(t, f); }
+    inline void APIENTRY BindRenderbuffer(GLenum t, GLuint r) { record(OP_BIND_RENDERBUFFER, Uint{t}, Name{NS_RENDERBUFFER, r}); real().BindRenderbuffer(t, r); }
+    inline void APIENTRY BindTexture(GLenum t, GLuint x) { record(OP_BIND_TEXTURE, Uint{t}, Name{NS_TEXTURE, x}); real().BindTexture(t, x); }
+    inline void APIENTRY BindVertexArray(GLuint v) { record(OP_BIND_VERTEX_ARRAY, Name{NS_VERTEX_ARRAY, v}); real().BindVertexArray(v); }
+    inline void APIENTRY BlendFunc(GLenum s, GLenum d) { record(OP_BLEND_FUNC, Uint{s}, Uint{d}); real().BlendFunc(s, d); }
+    inline void APIENTRY BufferData(GLenum t, GLsizeiptr n, const void *d, GLenum u)
+    {
+        Blob contents = {d, d ? (uint32_t)n : 0};
+        record(OP_BUFFER_DATA, Uint{t}, Int64{(int64_t)n}, contents, Uint{u});
+        real().BufferData(t, n, d, u);
+    }
+    inline void APIENTRY BufferSubData(GLenum t, GLintptr o, GLsizeiptr n, const void *d)
+    {
+        record(OP_BUFFER_SUB_DATA, Uint{t}, Int64{(int64_t)o}, Blob{d, (uint32_t)n});
+        real().BufferSubData(t, o, n, d);
+    }
+    inline void APIENTRY Clear(GLbitfield m) { record(OP_CLEAR, Uint{m}); real().Clear(m); }
+    inline void APIENTRY ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) { record(OP_CLEAR_COLOR, Float{r}, Float{g}, Float{b}, Float{a}); real().ClearColor(r, g, b, a); }
+    inline void APIENTRY ColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a) { record(OP_COLOR_MASK, Uint{r}, Uint{g}, Uint{b}, Uint{a}); real().ColorMask(r, g, b, a); }
+    inline void APIENTRY CompileShader(GLuint s) { record(OP_COMPILE_SHADER, Name{NS_PROGRAM, s}); real().CompileShader(s); }
+    inline GLuint APIENTRY CreateProgram()
+    {
+        GLuint p = real().CreateProgram();
+        record(OP_CREATE_PROGRAM, Name{NS_PROGRAM, p});
+        return p;
+    }
+    inline GLuint APIENTRY CreateShader(GLenum t)
+    {
+        GLuint s = real().CreateShader(t);
+        record(OP_CREATE_SHADER, Uint{t}, Name{NS_PROGRAM, s});
+        return s;
+    }
+    inline void APIENTRY CullFace(GLenum m) { record(OP_CULL_FACE, Uint{m}); real().CullFace(m); }
+    inline void APIENTRY DeleteBuffers(GLsizei n, const GLuint *b) { record(OP_DELETE_BUFFERS, names_blob(n, b)); real().DeleteBuffers(n, b); }
+    inline void APIENTRY DeleteFramebuffers(GLsizei n, const GLuint *f) { record(OP_DELETE_FRAMEBUFFERS, names_blob(n, f)); real().DeleteFramebuffers(n, f); }
+    inline void APIENTRY DeleteProgram(GLuint p) { record(OP_DELETE_PROGRAM, Name{NS_PROGRAM, p}); real().DeleteProgram(p); }
+    inline void APIENTRY DeleteRenderbuffers(GLsizei n, const GLuint *r) { record(OP_DELETE_RENDERBUFFERS, names_blob(n, r)); real().DeleteRenderbuffers(n, r); }
+    inline void APIENTRY DeleteShader(GLuint s) { record(OP_DELETE_SHADER, Name{NS_PROGRAM, s}); real().DeleteShader(s); }
+    inline void APIENTRY DeleteTextures(GLsizei n, const GLuint *t) { record(OP_DELETE_TEXTURES, names_blob(n, t)); real().DeleteTextures(n, t); }
+    inline void APIENTRY DeleteVertexArrays(GLsizei n, const GLuint *v) { record(OP_DELETE_VERTEX_ARRAYS, names_blob(n, v)); real().DeleteVertexArrays(n, v); }
+    inline void APIENTRY DepthFunc(GLenum f) { record(OP_DEPTH_FUNC, Uint{f}); real().DepthFunc(f); }
+    inline void APIENTRY DepthMask(GLboolean m) { record(OP_DEPTH_MASK, Uint{m}); real().DepthMask(m); }
+    inline void APIENTRY Disable(GLenum c) { record(OP_DISABLE, Uint{c}); real().Disable(c); }
+    inline void APIENTRY DisableVertexAttribArray(GLuint i) { record(OP_DISABLE_VERTEX_ATTRIB_ARRAY, Uint{i}); real().DisableVertexAttribArray(i); }
+    inline void APIENTRY DrawArrays(GLenum m, GLint f, GLsizei c) { record(OP_DRAW_ARRAYS, Uint{m}, Int{f}, Int{c}); real().DrawArrays(m, f, c); }
+    inline void APIENTRY DrawBuffer(GLenum b) { record(OP_DRAW_BUFFER, Uint{b}); real().DrawBuffer(b); }
+    inline void APIENTRY DrawBuffers(GLsizei n, const GLenum *b) { record(OP_DRAW_BUFFERS, Blob{b, (uint32_t)(n * 4)}); real().DrawBuffers(n, b); }
+    // Index data always comes from the bound element buffer in a core profile, so the
+    // pointer is an offset
+    inline void APIENTRY DrawElements(GLenum m, GLsizei c, GLenum t, const void *i)
+    {
+        record(OP_DRAW_ELEMENTS, Uint{m}, Int{c}, Uint{t}, Int64{(int64_t)(intptr_t)i});
+        real().DrawElements(m, c, t, i);
+    }
+    inline void APIENTRY DrawElementsInstanced(GLenum m, GLsizei c, GLenum t, const void *i, GLsizei n)
+    {
+        record(OP_DRAW_ELEMENTS_INSTANCED, Uint{m}, Int{c}, Uint{t}, Int64{(int64_t)(intptr_t)i}, Int{n});
+        real().DrawElementsInstanced(m, c, t, i, n);
+    }
+    inline void APIENTRY Enable(GLenum c) { record(OP_ENABLE, Uint{c}); real().Enable(c); }
+    inline void APIENTRY EnableVertexAttribArray(GLuint i) { record(OP_ENABLE_VERTEX_ATTRIB_ARRAY, Uint{i}); real().EnableVertexAttribArray(i); }
+    inline void APIENTRY Finish() { record(OP_FINISH); real().Finish(); }
+    inline void APIENTRY Flush() { record(OP_FLUSH); real().Flush(); }
+    inline void APIENTRY FramebufferRenderbuffer(GLenum t, GLenum a, GLenum rt, GLuint r)
+    {
+        record(OP_FRAMEBUFFER_RENDERBUFFER, Uint{t}, Uint{a}, Uint{rt}, Name{NS_RENDERBUFFER, r});
+        real().FramebufferRenderbuffer(t, a, rt, r);
+    }
+    inline void APIENTRY FramebufferTexture2D(GLenum t, GLenum a, GLenum tt, GLuint x, GLint l)
+    {
+        record(OP_FRAMEBUFFER_TEXTURE_2D, Uint{t}, Uint{a}, Uint{tt}, Name{NS_TEXTURE, x}, Int{l});
+        real().FramebufferTexture2D(t, a, tt, x, l);
+    }
+    // Generated names are recorded after the call so replay can map them to its own
+    inline void APIENTRY GenBuffers(GLsizei n, GLuint *b) { real().GenBuffers(n, b); record(OP_GEN_BUFFERS, names_blob(n, b)); }
+    inline void APIENTRY GenFramebuffers(GLsizei n, GLuint *f) { real().GenFramebuffers(n, f); record(OP_GEN_FRAMEBUFFERS, names_blob(n, f)); }
+    inline void APIENTRY GenRenderbuffers(GLsizei n, GLuint *r) { real().GenRenderbuffers(n, r); record(OP_GEN_RENDERBUFFERS, names_blob(n, r)); }
+    inline void APIENTRY GenTextures(GLsizei n, GLuint *t) { real().GenTextures(n, t); record(OP_GEN_TEXTURES, names_blob(n, t)); }
+    inline void APIENTRY GenVertexArrays(GLsizei n, GLuint *v) { real().GenVertexArrays(n, v); record(OP_GEN_VERTEX_ARRAYS, names_blob(n, v)); }
+    inline GLuint APIENTRY GetUniformBlockIndex(GLuint p, const GLchar *name)
+    {
+        GLuint index = real().GetUniformBlockIndex(p, name);
+        record(OP_GET_UNIFORM_BLOCK_INDEX, Name{NS_PROGRAM, p}, Blob{name, (uint32_t)std::strlen(name) + 1}, Uint{index});
+        return index;
+    }
+    // The returned location is recorded so replay can translate it for the same program
+    inline GLint APIENTRY GetUniformLocation(GLuint p, const GLchar *name)
+    {
+        GLint location = real().GetUniformLocation(p, name);
+        record(OP_GET_UNIFORM_LOCATION, Name{NS_PROGRAM, p}, Blob{name, (uint32_t)std::strlen(name) + 1}, Int{location});
+        return location;
+    }
+    inline void APIENTRY LinkProgram(GLuint p) { record(OP_LINK_PROGRAM, Name{NS_PROGRAM, p}); real().LinkProgram(p); }
+    inline void APIENTRY PixelStorei(GLenum p, GLint v)
+    {
+        if (p == GL_UNPACK_ALIGNMENT)
+            state().unpackAlignment = v;
+        record(OP_PIXEL_STOREI, Uint{p}, Int{v});
+        real().PixelStorei(p, v);
+    }
+    inline void APIENTRY PolygonOffset(GLfloat f, GLfloat u) { record(OP_POLYGON_OFFSET, Float{f}, Float{u}); real().PolygonOffset(f, u); }
+    inline void APIENTRY ReadBuffer(GLenum b) { record(OP_READ_BUFFER, Uint{b}); real().ReadBuffer(b); }
+    inline void APIENTRY RenderbufferStorage(GLenum t, GLenum f, GLsizei w, GLsizei h) { record(OP_RENDERBUFFER_STORAGE, Uint{t}, Uint{f}, Int{w}, Int{h}); real().RenderbufferStorage(t, f, w, h); }
+    inline void APIENTRY Scissor(GLint x, GLint y, GLsizei w, GLsizei h) { record(OP_SCISSOR, Int{x}, Int{y}, Int{w}, Int{h}); real().Scissor(x, y, w, h); }
+    // All source strings are joined into one
+    inline void APIENTRY ShaderSource(GLuint s, GLsizei count, const GLchar *const *strings, const GLint *lengths)
+    {
+        if (state().recording) {
+            std::string source;
+            for (GLsizei i = 0; i < count; i++)
+                source.append(strings[i], lengths && lengths[i] >= 0 ? lengths[i] : std::strlen(strings[i]));
+            record(OP_SHADER_SOURCE, Name{NS_PROGRAM, s}, Blob{source.c_str(), (uint32_t)source.size() + 1});
+        }
+        real().ShaderSource(s, count, strings, lengths);
+    }
+    inline void APIENTRY TexImage2D(GLenum t, GLint l, GLint i, GLsizei w, GLsizei h, GLint b, GLenum f, GLenum ty, const void *p)
+    {
+        Blob pixels = {p, p ? pixel_bytes(w, h, f, ty) : 0};
+        record(OP_TEX_IMAGE_2D, Uint{t}, Int{l}, Int{i}, Int{w}, Int{h}, Int{b}, Uint{f}, Uint{ty}, pixels);
+        real().TexImage2D(t, l, i, w, h, b, f, ty, p);
+    }
+    inline void APIENTRY TexParameterf(GLenum t, GLenum p, GLfloat v) { record(OP_TEX_PARAMETERF, Uint{t}, Uint{p}, Float{v}); real().TexParameterf(t, p, v); }
+    inline void APIENTRY TexParameterfv(GLenum t, GLenum p, const GLfloat *v)
+    {
+        record(OP_TEX_PARAMETERFV, Uint{t}, Uint{p}, Blob{v, p == GL_TEXTURE_BORDER_COLOR ? 16u : 4u});
+        real().TexParameterfv(t, p, v);
+    }
+    inline void APIENTRY TexParameteri(GLenum t, GLenum p, GLint v) { record(OP_TEX_PARAMETERI, Uint{t}, Uint{p}, Int{v}); real().TexParameteri(t, p, v); }
+    inline void APIENTRY TexSubImage2D(GLenum t, GLint l, GLint x, GLint y, GLsizei w, GLsizei h, GLenum f, GLenum ty, const void *p)
+    {
+        Blob pixels = {p, p ? pixel_bytes(w, h, f, ty) : 0};
+        record(OP_TEX_SUB_IMAGE_2D, Uint{t}, Int{l}, Int{x}, Int{y}, Int{w}, Int{h}, Uint{f}, Uint{ty}, pixels);
+        real().TexSubImage2D(t, l, x, y, w, h, f, ty, p);
+    }
+    inline void APIENTRY Uniform1f(GLint l, GLfloat x) { record(OP_UNIFORM_1F, Int{l}, Float{x}); real().Uniform1f(l, x); }
+    inline void APIENTRY Uniform1fv(GLint l, GLsizei n, const GLfloat *v) { record(OP_UNIFORM_1FV, Int{l}, Blob{v, (uint32_t)(n * 4)}); real().Uniform1fv(l, n, v); }
+    inline void APIENTRY Uniform1i(GLint l, GLint x) { record(OP_UNIFORM_1I, Int{l}, Int{x}); real().Uniform1i(l, x); }
+    inline void APIENTRY Uniform1iv(GLint l, GLsizei n, const GLint *v) { record(OP_UNIFORM_1IV, Int{l}, Blob{v, (uint32_t)(n * 4)}); real().Uniform1iv(l, n, v); }
+    inline void APIENTRY Uniform2f(GLint l, GLfloat x, GLfloat y) { record(OP_UNIFORM_2F, Int{l}, Float{x}, Float{y}); real().Uniform2f(l, x, y); }
+    inline void APIENTRY Uniform2fv(GLint l, GLsizei n, const GLfloat *v) { record(OP_UNIFORM_2FV, Int{l}, Blob{v, (uint32_t)(n * 8)}); real().Uniform2fv(l, n, v); }
+    inline void APIENTRY Uniform3f(GLint l, GLfloat x, GLfloat y, GLfloat z) { record(OP_UNIFORM_3F, Int{l}, Float{x}, Float{y}, Float{z}); real().Uniform3f(l, x, y, z); }
+    inline void APIENTRY Uniform3fv(GLint l, GLsizei n, const GLfloat *v) { record(OP_UNIFORM_3FV, Int{l}, Blob{v, (uint32_t)(n * 12)}); real().Uniform3fv(l, n, v); }
+    inline void APIENTRY Uniform4f(GLint l, GLfloat x, GLfloat y, GLfloat z, GLfloat w) { record(OP_UNIFORM_4F, Int{l}, Float{x}, Float{y}, Float{z}, Float{w}); real().Uniform4f(l, x, y, z, w); }
+    inline void APIENTRY Uniform4fv(GLint l, GLsizei n, const GLfloat *v) { record(OP_UNIFORM_4FV, Int{l}, Blob{v, (uint32_t)(n * 16)}); real().Uniform4fv(l, n, v); }
+    inline void APIENTRY UniformBlockBinding(GLuint p, GLuint i, GLuint b) { record(OP_UNIFORM_BLOCK_BINDING, Name{NS_PROGRAM, p}, Uint{i}, Uint{b}); real().UniformBlockBinding(p, i, b); }
+    inline void APIENTRY UniformMatrix3fv(GLint l, GLsizei n, GLboolean t, const GLfloat *v) { record(OP_UNIFORM_MATRIX_3FV, Int{l}, Uint{t}, Blob{v, (uint32_t)(n * 36)}); real().UniformMatrix3fv(l, n, t, v); }
+    inline void APIENTRY UniformMatrix4fv(GLint l, GLsizei n, GLboolean t, const GLfloat *v) { record(OP_UNIFORM_MATRIX_4FV, Int{l}, Uint{t}, Blob{v, (uint32_t)(n * 64)}); real().UniformMatrix4fv(l, n, t, v); }
+    inline void APIENTRY UseProgram(GLuint p) { record(OP_USE_PROGRAM, Name{NS_PROGRAM, p}); real().UseProgram(p); }
+    inline void APIENTRY VertexAttribDivisor(GLuint i, GLuint d) { record(OP_VERTEX_ATTRIB_DIVISOR, Uint{i}, Uint{d}); real().VertexAttribDivisor(i, d); }
+    inline void APIENTRY VertexAttribIPointer(GLuint i, GLint s, GLenum t, GLsizei st, const void *p)
+    {
+        record(OP_VERTEX_ATTRIB_IPOINTER, Uint{i}, Int{s}, Uint{t}, Int{st}, Int64{(int64_t)(intptr_t)p});
+        real().VertexAttribIPointer(i, s, t, st, p);
+    }
+    inline void APIENTRY VertexAttribPointer(GLuint i, GLint s, GLenum t, GLboolean n, GLsizei st, const void *p)
+    {
+        record(OP_VERTEX_ATTRIB_POINTER, Uint{i}, Int{s}, Uint{t}, Uint{n}, Int{st}, Int64{(int64_t)(intptr_t)p});
+        real().VertexAttribPointer(i, s, t, n, st, p);
+    }
+    inline void APIENTRY Viewport(GLint x, GLint y, GLsizei w, GLsizei h) { record(OP_VIEWPORT, Int{x}, Int{y}, Int{w}, Int{h}); real().Viewport(x, y, w, h); }
+
+    // Fills functions from glad's current pointers and, when wrap is set, points glad at the
+    // recording wrappers instead
+    inline void load(Functions &functions, bool wrap)
+    {
+#define GL_CAPTURE_HOOK(name) \
+        functions.name = glad_gl##name; \
+        if (wrap) glad_gl##name = GlCapture::name;
+        GL_CAPTURE_HOOK(ActiveTexture) GL_CAPTURE_HOOK(AttachShader) GL_CAPTURE_HOOK(BindBuffer)
+        GL_CAPTURE_HOOK(BindBufferBase) GL_CAPTURE_HOOK(BindFramebuffer) GL_CAPTURE_HOOK(BindRenderbuffer)
+        GL_CAPTURE_HOOK(BindTexture) GL_CAPTURE_HOOK(BindVertexArray) GL_CAPTURE_HOOK(BlendFunc)
+        GL_CAPTURE_HOOK(BufferData) GL_CAPTURE_HOOK(BufferSubData) GL_CAPTURE_HOOK(Clear)
+        GL_CAPTURE_HOOK(ClearColor) GL_CAPTURE_HOOK(ColorMask) GL_CAPTURE_HOOK(CompileShader)
+        GL_CAPTURE_HOOK(CreateProgram) GL_CAPTURE_HOOK(CreateShader) GL_CAPTURE_HOOK(CullFace)
+        GL_CAPTURE_HOOK(DeleteBuffers) GL_CAPTURE_HOOK(DeleteFramebuffers) GL_CAPTURE_HOOK(DeleteProgram)
+        GL_CAPTURE_HOOK(DeleteRenderbuffers) GL_CAPTURE_HOOK(DeleteShader) GL_CAPTURE_HOOK(DeleteTextures)
+        GL_CAPTURE_HOOK(DeleteVertexArrays) GL_CAPTURE_HOOK(DepthFunc) GL_CAPTURE_HOOK(DepthMask)
+        GL_CAPTURE_HOOK(Disable) GL_CAPTURE_HOOK(DisableVertexAttribArray) GL_CAPTURE_HOOK(DrawArrays)
+        GL_CAPTURE_HOOK(DrawBuffer) GL_CAPTURE_HOOK(DrawBuffers) GL_CAPTURE_HOOK(DrawElements)
+        GL_CAPTURE_HOOK(DrawElementsInstanced) GL_CAPTURE_HOOK(Enable) GL_CAPTURE_HOOK(EnableVertexAttribArray)
+        GL_CAPTURE_HOOK(Finish) GL_CAPTURE_HOOK(Flush) GL_CAPTURE_HOOK(FramebufferRenderbuffer)
+        GL_CAPTURE_HOOK(FramebufferTexture2D) GL_CAPTURE_HOOK(GenBuffers) GL_CAPTURE_HOOK(GenFramebuffers)
+        GL_CAPTURE_HOOK(GenRenderbuffers) GL_CAPTURE_HOOK(GenTextures) GL_CAPTURE_HOOK(GenVertexArrays)
+        GL_CAPTURE_HOOK(GetUniformBlockIndex) GL_CAPTURE_HOOK(GetUniformLocation) GL_CAPTURE_HOOK(LinkProgram)
+        GL_CAPTURE_HOOK(PixelStorei) GL_CAPTURE_HOOK(PolygonOffset) GL_CAPTURE_HOOK(ReadBuffer)
+        GL_CAPTURE_HOOK(RenderbufferStorage) GL_CAPTURE_HOOK(Scissor) GL_CAPTURE_HOOK(ShaderSource)
+        GL_CAPTURE_HOOK(TexImage2D) GL_CAPTURE_HOOK(TexParameterf) GL_CAPTURE_HOOK(TexParameterfv)
+        GL_CAPTURE_HOOK(TexParameteri) GL_CAPTURE_HOOK(TexSubImage2D) GL_CAPTURE_HOOK(Uniform1f)
+        GL_CAPTURE_HOOK(Uniform1fv) GL_CAPTURE_HOOK(Uniform1i) GL_CAPTURE_HOOK(Uniform1iv)
+        GL_CAPTURE_HOOK(Uniform2f) GL_CAPTURE_HOOK(Uniform2fv) GL_CAPTURE_HOOK(Uniform3f)
+        GL_CAPTURE_HOOK(Uniform3fv) GL_CAPTURE_HOOK(Uniform4f) GL_CAPTURE_HOOK(Uniform4fv)
+        GL_CAPTURE_HOOK(UniformBlockBinding) GL_CAPTURE_HOOK(UniformMatrix3fv) GL_CAPTURE_HOOK(UniformMatrix4fv)
+        GL_CAPTURE_HOOK(UseProgram) GL_CAPTURE_HOOK(VertexAttribDivisor) GL_CAPTURE_HOOK(VertexAttribIPointer)
+        GL_CAPTURE_HOOK(VertexAttribPointer) GL_CAPTURE_HOOK(Viewport)
+#undef GL_CAPTURE_HOOK
+    }
+
+    // Starts recording into path until `frames` frames have been captured. Call straight
+    // after the GL loader so resource creation is part of the capture.
+    inline void install(const std::string &path, int frames, int width, int height)
+    {
+        State &s = state();
+        if (s.installed)
+            return;
+        load(s.real, true);
+        s.installed = true;
+        s.recording = true;
+        s.path = path;
+        s.framesLeft = frames;
+        s.data.clear();
+        put("GLCAP", 5);
+        uint32_t header[3] = {VERSION, (uint32_t)width, (uint32_t)height};
+        put(header, sizeof(header));
+    }
+
+    inline bool save()
+    {
+        State &s = state();
+        std::ofstream file(s.path, std::ios::binary);
+        if (!file) {
+            std::cout << "ERROR::GL_CAPTURE::CANNOT_WRITE " << s.path << std::endl;
+            return false;
+        }
+        file.write((const char *)s.data.data(), s.data.size());
+        std::cout << "Captured " << s.data.size() / 1024 << " KB of GL commands to " << s.path << std::endl;
+        return true;
+    }
+
+    inline void begin_frame() { record(OP_FRAME_BEGIN); }
+
+    // Once enough frames are in, the file is written and the wrappers only forward
+    inline void end_frame()
+    {
+        State &s = state();
+        if (!s.recording)
+            return;
+        record(OP_FRAME_END);
+        if (--s.framesLeft <= 0) {
+            s.recording = false;
+            save();
+            std::vector<uint8_t>().swap(s.data);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef GOLDEN_IMAGE_H
+#define GOLDEN_IMAGE_H
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// An 8-bit RGB image, stored top row first
+struct Image
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+
+    // Binary PPM (P6), so references need no image library to read or write
+    bool load(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::string magic;
+        int maxValue = 0;
+        if (!file || !(file >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255)
+            return false;
+        file.get();
+        pixels.resize(width * height * 3);
+        file.read((char *)pixels.data(), pixels.size());
+        return (size_t)file.gcount() == pixels.size();
+    }
+
+    bool save(const std::string &path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            std::cout << "ERROR::IMAGE::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        file << "P6\n" << width << ' ' << height << "\n255\n";
+        file.write((const char *)pixels.data(), pixels.size());
+        return true;
+    }
+
+    // Reads the colour attachment of framebuffer, flipping GL's bottom-up rows
+    static Image read_framebuffer(GLuint framebuffer, int width, int height)
+    {
+        Image image;
+        image.width = width;
+        image.height = height;
+        image.pixels.resize(width * height * 3);
+        std::vector<unsigned char> rows(image.pixels.size());
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        int stride = width * 3;
+        for (int y = 0; y < height; y++)
+            std::copy(rows.begin() + (height - 1 - y) * stride, rows.begin() + (height - y) * stride,
+                      image.pixels.begin() + y * stride);
+        return image;
+    }
+};
+
+struct ImageDiff
+{
+    unsigned int differing = 0;   // pixels over the perceptual threshold
+    float fraction = 1.0f;
+    float maxDelta = 0.0f;        // worst pixel, 0 (same) to 1 (black vs white)
+    Image visual;                 // differing pixels in red over a faded copy of the reference
+};
+
+// Compares colours in YIQ space, weighting luma over chroma the way the eye does (Kotsarenko
+// and Ramos, "Measuring perceived color difference using YIQ NTSC transmission color
+// space"). A threshold of 0.1 roughly matches what is visible side by side, which absorbs
+// the rounding differences between drivers without hiding real changes.
+inline ImageDiff compare_images(const Image &reference, const Image &actual, float threshold)
+{
+    ImageDiff diff;
+    if (reference.width != actual.width || reference.height != actual.height)
+        return diff;
+    const float maxYiq = 35215.0f;   // delta between black and white
+    diff.fraction = 0.0f;
+    diff.visual = reference;
+    for (size_t i = 0; i < reference.pixels.size(); i += 3) {
+        glm::vec3 a(reference.pixels[i], reference.pixels[i + 1], reference.pixels[i + 2]);
+        glm::vec3 b(actual.pixels[i], actual.pixels[i + 1], actual.pixels[i + 2]);
+        glm::vec3 d = a - b;
+        float y = 0.29889531f * d.x + 0.58662247f * d.y + 0.11448223f * d.z;
+        float in = 0.59597799f * d.x - 0.27417610f * d.y - 0.32180189f * d.z;
+        float q = 0.21147017f * d.x - 0.52261711f * d.y + 0.31114694f * d.z;
+        float delta = std::sqrt((0.5053f * y * y + 0.299f * in * in + 0.1957f * q * q) / maxYiq);
+        diff.maxDelta = std::max(diff.maxDelta, delta);
+        unsigned char faded = (unsigned char)(255 - (255 - (a.x + a.y + a.z) / 3.0f) * 0.2f);
+        bool differs = delta > threshold;
+        diff.visual.pixels[i] = differs ? 255 : faded;
+        diff.visual.pixels[i + 1] = differs ? 0 : faded;
+        diff.visual.pixels[i + 2] = differs ? 0 : faded;
+        if (differs)
+            diff.differing++;
+    }
+    diff.fraction = (float)diff.differing / (reference.width * reference.height);
+    return diff;
+}
+
+// Exit code for a golden run with cases nobody has recorded yet; CTest reports it as skipped
+// rather than passed, since nothing was actually compared.
+const int GOLDEN_NOT_RECORDED = 77;
+
+// One canonical view with its budgets. A budget of 0 has not been recorded yet.
+struct GoldenCase
+{
+    std::string name;
+    std::string model;
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+    float fov;
+    float maxFrameMs;
+    unsigned int maxDrawCalls;
+    unsigned int maxStateChanges;
+
+    // --golden-update always records a draw call budget along with the reference images
+    bool recorded() const { return maxDrawCalls > 0; }
+};
+
+// golden.txt: one case per line, "name model x y z yaw pitch fov max_frame_ms
+// max_draw_calls max_state_changes", with '#' starting a comment. The reference image for
+// a case is <name>.ppm in the same directory.
+inline bool load_golden_cases(const std::string &path, std::vector<GoldenCase> &cases)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "ERROR::GOLDEN::FILE_NOT_SUCCESSFULLY_READ " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream stream(line);
+        GoldenCase c;
+        if (stream >> c.name >> c.model >> c.position.x >> c.position.y >> c.position.z >> c.yaw
+                   >> c.pitch >> c.fov >> c.maxFrameMs >> c.maxDrawCalls >> c.maxStateChanges)
+            cases.push_back(c);
+        else
+            std::cout << "ERROR::GOLDEN::BAD_LINE " << line << std::endl;
+    }
+    return !cases.empty();
+}
+
+inline bool save_golden_cases(const std::string &path, const std::vector<GoldenCase> &cases)
+{
+    std::ofstream file(path);
+    if (!file) {
+        std::cout << "ERROR::GOLDEN::CANNOT_WRITE " << path << std::endl;
+        return false;
+    }
+    file << "# name model x y z yaw pitch fov max_frame_ms max_draw_calls max_state_changes\n";
+    for (const GoldenCase &c: cases) {
+        file << c.name << ' ' << c.model << ' ' << c.position.x << ' ' << c.position.y << ' '
+             << c.position.z << ' ' << c.yaw << ' ' << c.pitch << ' ' << c.fov << ' '
+             << c.maxFrameMs << ' ' << c.maxDrawCalls << ' ' << c.maxStateChanges << '\n';
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+// Measures GPU time per zone with GL_TIMESTAMP query pairs. Queries live in a ring of
+// FRAME_LATENCY frames and a frame's results are only read once the ring wraps back to it,
+// by which point the GPU has long finished, so reading never stalls the pipeline. Timestamp
+// pairs rather than GL_TIME_ELAPSED let zones nest and overlap (e.g. a stage spanning
+// several passes). Timer queries are core in GL 3.3, so this also runs on Mesa llvmpipe.
+class GpuProfiler
+{
+public:
+    static const int FRAME_LATENCY = 5;
+    static const int WINDOW = 256;   // samples kept per zone for the rolling statistics
+
+    struct Stats
+    {
+        std::string name;
+        unsigned int samples;
+        double min;
+        double avg;
+        double p99;
+        double last;
+    };
+
+    bool enabled = true;
+
+    void begin_frame()
+    {
+        if (!enabled)
+            return;
+        Frame &frame = frames[frameIndex % FRAME_LATENCY];
+        if (frameIndex >= FRAME_LATENCY)
+            collect(frame, false);
+        frame.zones.clear();
+        frame.used = 0;
+        frame.index = frameIndex;
+        frameZone = begin("frame");
+    }
+
+    void end_frame()
+    {
+        if (!enabled)
+            return;
+        end(frameZone);
+        frameIndex++;
+    }
+
+    // Returns a handle to pass to end(); zones may nest or overlap freely
+    int begin(const std::string &name)
+    {
+        if (!enabled)
+            return -1;
+        Frame &frame = frames[frameIndex % FRAME_LATENCY];
+        Zone zone;
+        zone.id = zone_id(name);
+        zone.begin = next_query(frame);
+        zone.end = 0;
+        glQueryCounter(zone.begin, GL_TIMESTAMP);
+        frame.zones.push_back(zone);
+        return (int)frame.zones.size() - 1;
+    }
+
+    void end(int handle)
+    {
+        if (!enabled || handle < 0)
+            return;
+        Frame &frame = frames[frameIndex % FRAME_LATENCY];
+        frame.zones[handle].end = next_query(frame);
+        glQueryCounter(frame.zones[handle].end, GL_TIMESTAMP);
+    }
+
+    // Keeps every sample of one zone from the next frame on, for benchmarks longer than the
+    // rolling window
+    void record_zone(const std::string &name)
+    {
+        recordId = zone_id(name);
+        recordFrom = frameIndex;
+        recorded.clear();
+    }
+
+    const std::vector<double> &recorded_samples() const { return recorded; }
+
+    // Waits for and collects every frame still in flight, e.g. at the end of a benchmark
+    void flush()
+    {
+        unsigned int pending = std::min<unsigned int>(frameIndex, FRAME_LATENCY);
+        for (unsigned int i = frameIndex - pending; i < frameIndex; i++) {
+            Frame &frame = frames[i % FRAME_LATENCY];
+            collect(frame, true);
+            frame.zones.clear();
+            frame.used = 0;
+        }
+    }
+
+    std::vector<Stats> get_stats() const
+    {
+        std::vector<Stats> result;
+        std::vector<double> sorted;
+        for (unsigned int i = 0; i < history.size(); i++) {
+            const History &h = history[i];
+            unsigned int count = std::min<unsigned int>(h.count, WINDOW);
+            if (count == 0)
+                continue;
+            sorted.assign(h.samples.begin(), h.samples.begin() + count);
+            std::sort(sorted.begin(), sorted.end());
+            double sum = 0.0;
+            for (double s: sorted)
+                sum += s;
+            Stats stats;
+            stats.name = names[i];
+            stats.samples = h.count;
+            stats.min = sorted.front();
+            stats.avg = sum / count;
+            stats.p99 = sorted[std::min<unsigned int>(count - 1, (unsigned int)(0.99 * count))];
+            stats.last = h.samples[(h.count - 1) % WINDOW];
+            result.push_back(stats);
+        }
+        return result;
+    }
+
+    void print() const
+    {
+        for (const Stats &s: get_stats()) {
+            std::cout << s.name << ": min " << s.min << " ms, avg " << s.avg << " ms, p99 "
+                      << s.p99 << " ms" << std::endl;
+        }
+    }
+
+    bool write_csv(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file) {
+            std::cout << "ERROR::GPU_PROFILER::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        file << "pass,samples,min_ms,avg_ms,p99_ms,last_ms\n";
+        for (const Stats &s: get_stats()) {
+            file << s.name << ',' << s.samples << ',' << s.min << ',' << s.avg << ',' << s.p99
+                 << ',' << s.last << '\n';
+        }
+        return true;
+    }
+
+private:
+    struct Zone
+    {
+        int id;
+        GLuint begin;
+        GLuint end;
+    };
+
+    struct Frame
+    {
+        std::vector<GLuint> queries;
+        unsigned int used = 0;
+        unsigned int index = 0;
+        std::vector<Zone> zones;
+    };
+
+    struct History
+    {
+        std::vector<double> samples = std::vector<double>(WINDOW, 0.0);
+        unsigned int count = 0;
+    };
+
+    Frame frames[FRAME_LATENCY];
+    unsigned int frameIndex = 0;
+    int frameZone = -1;
+    std::map<std::string, int> ids;
+    std::vector<std::string> names;
+    std::vector<History> history;
+    int recordId = -1;
+    unsigned int recordFrom = 0;
+    std::vector<double> recorded;
+
+    int zone_id(const std::string &name)
+    {
+        auto it = ids.find(name);
+        if (it != ids.end())
+            return it->second;
+        int id = (int)names.size();
+        ids[name] = id;
+        names.push_back(name);
+        history.push_back(History());
+        return id;
+    }
+
+    GLuint next_query(Frame &frame)
+    {
+        if (frame.used == frame.queries.size()) {
+            GLuint query;
+            glGenQueries(1, &query);
+            frame.queries.push_back(query);
+        }
+        return frame.queries[frame.used++];
+    }
+
+    void collect(const Frame &frame, bool wait)
+    {
+        if (frame.used == 0)
+            return;
+        // Drop the frame rather than wait if the GPU is running more than FRAME_LATENCY behind
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available && !wait)
+            return;
+        for (const Zone &zone: frame.zones) {
+            if (zone.end == 0)
+                continue;
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(zone.begin, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(zone.end, GL_QUERY_RESULT, &end);
+            History &h = history[zone.id];
+            h.samples[h.count % WINDOW] = (end - begin) / 1.0e6;
+            h.count++;
+            if (zone.id == recordId && frame.index >= recordFrom)
+                recorded.push_back((end - begin) / 1.0e6);
+        }
+    }
+};
+
+// Times the enclosing scope on the GPU
+class GpuZone
+{
+public:
+    GpuZone(GpuProfiler &profiler, const std::string &name): profiler(profiler)
+    {
+        handle = profiler.begin(name);
+    }
+
+    ~GpuZone() { profiler.end(handle); }
+
+private:
+    GpuProfiler &profiler;
+    int handle;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include <iostream>
+#include <glad/glad.h>
+
+#ifdef HEADLESS_EGL
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// A GL 3.3 core context with no window, for build servers without a display or GPU. Uses
+// EGL on Mesa's surfaceless platform when available (works with llvmpipe), falling back to
+// the default display with a 1x1 pbuffer. Rendering goes to an offscreen framebuffer
+// created with create_target().
+class HeadlessContext
+{
+public:
+    GLuint framebuffer = 0;
+
+    bool create()
+    {
+#ifdef HEADLESS_EGL
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+            std::cout << "ERROR::HEADLESS::NO_EGL_DISPLAY" << std::endl;
+            return false;
+        }
+
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint numConfigs = 0;
+        bool pbuffer = eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) && numConfigs > 0;
+        if (!pbuffer) {
+            // The surfaceless platform exposes configs without any surface type
+            const EGLint anyAttribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+            if (!eglChooseConfig(display, anyAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+                std::cout << "ERROR::HEADLESS::NO_EGL_CONFIG" << std::endl;
+                return false;
+            }
+        }
+
+        eglBindAPI(EGL_OPENGL_API);
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+        if (context == EGL_NO_CONTEXT) {
+            std::cout << "ERROR::HEADLESS::CONTEXT_CREATION_FAILED" << std::endl;
+            return false;
+        }
+        if (pbuffer) {
+            const EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+            surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+        }
+        if (!eglMakeCurrent(display, surface, surface, context)) {
+            std::cout << "ERROR::HEADLESS::MAKE_CURRENT_FAILED" << std::endl;
+            return false;
+        }
+        if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return false;
+        }
+        return true;
+#else
+        std::cout << "ERROR::HEADLESS::NOT_BUILT_WITH_EGL" << std::endl;
+        return false;
+#endif
+    }
+
+    // The stand-in for the default framebuffer: an RGBA8 colour and depth target
+    GLuint create_target(int width, int height)
+    {
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glGenRenderbuffers(1, &color);
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return framebuffer;
+    }
+
+    void destroy()
+    {
+        if (framebuffer != 0) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &color);
+            glDeleteRenderbuffers(1, &depth);
+            framebuffer = 0;
+        }
+#ifdef HEADLESS_EGL
+        if (display != EGL_NO_DISPLAY) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (surface != EGL_NO_SURFACE)
+                eglDestroySurface(display, surface);
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            eglTerminate(display);
+            display = EGL_NO_DISPLAY;
+        }
+#endif
+    }
+
+private:
+    GLuint color = 0;
+    GLuint depth = 0;
+#ifdef HEADLESS_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+    EGLSurface surface = EGL_NO_SURFACE;
+#endif
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include <vector>
+
+// A raw input event, stamped when the window system delivered it
+struct InputEvent
+{
+    enum Type { KEY, MOUSE_MOVE, MOUSE_BUTTON };
+
+    Type type;
+    double time;     // seconds, on the same clock as the frame timings
+    int key;         // KEY, MOUSE_BUTTON: GLFW key or button and action
+    int action;
+    double x;        // MOUSE_MOVE, MOUSE_BUTTON: cursor position
+    double y;
+};
+
+// Collects events from the GLFW callbacks until the frame drains them. Keeping the events
+// (rather than applying them in the callbacks) lets the frame consume input at the last
+// moment before the view is built and tell how long the oldest event waited.
+class InputQueue
+{
+public:
+    void push(const InputEvent &event) { events.push_back(event); }
+
+    // Moves the pending events into out, oldest first
+    void drain(std::vector<InputEvent> &out)
+    {
+        out.swap(events);
+        events.clear();
+    }
+
+    bool empty() const { return events.empty(); }
+
+private:
+    std::vector<InputEvent> events;
+};
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts unfinished jobs. Waiting on a counter, or scheduling jobs to run after it, is how
+// jobs express dependencies.
+class JobCounter
+{
+public:
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+    struct Continuation { std::function<void()> work; JobCounter *counter; bool mainThread; };
+
+    std::atomic<int> pending{0};
+    std::mutex mutex;                  // guards continuations and the final decrement
+    std::vector<Continuation> continuations;
+};
+
+// Worker threads with a deque each. A worker pushes and pops its own jobs at the back, so
+// it keeps working on what it just split off while that is still in cache, and steals the
+// oldest jobs from the front of other deques when it runs dry; the oldest jobs are
+// usually the biggest pieces. Threads that are not workers, like the main thread, push to
+// a shared deque the workers steal from.
+//
+// Waiting on a counter never blocks a thread that could help: wait() runs queued jobs
+// until the counter reaches zero. On the main thread it also runs jobs queued with
+// run_on_main(), which is how jobs hand GL calls back to the thread that owns the context.
+class JobSystem
+{
+public:
+    JobSystem(): mainThread(std::this_thread::get_id()) {}
+
+    ~JobSystem() { stop(); }
+
+    // workers = 0 runs everything on the thread that waits
+    void start(unsigned int workers)
+    {
+        stop();
+        mainThread = std::this_thread::get_id();
+        queues.clear();
+        for (unsigned int i = 0; i <= workers; i++)
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        running = true;
+        for (unsigned int i = 0; i < workers; i++)
+            threads.push_back(std::thread([this, i]() { work(i); }));
+    }
+
+    void stop()
+    {
+        if (!running)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running = false;
+            wake.notify_all();
+        }
+        for (std::thread &t: threads)
+            t.join();
+        threads.clear();
+    }
+
+    unsigned int worker_count() const { return (unsigned int)threads.size(); }
+
+    void run(std::function<void()> work, JobCounter *counter = nullptr)
+    {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        push(Job{std::move(work), counter});
+    }
+
+    // Runs work once dependency reaches zero, without tying up a thread until then
+    void run_after(JobCounter &dependency, std::function<void()> work, JobCounter *counter = nullptr,
+                   bool onMainThread = false)
+    {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(dependency.mutex);
+            if (dependency.pending.load(std::memory_order_acquire) != 0) {
+                dependency.continuations.push_back({std::move(work), counter, onMainThread});
+                return;
+            }
+        }
+        if (onMainThread)
+            push_main(Job{std::move(work), counter});
+        else
+            push(Job{std::move(work), counter});
+    }
+
+    // Queues work for the main thread, which runs it in wait() or run_main_thread_jobs()
+    void run_on_main(std::function<void()> work, JobCounter *counter = nullptr)
+    {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        push_main(Job{std::move(work), counter});
+    }
+
+    void run_main_thread_jobs()
+    {
+        Job job;
+        while (pop_main(job))
+            execute(job);
+    }
+
+    void wait(JobCounter &counter)
+    {
+        bool isMain = std::this_thread::get_id() == mainThread;
+        int spins = 0;
+        while (!counter.done()) {
+            Job job;
+            if ((isMain && pop_main(job)) || find_job(own_queue(), job)) {
+                execute(job);
+                spins = 0;
+            } else if (++spins > 64) {
+                std::this_thread::yield();
+            }
+        }
+        // The last decrement happens under the counter's lock; taking it once means the
+        // finishing thread is done with the counter before the caller can destroy it
+        std::lock_guard<std::mutex> lock(counter.mutex);
+    }
+
+    // Calls body(first, last) over [begin, end) in chunks of grain and waits for them all
+    template <typename Body>
+    void parallel_for(size_t begin, size_t end, size_t grain, const Body &body)
+    {
+        if (begin >= end)
+            return;
+        grain = std::max<size_t>(grain, 1);
+        // Two words of capture keep each closure inside std::function's own storage, so
+        // splitting work doesn't allocate
+        struct Range { const Body *body; size_t end; size_t grain; };
+        Range range = {&body, end, grain};
+        const Range *shared = &range;
+        JobCounter counter;
+        for (size_t first = begin; first < end; first += grain) {
+            run([shared, first]() {
+                (*shared->body)(first, std::min(shared->end, first + shared->grain));
+            }, &counter);
+        }
+        wait(counter);
+    }
+
+private:
+    struct Job
+    {
+        std::function<void()> work;
+        JobCounter *counter;
+    };
+
+    // A growable ring buffer used as a deque. Unlike std::deque it keeps its storage as
+    // jobs come and go, so a steady stream of jobs doesn't touch the heap.
+    struct Queue
+    {
+        std::mutex mutex;
+        std::vector<Job> slots;
+        size_t head = 0;    // oldest job
+        size_t count = 0;
+
+        bool empty() const { return count == 0; }
+
+        void push_back(Job job)
+        {
+            if (count == slots.size())
+                grow();
+            slots[(head + count) % slots.size()] = std::move(job);
+            count++;
+        }
+
+        void pop_back(Job &job)
+        {
+            count--;
+            take(slots[(head + count) % slots.size()], job);
+        }
+
+        void pop_front(Job &job)
+        {
+            take(slots[head], job);
+            head = (head + 1) % slots.size();
+            count--;
+        }
+
+        static void take(Job &slot, Job &job)
+        {
+            job = std::move(slot);
+            slot.work = nullptr;   // release the closure's captures now
+        }
+
+        void grow()
+        {
+            std::vector<Job> larger(std::max<size_t>(64, slots.size() * 2));
+            for (size_t i = 0; i < count; i++)
+                larger[i] = std::move(slots[(head + i) % slots.size()]);
+            slots.swap(larger);
+            head = 0;
+        }
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;   // one per worker, then the shared one
+    std::vector<std::thread> threads;
+    Queue mainQueue;
+    std::thread::id mainThread;
+    std::atomic<bool> running{false};
+    std::atomic<int> queued{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    static int &worker_index()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    size_t own_queue() const
+    {
+        int index = worker_index();
+        return index >= 0 ? (size_t)index : queues.size() - 1;
+    }
+
+    void push(Job job)
+    {
+        if (queues.empty())
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        Queue &queue = *queues[own_queue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.push_back(std::move(job));
+        }
+        // Counted under sleepMutex so a worker between checking queued and sleeping
+        // cannot miss the wakeup
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued.fetch_add(1, std::memory_order_release);
+        wake.notify_one();
+    }
+
+    void push_main(Job job)
+    {
+        std::lock_guard<std::mutex> lock(mainQueue.mutex);
+        mainQueue.push_back(std::move(job));
+    }
+
+    bool pop_main(Job &job)
+    {
+        std::lock_guard<std::mutex> lock(mainQueue.mutex);
+        if (mainQueue.empty())
+            return false;
+        mainQueue.pop_front(job);
+        return true;
+    }
+
+    // Newest job from our own deque, otherwise the oldest from someone else's
+    bool find_job(size_t own, Job &job)
+    {
+        if (queues.empty() || queued.load(std::memory_order_acquire) == 0)
+            return false;
+        {
+            Queue &queue = *queues[own];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.empty()) {
+                queue.pop_back(job);
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue &victim = *queues[(own + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.empty()) {
+                victim.pop_front(job);
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(Job &job)
+    {
+        job.work();
+        JobCounter *counter = job.counter;
+        if (!counter)
+            return;
+        std::vector<JobCounter::Continuation> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter->mutex);
+            if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                ready.swap(counter->continuations);
+        }
+        for (JobCounter::Continuation &c: ready) {
+            if (c.mainThread)
+                push_main(Job{std::move(c.work), c.counter});
+            else
+                push(Job{std::move(c.work), c.counter});
+        }
+    }
+
+    void work(unsigned int index)
+    {
+        worker_index() = (int)index;
+        while (running) {
+            Job job;
+            if (find_job(index, job)) {
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() {
+                return !running || queued.load(std::memory_order_acquire) > 0;
+            });
+        }
+        worker_index() = -1;
+    }
+};
+
+#endif
@@ -1,9 +1,13 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <utility>
 #include <vector>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include "FrameArena.h"
+#include "RenderStats.h"
 
 struct Vertex 
 {
@@ -15,16 +19,42 @@ struct Vertex
     Vertex(glm::vec3 p, glm::vec3 n, glm::vec2 t): position{p}, normal{n}, texcoord{t} {}
 };
 
+// Up to four joints per vertex, weights summing to one, at attribute locations 10 and 11.
+// Kept beside the vertices rather than in them so meshes without a skin keep the plain layout.
+struct VertexSkin
+{
+	unsigned short joints[4];
+	float weights[4];
+};
+
+// Per-instance vertex data: placement and normal matrix, attribute locations 3-6 and 7-9
+struct Instance
+{
+	glm::mat4 transform;
+	glm::mat3 normal;
+};
+
+// Geometry uploaded once and drawn at every placement in `instances` with a single
+// instanced draw. A mesh starts with one identity instance, so meshes that are only used
+// once need no extra setup and every shader can read the instance attributes.
 class Mesh 
 {
 public:
 	std::vector<Vertex> vertices;
 	std::vector<unsigned int> indices;
+	std::vector<glm::mat4> instances;
+	std::vector<VertexSkin> skin;      // empty unless the mesh is skinned
 	GLuint VAO;
 	GLuint VBO;
 	GLuint EBO;
+	GLuint instanceVBO;
+	GLuint skinVBO;
 
-	Mesh(std::vector<Vertex> v, std::vector<unsigned int> i): vertices{v}, indices{i}
+	// Empty placeholder with no GL objects; draws nothing
+	Mesh(): VAO(0), VBO(0), EBO(0), instanceVBO(0), skinVBO(0) {}
+
+	Mesh(std::vector<Vertex> v, std::vector<unsigned int> i): vertices{std::move(v)}, indices{std::move(i)}, 
+															 instances{glm::mat4(1.0f)}, skinVBO(0)
 	{
 		setupMesh();
 	}
@@ -45,13 +75,105 @@ public:
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texcoord));
         glEnableVertexAttribArray(2);
+
+		glGenBuffers(1, &instanceVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		for (GLuint c = 0; c < 4; c++) {
+			glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), 
+								  (void*)(offsetof(Instance, transform) + c * sizeof(glm::vec4)));
+			glEnableVertexAttribArray(3 + c);
+			glVertexAttribDivisor(3 + c, 1);
+		}
+		for (GLuint c = 0; c < 3; c++) {
+			glVertexAttribPointer(7 + c, 3, GL_FLOAT, GL_FALSE, sizeof(Instance), 
+								  (void*)(offsetof(Instance, normal) + c * sizeof(glm::vec3)));
+			glEnableVertexAttribArray(7 + c);
+			glVertexAttribDivisor(7 + c, 1);
+		}
 		glBindVertexArray(0);
+		uploadInstances();
+	}
+
+	// Adds joint indices and weights for every vertex, for skinning in the vertex shader
+	void set_skin(std::vector<VertexSkin> s)
+	{
+		skin = std::move(s);
+		if (!skinVBO) {
+			glGenBuffers(1, &skinVBO);
+		}
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, skinVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(VertexSkin) * skin.size(), skin.data(), GL_STATIC_DRAW);
+		glVertexAttribIPointer(10, 4, GL_UNSIGNED_SHORT, sizeof(VertexSkin), (void*)offsetof(VertexSkin, joints));
+		glEnableVertexAttribArray(10);
+		glVertexAttribPointer(11, 4, GL_FLOAT, GL_FALSE, sizeof(VertexSkin), (void*)offsetof(VertexSkin, weights));
+		glEnableVertexAttribArray(11);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// Overwrites the uploaded vertices, e.g. with skinned ones, leaving `vertices` as they were
+	void update_vertices(const Vertex *data)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Vertex) * vertices.size(), data);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// Replaces the placements; an empty list hides the mesh
+	void set_instances(const std::vector<glm::mat4> &transforms)
+	{
+		instances = transforms;
+		uploadInstances();
+	}
+
+	void uploadInstances()
+	{
+		FrameVector<Instance> data;
+		data.reserve(instances.size());
+		for (const glm::mat4 &t: instances) {
+			Instance instance = {t, glm::inverseTranspose(glm::mat3(t))};
+			data.push_back(instance);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * data.size(), data.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// Grows lo and hi to cover this mesh's vertices
+	void extend_bounds(glm::vec3 &lo, glm::vec3 &hi) const
+	{
+		for (const Vertex &v: vertices) {
+			lo = glm::min(lo, v.position);
+			hi = glm::max(hi, v.position);
+		}
+	}
+
+	glm::vec4 bounding_sphere() const
+	{
+		glm::vec3 lo(1e30f), hi(-1e30f);
+		extend_bounds(lo, hi);
+		return sphere_around(lo, hi);
+	}
+
+	// Sphere through the corners of a box, center in xyz and radius in w
+	static glm::vec4 sphere_around(const glm::vec3 &lo, const glm::vec3 &hi)
+	{
+		if (lo.x > hi.x)
+			return glm::vec4(0.0f);
+		glm::vec3 center = (lo + hi) * 0.5f;
+		return glm::vec4(center, glm::length(hi - lo) * 0.5f);
 	}
 
 	void draw()
 	{
+		if (instances.empty())
+			return;
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)0);
+		glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (void*)0, instances.size());
+		render_stats().drawCalls++;
+		render_stats().triangles += indices.size() / 3 * instances.size();
+		render_stats().stateChanges++;
 		glBindVertexArray(0);
 	}
 };
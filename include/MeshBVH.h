@@ -0,0 +1,437 @@
+#ifndef MESH_BVH_H
+#define MESH_BVH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Mesh.h"
+#include "Profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define MESH_BVH_SSE
+#include <xmmintrin.h>
+#endif
+
+// Two nodes per 64-byte cache line. The bounds sit in front of the index fields so each
+// corner loads as one four-wide vector.
+struct BVHNode
+{
+    float min[3];
+    uint32_t leftOrFirst;   // interior: left child, the right child follows it; leaf: first triangle
+    float max[3];
+    uint32_t count;         // triangles in a leaf, 0 for interior nodes
+
+    bool leaf() const { return count != 0; }
+};
+static_assert(sizeof(BVHNode) == 32, "BVHNode should stay 32 bytes");
+
+struct RayHit
+{
+    float t = FLT_MAX;
+    uint32_t triangle = ~0u;   // index into the source index buffer divided by 3
+    float u = 0.0f;            // barycentric coordinates of the hit
+    float v = 0.0f;
+};
+
+// Bounding volume hierarchy over a triangle mesh, built top-down with a binned surface
+// area heuristic. Large subtrees near the root are built on separate threads; they write
+// disjoint ranges of the preallocated node and index arrays, so the only shared state is
+// the atomic node counter. Triangles are copied into leaf order with precomputed edges so
+// traversal touches memory roughly in the order it visits leaves.
+class MeshBVH
+{
+public:
+    static const int BINS = 16;
+    static const uint32_t MAX_LEAF_SIZE = 8;         // split above this even when SAH disagrees
+    static const uint32_t PARALLEL_THRESHOLD = 4096; // smaller subtrees are not worth a thread
+    static const int MAX_DEPTH = 64;                 // deeper ranges stay leaves, so the
+                                                     // traversal stacks below cannot overflow
+
+    std::vector<BVHNode> nodes;   // nodes[0] is the root
+
+    void build(const Mesh &mesh, unsigned int threads = 0)
+    {
+        std::vector<glm::vec3> positions;
+        positions.reserve(mesh.vertices.size());
+        for (const Vertex &v: mesh.vertices)
+            positions.push_back(v.position);
+        build(positions, mesh.indices, threads);
+    }
+
+    // threads = 0 uses every hardware thread
+    void build(const std::vector<glm::vec3> &positions, const std::vector<unsigned int> &indices,
+               unsigned int threads = 0)
+    {
+        PROFILE_SCOPE("MeshBVH::build");
+        uint32_t count = (uint32_t)(indices.size() / 3);
+        nodes.clear();
+        triangles.clear();
+        triangleIds.clear();
+        if (count == 0)
+            return;
+
+        Builder builder;
+        builder.lo.resize(count);
+        builder.hi.resize(count);
+        builder.center.resize(count);
+        triangleIds.resize(count);
+        for (uint32_t i = 0; i < count; i++) {
+            const glm::vec3 &a = positions[indices[3 * i]];
+            const glm::vec3 &b = positions[indices[3 * i + 1]];
+            const glm::vec3 &c = positions[indices[3 * i + 2]];
+            builder.lo[i] = glm::min(a, glm::min(b, c));
+            builder.hi[i] = glm::max(a, glm::max(b, c));
+            builder.center[i] = (builder.lo[i] + builder.hi[i]) * 0.5f;
+            triangleIds[i] = i;
+        }
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        builder.parallelDepth = 0;
+        while ((1u << builder.parallelDepth) < threads)
+            builder.parallelDepth++;
+        builder.used = 1;
+
+        nodes.resize(2 * count - 1);
+        build_node(builder, 0, 0, count, 0);
+        nodes.resize(builder.used);
+        nodes.shrink_to_fit();
+
+        triangles.resize(count);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t id = triangleIds[i];
+            glm::vec3 a = positions[indices[3 * id]];
+            Triangle &t = triangles[i];
+            t.v0 = a;
+            t.e1 = positions[indices[3 * id + 1]] - a;
+            t.e2 = positions[indices[3 * id + 2]] - a;
+        }
+    }
+
+    size_t triangle_count() const { return triangles.size(); }
+
+    glm::vec3 bounds_min() const { return nodes.empty() ? glm::vec3(0.0f) : glm::vec3(nodes[0].min[0], nodes[0].min[1], nodes[0].min[2]); }
+    glm::vec3 bounds_max() const { return nodes.empty() ? glm::vec3(0.0f) : glm::vec3(nodes[0].max[0], nodes[0].max[1], nodes[0].max[2]); }
+
+    // Expected cost of a random ray relative to the root's area, for comparing builds
+    float sah_cost() const
+    {
+        if (nodes.empty())
+            return 0.0f;
+        float rootArea = half_area(nodes[0]);
+        float cost = 0.0f;
+        for (const BVHNode &n: nodes)
+            cost += half_area(n) / rootArea * (n.leaf() ? (float)n.count : TRAVERSAL_COST);
+        return cost;
+    }
+
+    // Closest hit along the ray no further than hit.t; the ray hits both faces of a triangle
+    bool intersect_ray(const glm::vec3 &origin, const glm::vec3 &direction, RayHit &hit) const
+    {
+        if (nodes.empty())
+            return false;
+        glm::vec3 inverse;
+        for (int i = 0; i < 3; i++) {
+            float d = direction[i];
+            if (std::fabs(d) < 1e-30f)
+                d = d < 0.0f ? -1e-30f : 1e-30f;
+            inverse[i] = 1.0f / d;
+        }
+        RayData ray(origin, inverse);
+        bool found = false;
+
+        struct Entry { uint32_t node; float distance; };
+        Entry stack[MAX_DEPTH + 1];
+        int size = 0;
+        float distance;
+        if (!intersect_box(nodes[0], ray, hit.t, distance))
+            return false;
+        stack[size++] = {0, distance};
+        while (size > 0) {
+            Entry entry = stack[--size];
+            if (entry.distance >= hit.t)
+                continue;
+            const BVHNode &node = nodes[entry.node];
+            if (node.leaf()) {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                    if (intersect_triangle(triangles[i], origin, direction, hit)) {
+                        hit.triangle = triangleIds[i];
+                        found = true;
+                    }
+                }
+                continue;
+            }
+            uint32_t left = node.leftOrFirst, right = left + 1;
+            float leftDistance, rightDistance;
+            bool hitLeft = intersect_box(nodes[left], ray, hit.t, leftDistance);
+            bool hitRight = intersect_box(nodes[right], ray, hit.t, rightDistance);
+            // Push the far child first so the near one is visited next and shrinks hit.t
+            if (hitLeft && hitRight) {
+                if (leftDistance < rightDistance) {
+                    stack[size++] = {right, rightDistance};
+                    stack[size++] = {left, leftDistance};
+                } else {
+                    stack[size++] = {left, leftDistance};
+                    stack[size++] = {right, rightDistance};
+                }
+            } else if (hitLeft) {
+                stack[size++] = {left, leftDistance};
+            } else if (hitRight) {
+                stack[size++] = {right, rightDistance};
+            }
+        }
+        return found;
+    }
+
+    // Appends the triangles whose bounding boxes overlap [lo, hi]
+    void query_aabb(const glm::vec3 &lo, const glm::vec3 &hi, std::vector<uint32_t> &out) const
+    {
+        if (nodes.empty())
+            return;
+        uint32_t stack[MAX_DEPTH + 1];
+        int size = 0;
+        stack[size++] = 0;
+        while (size > 0) {
+            const BVHNode &node = nodes[stack[--size]];
+            if (!overlaps(node.min, node.max, lo, hi))
+                continue;
+            if (!node.leaf()) {
+                stack[size++] = node.leftOrFirst + 1;
+                stack[size++] = node.leftOrFirst;
+                continue;
+            }
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                const Triangle &t = triangles[i];
+                glm::vec3 b = t.v0 + t.e1, c = t.v0 + t.e2;
+                glm::vec3 triLo = glm::min(t.v0, glm::min(b, c)), triHi = glm::max(t.v0, glm::max(b, c));
+                if (glm::all(glm::lessThanEqual(triLo, hi)) && glm::all(glm::greaterThanEqual(triHi, lo)))
+                    out.push_back(triangleIds[i]);
+            }
+        }
+    }
+
+private:
+    static constexpr float TRAVERSAL_COST = 1.0f;   // relative to one triangle test
+
+    struct Triangle { glm::vec3 v0, e1, e2; };   // one vertex and two edges, for Moller-Trumbore
+
+    struct Builder
+    {
+        std::vector<glm::vec3> lo, hi, center;   // per source triangle
+        std::atomic<uint32_t> used;
+        unsigned int parallelDepth;
+    };
+
+    struct Bin
+    {
+        glm::vec3 lo = glm::vec3(FLT_MAX);
+        glm::vec3 hi = glm::vec3(-FLT_MAX);
+        uint32_t count = 0;
+    };
+
+    std::vector<Triangle> triangles;   // in leaf order
+    std::vector<uint32_t> triangleIds; // source triangle of each entry in triangles
+
+    static float half_area(const glm::vec3 &lo, const glm::vec3 &hi)
+    {
+        glm::vec3 d = glm::max(hi - lo, glm::vec3(0.0f));
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    static float half_area(const BVHNode &n)
+    {
+        return half_area(glm::vec3(n.min[0], n.min[1], n.min[2]), glm::vec3(n.max[0], n.max[1], n.max[2]));
+    }
+
+    void build_node(Builder &b, uint32_t index, uint32_t first, uint32_t count, unsigned int depth)
+    {
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX), centerLo(FLT_MAX), centerHi(-FLT_MAX);
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t id = triangleIds[i];
+            lo = glm::min(lo, b.lo[id]);
+            hi = glm::max(hi, b.hi[id]);
+            centerLo = glm::min(centerLo, b.center[id]);
+            centerHi = glm::max(centerHi, b.center[id]);
+        }
+        BVHNode &node = nodes[index];
+        for (int k = 0; k < 3; k++) {
+            node.min[k] = lo[k];
+            node.max[k] = hi[k];
+        }
+        node.leftOrFirst = first;
+        node.count = count;
+        // Each level of a depth-first walk leaves at most one sibling on the stack
+        if (count <= 1 || depth >= (unsigned int)MAX_DEPTH)
+            return;
+
+        // Best plane over all axes, between bins splitBin - 1 and splitBin
+        int splitAxis = -1, splitBin = 0;
+        float splitCost = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = centerHi[axis] - centerLo[axis];
+            if (extent <= 0.0f)
+                continue;
+            Bin bins[BINS];
+            float scale = BINS / extent;
+            for (uint32_t i = first; i < first + count; i++) {
+                uint32_t id = triangleIds[i];
+                int bin = std::min(BINS - 1, (int)((b.center[id][axis] - centerLo[axis]) * scale));
+                bins[bin].lo = glm::min(bins[bin].lo, b.lo[id]);
+                bins[bin].hi = glm::max(bins[bin].hi, b.hi[id]);
+                bins[bin].count++;
+            }
+            // Sweep from the right for the right-hand areas, then from the left for the cost
+            float rightArea[BINS];
+            uint32_t rightCount[BINS];
+            Bin right;
+            for (int i = BINS - 1; i > 0; i--) {
+                right.lo = glm::min(right.lo, bins[i].lo);
+                right.hi = glm::max(right.hi, bins[i].hi);
+                right.count += bins[i].count;
+                rightArea[i] = half_area(right.lo, right.hi);
+                rightCount[i] = right.count;
+            }
+            Bin left;
+            for (int i = 1; i < BINS; i++) {
+                left.lo = glm::min(left.lo, bins[i - 1].lo);
+                left.hi = glm::max(left.hi, bins[i - 1].hi);
+                left.count += bins[i - 1].count;
+                if (left.count == 0 || rightCount[i] == 0)
+                    continue;
+                float cost = left.count * half_area(left.lo, left.hi) + rightCount[i] * rightArea[i];
+                if (cost < splitCost) {
+                    splitCost = cost;
+                    splitAxis = axis;
+                    splitBin = i;
+                }
+            }
+        }
+
+        uint32_t middle;
+        if (splitAxis < 0) {
+            // Every centroid coincides, so no plane separates them; halve the range instead
+            if (count <= MAX_LEAF_SIZE)
+                return;
+            middle = first + count / 2;
+        } else {
+            float leafCost = (float)count * half_area(lo, hi);
+            if (count <= MAX_LEAF_SIZE && splitCost + TRAVERSAL_COST * half_area(lo, hi) >= leafCost)
+                return;
+            float scale = BINS / (centerHi[splitAxis] - centerLo[splitAxis]);
+            float origin = centerLo[splitAxis];
+            uint32_t *begin = triangleIds.data() + first;
+            middle = first + (uint32_t)(std::partition(begin, begin + count, [&](uint32_t id) {
+                return std::min(BINS - 1, (int)((b.center[id][splitAxis] - origin) * scale)) < splitBin;
+            }) - begin);
+        }
+
+        uint32_t left = b.used.fetch_add(2);
+        node.leftOrFirst = left;
+        node.count = 0;
+        uint32_t leftCount = middle - first, rightCount = count - leftCount;
+        if (depth < b.parallelDepth && count >= PARALLEL_THRESHOLD) {
+            std::future<void> job = std::async(std::launch::async, [&]() {
+                build_node(b, left, first, leftCount, depth + 1);
+            });
+            build_node(b, left + 1, middle, rightCount, depth + 1);
+            job.get();
+        } else {
+            build_node(b, left, first, leftCount, depth + 1);
+            build_node(b, left + 1, middle, rightCount, depth + 1);
+        }
+    }
+
+#ifdef MESH_BVH_SSE
+    struct RayData
+    {
+        __m128 origin, inverse;
+        RayData(const glm::vec3 &o, const glm::vec3 &inv):
+            origin(_mm_setr_ps(o.x, o.y, o.z, 0.0f)), inverse(_mm_setr_ps(inv.x, inv.y, inv.z, 0.0f)) {}
+    };
+
+    // Slab test on all three axes at once. The fourth lane of each load holds an index
+    // field, so it is overwritten with the third before the horizontal min and max.
+    static bool intersect_box(const BVHNode &n, const RayData &ray, float tMax, float &tNear)
+    {
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.min), ray.origin), ray.inverse);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n.max), ray.origin), ray.inverse);
+        __m128 enter = _mm_min_ps(t1, t2), exit = _mm_max_ps(t1, t2);
+        enter = _mm_shuffle_ps(enter, enter, _MM_SHUFFLE(2, 2, 1, 0));
+        exit = _mm_shuffle_ps(exit, exit, _MM_SHUFFLE(2, 2, 1, 0));
+        enter = _mm_max_ps(enter, _mm_shuffle_ps(enter, enter, _MM_SHUFFLE(1, 0, 3, 2)));
+        enter = _mm_max_ps(enter, _mm_shuffle_ps(enter, enter, _MM_SHUFFLE(2, 3, 0, 1)));
+        exit = _mm_min_ps(exit, _mm_shuffle_ps(exit, exit, _MM_SHUFFLE(1, 0, 3, 2)));
+        exit = _mm_min_ps(exit, _mm_shuffle_ps(exit, exit, _MM_SHUFFLE(2, 3, 0, 1)));
+        float start = std::max(_mm_cvtss_f32(enter), 0.0f);
+        tNear = start;
+        return _mm_cvtss_f32(exit) >= start && start < tMax;
+    }
+
+    static bool overlaps(const float *nodeMin, const float *nodeMax, const glm::vec3 &lo, const glm::vec3 &hi)
+    {
+        __m128 below = _mm_cmple_ps(_mm_loadu_ps(nodeMin), _mm_setr_ps(hi.x, hi.y, hi.z, 0.0f));
+        __m128 above = _mm_cmpge_ps(_mm_loadu_ps(nodeMax), _mm_setr_ps(lo.x, lo.y, lo.z, 0.0f));
+        return (_mm_movemask_ps(_mm_and_ps(below, above)) & 7) == 7;
+    }
+#else
+    struct RayData
+    {
+        glm::vec3 origin, inverse;
+        RayData(const glm::vec3 &o, const glm::vec3 &inv): origin(o), inverse(inv) {}
+    };
+
+    static bool intersect_box(const BVHNode &n, const RayData &ray, float tMax, float &tNear)
+    {
+        float enter = 0.0f, exit = FLT_MAX;
+        for (int k = 0; k < 3; k++) {
+            float t1 = (n.min[k] - ray.origin[k]) * ray.inverse[k];
+            float t2 = (n.max[k] - ray.origin[k]) * ray.inverse[k];
+            enter = std::max(enter, std::min(t1, t2));
+            exit = std::min(exit, std::max(t1, t2));
+        }
+        tNear = enter;
+        return exit >= enter && enter < tMax;
+    }
+
+    static bool overlaps(const float *nodeMin, const float *nodeMax, const glm::vec3 &lo, const glm::vec3 &hi)
+    {
+        for (int k = 0; k < 3; k++) {
+            if (nodeMin[k] > hi[k] || nodeMax[k] < lo[k])
+                return false;
+        }
+        return true;
+    }
+#endif
+
+    static bool intersect_triangle(const Triangle &tri, const glm::vec3 &origin, const glm::vec3 &direction,
+                                   RayHit &hit)
+    {
+        glm::vec3 p = glm::cross(direction, tri.e2);
+        float det = glm::dot(tri.e1, p);
+        if (std::fabs(det) < 1e-12f)
+            return false;
+        float inverse = 1.0f / det;
+        glm::vec3 s = origin - tri.v0;
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, tri.e1);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        float t = glm::dot(tri.e2, q) * inverse;
+        if (t <= 0.0f || t >= hit.t)
+            return false;
+        hit.t = t;
+        hit.u = u;
+        hit.v = v;
+        return true;
+    }
+};
+
+#endif
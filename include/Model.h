@@ -2,34 +2,285 @@
 #define MODEL_H
 
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include "Animation.h"
+#include "AnimationCompression.h"
+#include "JobSystem.h"
 #include "Mesh.h"
+#include "Profiler.h"
+#include "Skinning.h"
+#include "shader.h"
 
+// Uniform buffer binding of the shaders' JointPalette block
+const GLuint JOINT_PALETTE_BINDING = 0;
+
+// Binds a palette of identity matrices at JOINT_PALETTE_BINDING, so shaders declaring the
+// block have a buffer behind it before any skinned mesh has drawn, or when none ever does.
+// Skinned draws bind their own palettes over it.
+inline GLuint bind_default_joint_palette()
+{
+    std::vector<glm::mat4> identity(MAX_PALETTE_JOINTS, glm::mat4(1.0f));
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * identity.size(), identity.data(), GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, JOINT_PALETTE_BINDING, buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return buffer;
+}
+
+// A node of the imported hierarchy. Nodes are stored parents first, so global transforms
+// can be computed in one pass over the array.
+struct ModelNode
+{
+    std::string name;
+    int parent;                        // -1 for the root
+    glm::mat4 local;
+    glm::mat4 global;                  // relative to the model's origin
+    std::vector<unsigned int> meshes;  // indices into Model's meshes
+};
+
+// Each aiMesh is uploaded once. The node hierarchy is kept as a transform tree, and every
+// node reference to a mesh becomes an instance of it, so repeated parts share one set of
+// buffers and draw with one call per mesh however many times they are placed.
+//
+// Given a job system, meshes are converted on the workers and each one's upload is handed
+// back to the calling thread, which must own the GL context, as soon as it is ready, so
+// uploads overlap with converting the remaining meshes.
+//
+// Every node is also a joint of `skeleton`, and the file's animations become `clips`,
+// compressed as they are imported.
+// Posing the model moves meshes attached to nodes through their instances and updates
+// the joint palettes of meshes with bone weights. Those are skinned in the vertex shader
+// from a uniform buffer per mesh, or with cpuSkinning on the CPU, re-uploading the vertices.
 class Model 
 {
 public:
-    Model(std::string filepath)
+    std::vector<ModelNode> nodes;
+    Skeleton skeleton;
+    std::vector<CompressedClip> clips;
+    bool cpuSkinning = false;
+
+    Model(std::string filepath, JobSystem *jobs = nullptr)
     {
+        PROFILE_SCOPE("Model::Model");
         Assimp::Importer importer;
 	    const aiScene *scene = importer.ReadFile(filepath, aiProcess_Triangulate);
 	    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode){
     		std::cout << importer.GetErrorString() << std::endl;
         }
     	printNodeNames(scene->mRootNode, 0);
-	    process_node(scene, scene->mRootNode, aiMatrix4x4());
+        meshes.resize(scene->mNumMeshes);
+        skins.resize(scene->mNumMeshes);
+        if (jobs) {
+            JobCounter imported;
+            for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+                const aiMesh *source = scene->mMeshes[i];
+                jobs->run([this, jobs, source, i, &imported]() {
+                    std::shared_ptr<MeshData> data(new MeshData());
+                    process_mesh(source, *data);
+                    jobs->run_on_main([this, data, i]() {
+                        upload_mesh(i, *data);
+                    }, &imported);
+                }, &imported);
+            }
+            jobs->wait(imported);
+        } else {
+            for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+                MeshData data;
+                process_mesh(scene->mMeshes[i], data);
+                upload_mesh(i, data);
+            }
+        }
+        process_node(scene->mRootNode, -1);
+        add_joints(scene->mRootNode, -1, skeleton);
+        std::vector<AnimationClip> imported;
+        process_animations(scene, skeleton, imported);
+        for (const AnimationClip &clip: imported)
+            clips.push_back(CompressedClip(clip, skeleton));
+        setup_skins();
+        update_instances();
     }
 
-    void draw()
+    // Sets `skinned` for each mesh, so shader must be the one in use
+    void draw(const Shader &shader)
     {
-        for (Mesh m: meshes) 
-            m.draw();
+        PROFILE_SCOPE("Model::draw");
+        bool skinned = false;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            bool gpuSkinned = !cpuSkinning && paletteBuffers[i];
+            if (gpuSkinned)
+                glBindBufferBase(GL_UNIFORM_BUFFER, JOINT_PALETTE_BINDING, paletteBuffers[i]);
+            if (gpuSkinned != skinned) {
+                shader.set_bool("skinned", gpuSkinned);
+                skinned = gpuSkinned;
+            }
+            meshes[i].draw();
+        }
+        if (skinned)
+            shader.set_bool("skinned", false);
+    }
+
+    // Poses the model time seconds into its first clip; without clips it keeps the bind pose
+    void animate(float time)
+    {
+        PROFILE_SCOPE("Model::animate");
+        if (clips.empty())
+            return;
+        clips[0].sample(skeleton, time, pose);
+        apply_pose(pose);
+    }
+
+    // Places the meshes for a pose of the skeleton
+    void apply_pose(const std::vector<JointPose> &jointPoses)
+    {
+        pose_to_model(skeleton, jointPoses, jointModel);
+        place_meshes();
+        skin_meshes();
+    }
+
+    const std::vector<Mesh> &get_meshes() const { return meshes; }
+
+    glm::vec4 bounding_sphere() const
+    {
+        glm::vec3 lo(1e30f), hi(-1e30f);
+        for (const Mesh &m: meshes) {
+            glm::vec3 meshLo(1e30f), meshHi(-1e30f);
+            m.extend_bounds(meshLo, meshHi);
+            if (meshLo.x > meshHi.x)
+                continue;
+            for (const glm::mat4 &t: m.instances) {
+                for (int corner = 0; corner < 8; corner++) {
+                    glm::vec3 p(corner & 1 ? meshHi.x : meshLo.x,
+                                corner & 2 ? meshHi.y : meshLo.y,
+                                corner & 4 ? meshHi.z : meshLo.z);
+                    glm::vec3 q(t * glm::vec4(p, 1.0f));
+                    lo = glm::min(lo, q);
+                    hi = glm::max(hi, q);
+                }
+            }
+        }
+        return Mesh::sphere_around(lo, hi);
+    }
+
+    // Recomputes global node transforms and re-uploads every mesh's instance list, after
+    // changing a node's local transform
+    void update_instances()
+    {
+        jointModel.resize(nodes.size());
+        for (size_t n = 0; n < nodes.size(); n++) {
+            ModelNode &node = nodes[n];
+            node.global = node.parent < 0 ? node.local : nodes[node.parent].global * node.local;
+            jointModel[n] = node.global;
+        }
+        place_meshes();
+        skin_meshes();
+        size_t instances = 0, skinned = 0;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            instances += meshes[i].instances.size();
+            skinned += skins[i].empty() ? 0 : 1;
+        }
+        std::cout << meshes.size() << " meshes (" << skinned << " skinned), " << instances << " instances, " 
+                  << skeleton.size() << " joints, " << clips.size() << " clips" << std::endl;
+    }
+
+    const std::vector<SkinBinding> &get_skins() const { return skins; }
+
+    // Assimp to our vertex layout, skin and bone list; no GL calls, so it can run on any thread
+    struct MeshData
+    {
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        std::vector<VertexSkin> skin;
+        SkinBinding binding;
+    };
+
+    static void process_mesh(const aiMesh *mesh, MeshData &data)
+    {
+        std::vector<Vertex> &vertices = data.vertices;
+        std::vector<unsigned int> &indices = data.indices;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3);
+        for (unsigned int j = 0; j < mesh->mNumVertices; j++) {
+            aiVector3D position = mesh->mVertices[j];
+            aiVector3D normal = mesh->HasNormals() ? mesh->mNormals[j] : aiVector3D(0.0f, 1.0f, 0.0f);
+            glm::vec3 pos(position.x, position.y, position.z);
+            glm::vec3 norm(normal.x, normal.y, normal.z);
+            vertices.push_back(Vertex(pos, norm));
+        }
+        for (unsigned int j = 0; j < mesh->mNumFaces; j++) {
+            aiFace face = mesh->mFaces[j];
+            for (unsigned int k = 0; k < face.mNumIndices; k++) {
+                indices.push_back(face.mIndices[k]);
+            }
+        }
+        process_bones(mesh, data);
+    }
+
+    // Skeleton from the node hierarchy, in the same order as `nodes`
+    static void add_joints(const aiNode *node, int parent, Skeleton &skeleton)
+    {
+        aiVector3D scaling, position;
+        aiQuaternion rotation;
+        node->mTransformation.Decompose(scaling, rotation, position);
+        JointPose bind;
+        bind.translation = glm::vec3(position.x, position.y, position.z);
+        bind.rotation = glm::quat(rotation.w, rotation.x, rotation.y, rotation.z);
+        bind.scale = glm::vec3(scaling.x, scaling.y, scaling.z);
+        int index = (int)skeleton.size();
+        skeleton.names.push_back(node->mName.C_Str());
+        skeleton.parents.push_back(parent);
+        skeleton.bindPose.push_back(bind);
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+            add_joints(node->mChildren[i], index, skeleton);
+    }
+
+    // Channels are matched to joints by node name; key times go from ticks to seconds
+    static void process_animations(const aiScene *scene, const Skeleton &skeleton, std::vector<AnimationClip> &clips)
+    {
+        for (unsigned int a = 0; a < scene->mNumAnimations; a++) {
+            const aiAnimation *animation = scene->mAnimations[a];
+            double ticks = animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+            AnimationClip clip;
+            clip.name = animation->mName.C_Str();
+            clip.duration = (float)(animation->mDuration / ticks);
+            clip.tracks.resize(skeleton.size());
+            for (unsigned int c = 0; c < animation->mNumChannels; c++) {
+                const aiNodeAnim *channel = animation->mChannels[c];
+                int joint = skeleton.find(channel->mNodeName.C_Str());
+                if (joint < 0)
+                    continue;
+                JointTrack &track = clip.tracks[joint];
+                for (unsigned int k = 0; k < channel->mNumPositionKeys; k++) {
+                    const aiVectorKey &key = channel->mPositionKeys[k];
+                    track.translations.push_back({(float)(key.mTime / ticks), glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z)});
+                }
+                for (unsigned int k = 0; k < channel->mNumRotationKeys; k++) {
+                    const aiQuatKey &key = channel->mRotationKeys[k];
+                    track.rotations.push_back({(float)(key.mTime / ticks), glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z)});
+                }
+                for (unsigned int k = 0; k < channel->mNumScalingKeys; k++) {
+                    const aiVectorKey &key = channel->mScalingKeys[k];
+                    track.scales.push_back({(float)(key.mTime / ticks), glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z)});
+                }
+            }
+            clips.push_back(std::move(clip));
+        }
     }
 
 private:
     std::vector<Mesh> meshes;
+    std::vector<SkinBinding> skins;          // per mesh, empty for meshes without bones
+    std::vector<GLuint> paletteBuffers;      // per mesh, 0 for meshes without bones
+    std::vector<JointPose> pose;
+    std::vector<glm::mat4> jointModel;       // each joint relative to the model's origin
+    std::vector<glm::mat4> palette;          // scratch for one mesh's palette
+    std::vector<Vertex> skinned;             // scratch for CPU skinning
 
     void printNodeNames(aiNode *root, unsigned int lvl)
     {
@@ -42,36 +293,127 @@ private:
         }
     }
 
-    void process_node(const aiScene * scene, const aiNode *node, aiMatrix4x4 parentTransform)
-    {
-        /*aiMatrix4x4 transform = parentTransform * node->mTransformation;
-        aiMatrix4x4 ntransform = transform.Inverse().Transpose();*/
-        aiMatrix4x4 transform = parentTransform;
-        aiMatrix4x4 ntransform = parentTransform;
-        for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-            std::cout << node->mName.C_Str() << std::endl;
-            std::vector<Vertex> vertices;
-            std::vector<unsigned int> indices;
-            aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-            for (unsigned int j = 0; j < mesh->mNumVertices; j++) {
-                aiVector3D position = ntransform * mesh->mVertices[j];
-                aiVector3D normal = ntransform * mesh->mNormals[j];			
-                glm::vec3 pos(position.x, position.y, position.z);
-                glm::vec3 norm(normal.x, normal.y, normal.z);
-                vertices.push_back(Vertex(pos, norm));
-            }
-            for (unsigned int j = 0; j < mesh->mNumFaces; j++) {
-                aiFace face = mesh->mFaces[j];
-                for (unsigned int k = 0; k < face.mNumIndices; k++) {
-                    indices.push_back(face.mIndices[k]);
+    static glm::mat4 to_glm(const aiMatrix4x4 &m)
+    {
+        // Assimp matrices are row-major, glm's are column-major
+        glm::mat4 result;
+        for (int row = 0; row < 4; row++) {
+            for (int column = 0; column < 4; column++)
+                result[column][row] = m[row][column];
+        }
+        return result;
+    }
+
+    // Up to four heaviest bones per vertex, renormalized. Meshes with more bones than a
+    // palette holds keep the first MAX_PALETTE_JOINTS.
+    static void process_bones(const aiMesh *mesh, MeshData &data)
+    {
+        if (!mesh->HasBones())
+            return;
+        unsigned int bones = std::min(mesh->mNumBones, MAX_PALETTE_JOINTS);
+        if (bones < mesh->mNumBones)
+            std::cout << mesh->mName.C_Str() << ": " << mesh->mNumBones << " bones, using the first " << bones << std::endl;
+        VertexSkin empty = {{0, 0, 0, 0}, {0.0f, 0.0f, 0.0f, 0.0f}};
+        data.skin.assign(mesh->mNumVertices, empty);
+        for (unsigned int b = 0; b < bones; b++) {
+            const aiBone *bone = mesh->mBones[b];
+            data.binding.names.push_back(bone->mName.C_Str());
+            data.binding.inverseBind.push_back(to_glm(bone->mOffsetMatrix));
+            for (unsigned int w = 0; w < bone->mNumWeights; w++) {
+                const aiVertexWeight &weight = bone->mWeights[w];
+                VertexSkin &s = data.skin[weight.mVertexId];
+                int lightest = 0;
+                for (int k = 1; k < 4; k++) {
+                    if (s.weights[k] < s.weights[lightest])
+                        lightest = k;
                 }
+                if (weight.mWeight > s.weights[lightest]) {
+                    s.joints[lightest] = (unsigned short)b;
+                    s.weights[lightest] = weight.mWeight;
+                }
+            }
+        }
+        for (VertexSkin &s: data.skin) {
+            float total = s.weights[0] + s.weights[1] + s.weights[2] + s.weights[3];
+            for (int k = 0; k < 4; k++)
+                s.weights[k] = total > 0.0f ? s.weights[k] / total : (k == 0 ? 1.0f : 0.0f);
+        }
+    }
+
+    void upload_mesh(unsigned int i, MeshData &data)
+    {
+        meshes[i] = Mesh(std::move(data.vertices), std::move(data.indices));
+        if (!data.skin.empty())
+            meshes[i].set_skin(std::move(data.skin));
+        skins[i] = std::move(data.binding);
+    }
+
+    // Bones to joints by name, and a palette buffer for each skinned mesh
+    void setup_skins()
+    {
+        paletteBuffers.assign(meshes.size(), 0);
+        for (size_t i = 0; i < meshes.size(); i++) {
+            SkinBinding &binding = skins[i];
+            if (binding.empty())
+                continue;
+            binding.joints.resize(binding.names.size());
+            for (size_t b = 0; b < binding.names.size(); b++)
+                binding.joints[b] = skeleton.find(binding.names[b]);
+            glGenBuffers(1, &paletteBuffers[i]);
+            glBindBuffer(GL_UNIFORM_BUFFER, paletteBuffers[i]);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * MAX_PALETTE_JOINTS, nullptr, GL_DYNAMIC_DRAW);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        palette.resize(MAX_PALETTE_JOINTS);
+    }
+
+    // Meshes attached to nodes follow them through their instances. Skinned meshes are
+    // placed by their palettes, so their instances stay at the origin.
+    void place_meshes()
+    {
+        for (Mesh &m: meshes)
+            m.instances.clear();
+        for (size_t n = 0; n < nodes.size(); n++) {
+            for (unsigned int m: nodes[n].meshes)
+                meshes[m].instances.push_back(skins[m].empty() ? jointModel[n] : glm::mat4(1.0f));
+        }
+        for (Mesh &m: meshes)
+            m.uploadInstances();
+    }
+
+    void skin_meshes()
+    {
+        for (size_t i = 0; i < meshes.size(); i++) {
+            const SkinBinding &binding = skins[i];
+            if (binding.empty())
+                continue;
+            binding.palette(jointModel, palette.data());
+            if (cpuSkinning) {
+                Mesh &mesh = meshes[i];
+                skinned.resize(mesh.vertices.size(), Vertex(glm::vec3(0.0f), glm::vec3(0.0f)));
+                skin_vertices(palette.data(), mesh.vertices.data(), mesh.skin.data(), mesh.vertices.size(), skinned.data());
+                mesh.update_vertices(skinned.data());
+            } else {
+                glBindBuffer(GL_UNIFORM_BUFFER, paletteBuffers[i]);
+                glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4) * binding.joints.size(), palette.data());
             }
-            meshes.push_back(Mesh(vertices, indices));
         }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void process_node(const aiNode *node, int parent)
+    {
+        ModelNode entry;
+        entry.name = node->mName.C_Str();
+        entry.parent = parent;
+        entry.local = to_glm(node->mTransformation);
+        entry.meshes.assign(node->mMeshes, node->mMeshes + node->mNumMeshes);
+        int index = (int)nodes.size();
+        nodes.push_back(entry);
         for (unsigned int i = 0; i < node->mNumChildren; i++) {
-            process_node(scene, node->mChildren[i], transform);		
+            process_node(node->mChildren[i], index);		
         }
     }   
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,147 @@
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <cfloat>
+#include <map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Mesh.h"
+#include "MeshBVH.h"
+#include "Scene.h"
+#include "Terrain.h"
+
+struct PickResult
+{
+    bool hit = false;
+    Entity entity = NO_ENTITY;
+    unsigned int mesh = 0;       // index within the entity's renderable
+    unsigned int instance = 0;
+    unsigned int triangle = 0;   // index into the mesh's index buffer divided by 3
+    float u = 0.0f;              // barycentric coordinates within the triangle
+    float v = 0.0f;
+    float distance = FLT_MAX;    // along the normalized ray, in world units
+    glm::vec3 position;
+};
+
+// Cursor position in window coordinates (origin top left) to a world-space ray from the
+// near plane, through the inverse of the camera's view-projection
+inline void cursor_ray(double x, double y, float width, float height, const glm::mat4 &viewProjection,
+                       glm::vec3 &origin, glm::vec3 &direction)
+{
+    float ndcX = (float)(2.0 * x / width - 1.0);
+    float ndcY = (float)(1.0 - 2.0 * y / height);
+    glm::mat4 inverse = glm::inverse(viewProjection);
+    glm::vec4 nearPoint = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverse * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    origin = glm::vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
+
+// CPU ray picking against the scene. Candidate entities come from the scene BVH, closest
+// boxes cutting the search short, then the ray is moved into each mesh instance's space
+// and traced through that mesh's triangle BVH. Transforming the ray rather than the
+// triangles keeps the ray parameter, so distances compare across instances without
+// rescaling. Terrain has no fixed triangles, so its ray marches the heightmap instead.
+// Nothing is read back from the GPU.
+class Picker
+{
+public:
+    // Registers the geometry drawn for a renderable handle, building a triangle BVH per mesh
+    void add_renderable(int handle, const std::vector<Mesh> &meshes)
+    {
+        if (handle >= (int)renderables.size())
+            renderables.resize(handle + 1);
+        std::vector<Target> &targets = renderables[handle];
+        targets.clear();
+        targets.resize(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++) {
+            targets[i].bvh.build(meshes[i]);
+            for (const glm::mat4 &instance: meshes[i].instances)
+                targets[i].inverseInstances.push_back(glm::inverse(instance));
+        }
+    }
+
+    void add_renderable(int handle, const Mesh &mesh)
+    {
+        add_renderable(handle, std::vector<Mesh>(1, mesh));
+    }
+
+    // Registers a renderable drawn as terrain with these settings. Its hits report mesh,
+    // instance and triangle 0.
+    void add_terrain(int handle, const TerrainSettings &settings)
+    {
+        terrains[handle] = settings;
+    }
+
+    // Takes the current placements of a renderable's meshes, e.g. after posing a model, and
+    // keeps the triangle BVHs. Skinned meshes are still picked in their bind pose.
+    void update_instances(int handle, const std::vector<Mesh> &meshes)
+    {
+        std::vector<Target> &targets = renderables[handle];
+        for (size_t i = 0; i < meshes.size() && i < targets.size(); i++) {
+            targets[i].inverseInstances.clear();
+            for (const glm::mat4 &instance: meshes[i].instances)
+                targets[i].inverseInstances.push_back(glm::inverse(instance));
+        }
+    }
+
+    PickResult pick(const Scene &scene, const glm::vec3 &origin, const glm::vec3 &direction) const
+    {
+        PickResult result;
+        scene.bvh.query_ray(origin, direction, FLT_MAX, [&](uint32_t e) {
+            int handle = scene.renderables[e];
+            auto terrain = terrains.find(handle);
+            if (terrain == terrains.end() && (handle < 0 || handle >= (int)renderables.size()))
+                return result.distance;
+            glm::mat4 toEntity = glm::inverse(scene.world[e]);
+            glm::vec3 entityOrigin(toEntity * glm::vec4(origin, 1.0f));
+            glm::vec3 entityDirection(toEntity * glm::vec4(direction, 0.0f));
+            float t;
+            if (terrain != terrains.end()) {
+                if (terrain_intersect_ray(terrain->second, entityOrigin, entityDirection, result.distance, t)) {
+                    result = PickResult();
+                    result.hit = true;
+                    result.entity = e;
+                    result.distance = t;
+                }
+                return result.distance;
+            }
+            const std::vector<Target> &targets = renderables[handle];
+            for (unsigned int m = 0; m < targets.size(); m++) {
+                const Target &target = targets[m];
+                for (unsigned int i = 0; i < target.inverseInstances.size(); i++) {
+                    const glm::mat4 &toMesh = target.inverseInstances[i];
+                    RayHit hit;
+                    hit.t = result.distance;
+                    if (!target.bvh.intersect_ray(glm::vec3(toMesh * glm::vec4(entityOrigin, 1.0f)),
+                                                  glm::vec3(toMesh * glm::vec4(entityDirection, 0.0f)), hit))
+                        continue;
+                    result.hit = true;
+                    result.entity = e;
+                    result.mesh = m;
+                    result.instance = i;
+                    result.triangle = hit.triangle;
+                    result.u = hit.u;
+                    result.v = hit.v;
+                    result.distance = hit.t;
+                }
+            }
+            return result.distance;
+        });
+        if (result.hit)
+            result.position = origin + direction * result.distance;
+        return result;
+    }
+
+private:
+    struct Target
+    {
+        MeshBVH bvh;
+        std::vector<glm::mat4> inverseInstances;
+    };
+
+    std::vector<std::vector<Target>> renderables;   // indexed by renderable handle
+    std::map<int, TerrainSettings> terrains;        // by renderable handle
+};
+
+#endif
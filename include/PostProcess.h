@@ -0,0 +1,209 @@
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "FrameGraph.h"
+#include "GpuProfiler.h"
+#include "Mesh.h"
+#include "shader.h"
+
+struct PostProcessSettings
+{
+    float renderScale = 1.0f;   // internal resolution relative to the output
+    bool bloom = true;
+    bool tonemap = true;
+    bool fxaa = true;
+    int bloomLevels = 5;
+    float bloomThreshold = 1.0f;
+    float bloomIntensity = 0.05f;
+    float exposure = 1.0f;
+};
+
+// HDR scene target -> bloom pyramid -> tonemap -> FXAA, all drawn with the screen quad into
+// frame graph targets so the pool ping-pongs between them. Besides the per-pass times the
+// frame graph records, the bloom pyramid and the whole chain are timed as "bloom" and "post".
+class PostProcess
+{
+public:
+    PostProcessSettings settings;
+
+    PostProcess(const std::string &shaderdir, Mesh &screenQuad, GpuProfiler &profiler):
+        screenQuad(screenQuad),
+        profiler(profiler),
+        downShader(shaderdir + "screen_vert.glsl", shaderdir + "bloom_down_frag.glsl"),
+        upShader(shaderdir + "screen_vert.glsl", shaderdir + "bloom_up_frag.glsl"),
+        tonemapShader(shaderdir + "screen_vert.glsl", shaderdir + "tonemap_frag.glsl"),
+        fxaaShader(shaderdir + "screen_vert.glsl", shaderdir + "fxaa_frag.glsl")
+    {
+    }
+
+    // The size the scene should be rendered at before post-processing
+    TextureDesc scene_desc(const TextureDesc &output) const
+    {
+        TextureDesc desc = {(GLsizei)(output.width * settings.renderScale),
+                            (GLsizei)(output.height * settings.renderScale), GL_RGBA16F};
+        return desc;
+    }
+
+    void add_passes(FrameGraph &graph, FrameGraph::Resource scene, FrameGraph::Resource output)
+    {
+        FrameGraph::Resource bloom = -1;
+        if (settings.bloom)
+            bloom = add_bloom_passes(graph, scene);
+
+        FrameGraph::Resource ldr = output;
+        graph.add_pass("tonemap", [&](FrameGraph::Builder &builder) {
+            builder.read(scene);
+            if (bloom != -1)
+                builder.read(bloom);
+            if (settings.fxaa) {
+                TextureDesc desc = graph.desc(scene);
+                desc.internalFormat = GL_RGBA8;
+                ldr = builder.create("ldr", desc);
+            } else {
+                builder.write(output);
+            }
+            bool last = !settings.fxaa;
+            return [this, scene, bloom, last](const FrameGraph::Context &context) {
+                if (bloom == -1)
+                    postZone = profiler.begin("post");
+                context.bind_target();
+                tonemapShader.use();
+                tonemapShader.set_int("screenTexture", 0);
+                tonemapShader.set_int("bloomTexture", 1);
+                tonemapShader.set_bool("bloom", bloom != -1);
+                tonemapShader.set_bool("tonemap", settings.tonemap);
+                tonemapShader.set_float("bloomIntensity", settings.bloomIntensity);
+                tonemapShader.set_float("exposure", settings.exposure);
+                bind_texture(0, context.texture(scene));
+                if (bloom != -1)
+                    bind_texture(1, context.texture(bloom));
+                draw_quad();
+                if (last)
+                    profiler.end(postZone);
+            };
+        });
+
+        if (settings.fxaa) {
+            graph.add_pass("fxaa", [&](FrameGraph::Builder &builder) {
+                builder.read(ldr);
+                builder.write(output);
+                return [this, ldr](const FrameGraph::Context &context) {
+                    context.bind_target();
+                    const TextureDesc &desc = context.desc(ldr);
+                    fxaaShader.use();
+                    fxaaShader.set_int("screenTexture", 0);
+                    fxaaShader.set_vec2("inverseScreenSize", 1.0f / desc.width, 1.0f / desc.height);
+                    bind_texture(0, context.texture(ldr));
+                    draw_quad();
+                    profiler.end(postZone);
+                };
+            });
+        }
+    }
+
+private:
+    Mesh &screenQuad;
+    GpuProfiler &profiler;
+    Shader downShader;
+    Shader upShader;
+    Shader tonemapShader;
+    Shader fxaaShader;
+    int postZone = -1;
+    int bloomZone = -1;
+
+    // Downsample into a half-resolution pyramid, the first step also thresholding, then walk
+    // back up adding each level onto the next larger one.
+    FrameGraph::Resource add_bloom_passes(FrameGraph &graph, FrameGraph::Resource scene)
+    {
+        std::vector<FrameGraph::Resource> levels;
+        std::vector<TextureDesc> levelDescs;
+        FrameGraph::Resource source = scene;
+        TextureDesc sourceDesc = graph.desc(scene);
+        for (int i = 0; i < settings.bloomLevels; i++) {
+            TextureDesc desc = {sourceDesc.width / 2, sourceDesc.height / 2, GL_R11F_G11F_B10F};
+            if (desc.width < 8 || desc.height < 8)
+                break;
+            bool first = i == 0;
+            FrameGraph::Resource level = -1;
+            graph.add_pass("bloomDown" + std::to_string(i), [&](FrameGraph::Builder &builder) {
+                builder.read(source);
+                level = builder.create("bloomDown" + std::to_string(i), desc);
+                return [this, source, sourceDesc, first](const FrameGraph::Context &context) {
+                    if (first) {
+                        postZone = profiler.begin("post");
+                        bloomZone = profiler.begin("bloom");
+                    }
+                    context.bind_target();
+                    downShader.use();
+                    downShader.set_int("sourceTexture", 0);
+                    downShader.set_bool("prefilter", first);
+                    downShader.set_float("threshold", settings.bloomThreshold);
+                    downShader.set_vec2("sourceTexelSize", 1.0f / sourceDesc.width, 1.0f / sourceDesc.height);
+                    bind_texture(0, context.texture(source));
+                    draw_quad();
+                };
+            });
+            levels.push_back(level);
+            levelDescs.push_back(desc);
+            source = level;
+            sourceDesc = desc;
+        }
+        if (levels.empty())
+            return -1;
+
+        FrameGraph::Resource result = levels.back();
+        if (levels.size() == 1) {
+            graph.add_pass("bloomEnd", [&](FrameGraph::Builder &builder) {
+                builder.read(result);
+                builder.side_effect();
+                return [this](const FrameGraph::Context &) { profiler.end(bloomZone); };
+            });
+            return result;
+        }
+        for (int i = (int)levels.size() - 2; i >= 0; i--) {
+            FrameGraph::Resource smaller = result;
+            TextureDesc smallerDesc = levelDescs[i + 1];
+            FrameGraph::Resource current = levels[i];
+            bool last = i == 0;
+            graph.add_pass("bloomUp" + std::to_string(i), [&](FrameGraph::Builder &builder) {
+                builder.read(smaller);
+                builder.read(current);
+                result = builder.create("bloomUp" + std::to_string(i), levelDescs[i]);
+                return [this, smaller, smallerDesc, current, last](const FrameGraph::Context &context) {
+                    context.bind_target();
+                    upShader.use();
+                    upShader.set_int("sourceTexture", 0);
+                    upShader.set_int("currentTexture", 1);
+                    upShader.set_vec2("sourceTexelSize", 1.0f / smallerDesc.width, 1.0f / smallerDesc.height);
+                    bind_texture(0, context.texture(smaller));
+                    bind_texture(1, context.texture(current));
+                    draw_quad();
+                    if (last)
+                        profiler.end(bloomZone);
+                };
+            });
+        }
+        return result;
+    }
+
+    void bind_texture(int unit, GLuint texture) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        render_stats().stateChanges++;
+    }
+
+    void draw_quad()
+    {
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        screenQuad.draw();
+    }
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// CPU zone profiling. PROFILE_SCOPE("name") times the rest of the enclosing scope and
+// PROFILE_FUNCTION() uses the function name. Both compile to nothing unless ENABLE_PROFILER
+// is defined. Names must be string literals or otherwise outlive the program.
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#ifdef ENABLE_PROFILER
+#define PROFILE_SCOPE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#endif
+
+namespace Profiler
+{
+    struct Event
+    {
+        const char *name;
+        uint64_t start;     // nanoseconds since the profiler's epoch
+        uint64_t duration;
+    };
+
+    // One per thread, written only by its owner. Events go into a ring so a long session
+    // keeps the most recent CAPACITY zones; count is published with release ordering so an
+    // exporting thread sees whole events without taking a lock on the hot path.
+    struct EventBuffer
+    {
+        static const uint32_t CAPACITY = 1 << 16;
+        std::atomic<uint32_t> count{0};
+        uint32_t threadId;
+        std::vector<Event> events = std::vector<Event>(CAPACITY);
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<EventBuffer *> buffers;
+    };
+
+    inline Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    inline std::chrono::steady_clock::time_point epoch()
+    {
+        static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        return start;
+    }
+
+    inline uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch()).count();
+    }
+
+    // Buffers are registered once per thread and never freed, so events from threads that
+    // have exited can still be exported.
+    inline EventBuffer *thread_buffer()
+    {
+        thread_local EventBuffer *buffer = nullptr;
+        if (!buffer) {
+            buffer = new EventBuffer();
+            Registry &r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            buffer->threadId = (uint32_t)r.buffers.size();
+            r.buffers.push_back(buffer);
+        }
+        return buffer;
+    }
+
+    inline void record(const char *name, uint64_t start, uint64_t end)
+    {
+        EventBuffer *buffer = thread_buffer();
+        uint32_t index = buffer->count.load(std::memory_order_relaxed);
+        Event &event = buffer->events[index % EventBuffer::CAPACITY];
+        event.name = name;
+        event.start = start;
+        event.duration = end - start;
+        buffer->count.store(index + 1, std::memory_order_release);
+    }
+
+    // Writes s as the inside of a JSON string literal
+    inline void write_escaped(std::ofstream &file, const char *s)
+    {
+        static const char hex[] = "0123456789abcdef";
+        for (; *s; s++) {
+            unsigned char c = (unsigned char)*s;
+            if (c == '"' || c == '\\')
+                file << '\\' << *s;
+            else if (c < 0x20)
+                file << "\\u00" << hex[c >> 4] << hex[c & 15];
+            else
+                file << *s;
+        }
+    }
+
+    // Writes every buffered zone in Chrome trace_event format (chrome://tracing, Perfetto).
+    // Zones still being written while the export runs may be missing or torn.
+    inline bool write_chrome_trace(const std::string &path)
+    {
+        std::ofstream file(path);
+        if (!file) {
+            std::cout << "ERROR::PROFILER::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (EventBuffer *buffer: r.buffers) {
+            uint32_t count = buffer->count.load(std::memory_order_acquire);
+            uint32_t begin = count > EventBuffer::CAPACITY ? count - EventBuffer::CAPACITY : 0;
+            for (uint32_t i = begin; i < count; i++) {
+                const Event &event = buffer->events[i % EventBuffer::CAPACITY];
+                file << (first ? "" : ",") << "\n{\"name\":\"";
+                write_escaped(file, event.name);
+                file << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+                     << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << event.duration / 1000.0
+                     << "}";
+                first = false;
+            }
+        }
+        file << "\n]}\n";
+        std::cout << "Wrote CPU trace to " << path << std::endl;
+        return true;
+    }
+}
+
+class ProfileZone
+{
+public:
+    ProfileZone(const char *name): name(name), start(Profiler::now()) {}
+
+    ~ProfileZone() { Profiler::record(name, start, Profiler::now()); }
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+#endif
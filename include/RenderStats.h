@@ -0,0 +1,27 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+// Per-frame counters, reset at the start of each frame
+struct RenderStats
+{
+    unsigned int drawCalls = 0;
+    unsigned int triangles = 0;
+    unsigned int stateChanges = 0;   // program, framebuffer, texture and vertex array binds
+    unsigned int culled = 0;         // objects skipped by frustum culling
+
+    void reset()
+    {
+        drawCalls = 0;
+        triangles = 0;
+        stateChanges = 0;
+        culled = 0;
+    }
+};
+
+inline RenderStats &render_stats()
+{
+    static RenderStats stats;
+    return stats;
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "SceneBVH.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define SCENE_SSE
+#include <xmmintrin.h>
+#endif
+
+typedef unsigned int Entity;
+const Entity NO_ENTITY = ~0u;
+
+// Entities stored as parallel arrays rather than objects, so the transform update streams
+// through exactly the components it needs. A parent must be created before its children,
+// which makes index order a valid update order: one forward pass propagates transforms
+// down any depth of hierarchy. Setting a local transform marks the entity dirty; update()
+// recomputes only dirty entities and their descendants, and moves their boxes in bvh.
+// Entities that are renderable or have bounds are in bvh, keyed by entity.
+class Scene
+{
+public:
+    // Local transform, one array per component
+    std::vector<float> px, py, pz;
+    std::vector<float> qx, qy, qz, qw;
+    std::vector<float> sx, sy, sz;
+    std::vector<Entity> parents;
+    std::vector<glm::vec4> localBounds;   // bounding sphere in local space, radius in w
+    std::vector<int> renderables;         // renderer's handle, -1 for transform-only entities
+
+    // Results of update()
+    std::vector<glm::mat4> world;
+    std::vector<glm::mat3> normal;        // inverse transpose of the world 3x3, for lighting
+    std::vector<glm::vec4> worldBounds;
+    unsigned int updated = 0;             // entities recomputed by the last update()
+    SceneBVH bvh;                         // world bounds, for culling and proximity queries
+
+    Entity size() const { return (Entity)parents.size(); }
+
+    Entity create(Entity parent = NO_ENTITY, int renderable = -1)
+    {
+        Entity e = size();
+        px.push_back(0.0f); py.push_back(0.0f); pz.push_back(0.0f);
+        qx.push_back(0.0f); qy.push_back(0.0f); qz.push_back(0.0f); qw.push_back(1.0f);
+        sx.push_back(1.0f); sy.push_back(1.0f); sz.push_back(1.0f);
+        parents.push_back(parent < e ? parent : NO_ENTITY);
+        localBounds.push_back(glm::vec4(0.0f));
+        renderables.push_back(renderable);
+        world.push_back(glm::mat4(1.0f));
+        normal.push_back(glm::mat3(1.0f));
+        worldBounds.push_back(glm::vec4(0.0f));
+        local.push_back(glm::mat4(1.0f));
+        localDirty.push_back(1);
+        worldDirty.push_back(1);
+        proxies.push_back((int)SceneBVH::NONE);   // a copy: push_back would odr-use the constant
+        return e;
+    }
+
+    void set_position(Entity e, const glm::vec3 &p)
+    {
+        px[e] = p.x; py[e] = p.y; pz[e] = p.z;
+        localDirty[e] = 1;
+    }
+
+    void set_rotation(Entity e, const glm::quat &q)
+    {
+        qx[e] = q.x; qy[e] = q.y; qz[e] = q.z; qw[e] = q.w;
+        localDirty[e] = 1;
+    }
+
+    void set_scale(Entity e, const glm::vec3 &s)
+    {
+        sx[e] = s.x; sy[e] = s.y; sz[e] = s.z;
+        localDirty[e] = 1;
+    }
+
+    void set_bounds(Entity e, const glm::vec4 &sphere)
+    {
+        localBounds[e] = sphere;
+        localDirty[e] = 1;
+    }
+
+    void update()
+    {
+        dirtyList.clear();
+        for (Entity e = 0; e < size(); e++) {
+            if (localDirty[e])
+                dirtyList.push_back(e);
+        }
+        build_local_matrices();
+
+        updated = 0;
+        for (Entity e = 0; e < size(); e++) {
+            Entity parent = parents[e];
+            bool dirty = localDirty[e] || (parent != NO_ENTITY && worldDirty[parent]);
+            worldDirty[e] = dirty;
+            if (!dirty)
+                continue;
+            if (parent == NO_ENTITY)
+                world[e] = local[e];
+            else
+                multiply(world[parent], local[e], world[e]);
+            update_derived(e);
+            update_proxy(e);
+            localDirty[e] = 0;
+            updated++;
+        }
+    }
+
+private:
+    std::vector<glm::mat4> local;
+    std::vector<unsigned char> localDirty;
+    std::vector<unsigned char> worldDirty;   // recomputed in the current update()
+    std::vector<Entity> dirtyList;
+    std::vector<int> proxies;                // bvh proxy of each entity
+
+    // Translation * rotation * scale for every dirty entity, four at a time with one entity
+    // per SIMD lane, then transposed into each entity's matrix columns
+    void build_local_matrices()
+    {
+        size_t count = dirtyList.size();
+        size_t i = 0;
+#ifdef SCENE_SSE
+        for (; i + 4 <= count; i += 4) {
+            const Entity *e = &dirtyList[i];
+#define SCENE_GATHER(a) _mm_setr_ps(a[e[0]], a[e[1]], a[e[2]], a[e[3]])
+            __m128 x = SCENE_GATHER(qx), y = SCENE_GATHER(qy), z = SCENE_GATHER(qz), w = SCENE_GATHER(qw);
+            __m128 scaleX = SCENE_GATHER(sx), scaleY = SCENE_GATHER(sy), scaleZ = SCENE_GATHER(sz);
+            __m128 tx = SCENE_GATHER(px), ty = SCENE_GATHER(py), tz = SCENE_GATHER(pz);
+#undef SCENE_GATHER
+            __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+            __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+            __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+            __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+            __m128 c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), scaleX);
+            __m128 c0y = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), scaleX);
+            __m128 c0z = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), scaleX);
+            __m128 c1x = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), scaleY);
+            __m128 c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), scaleY);
+            __m128 c1z = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), scaleY);
+            __m128 c2x = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), scaleZ);
+            __m128 c2y = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), scaleZ);
+            __m128 c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), scaleZ);
+
+            // After each transpose, register k holds one column of entity k
+            __m128 zero0 = zero, zero1 = zero, zero2 = zero, ones = one;
+            _MM_TRANSPOSE4_PS(c0x, c0y, c0z, zero0);
+            _MM_TRANSPOSE4_PS(c1x, c1y, c1z, zero1);
+            _MM_TRANSPOSE4_PS(c2x, c2y, c2z, zero2);
+            _MM_TRANSPOSE4_PS(tx, ty, tz, ones);
+            __m128 column0[4] = {c0x, c0y, c0z, zero0};
+            __m128 column1[4] = {c1x, c1y, c1z, zero1};
+            __m128 column2[4] = {c2x, c2y, c2z, zero2};
+            __m128 column3[4] = {tx, ty, tz, ones};
+            for (int k = 0; k < 4; k++) {
+                float *m = glm::value_ptr(local[e[k]]);
+                _mm_storeu_ps(m, column0[k]);
+                _mm_storeu_ps(m + 4, column1[k]);
+                _mm_storeu_ps(m + 8, column2[k]);
+                _mm_storeu_ps(m + 12, column3[k]);
+            }
+        }
+#endif
+        for (; i < count; i++) {
+            Entity e = dirtyList[i];
+            glm::mat3 r = glm::mat3_cast(glm::quat(qw[e], qx[e], qy[e], qz[e]));
+            glm::mat4 &m = local[e];
+            m[0] = glm::vec4(r[0] * sx[e], 0.0f);
+            m[1] = glm::vec4(r[1] * sy[e], 0.0f);
+            m[2] = glm::vec4(r[2] * sz[e], 0.0f);
+            m[3] = glm::vec4(px[e], py[e], pz[e], 1.0f);
+        }
+    }
+
+    // out = a * b, each column of the result a linear combination of a's columns
+    static void multiply(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out)
+    {
+#ifdef SCENE_SSE
+        const float *pa = glm::value_ptr(a), *pb = glm::value_ptr(b);
+        __m128 a0 = _mm_loadu_ps(pa), a1 = _mm_loadu_ps(pa + 4);
+        __m128 a2 = _mm_loadu_ps(pa + 8), a3 = _mm_loadu_ps(pa + 12);
+        float *po = glm::value_ptr(out);
+        for (int j = 0; j < 4; j++) {
+            const float *c = pb + 4 * j;
+            __m128 r = _mm_mul_ps(a0, _mm_set1_ps(c[0]));
+            r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(c[1])));
+            r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(c[2])));
+            r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(c[3])));
+            _mm_storeu_ps(po + 4 * j, r);
+        }
+#else
+        out = a * b;
+#endif
+    }
+
+    // Normal matrix from cofactors (the inverse transpose is the cofactor matrix over the
+    // determinant) and the world bounding sphere, scaled by the largest axis scale
+    void update_derived(Entity e)
+    {
+        const glm::mat4 &m = world[e];
+        glm::vec3 c0(m[0]), c1(m[1]), c2(m[2]);
+        glm::vec3 r0 = glm::cross(c1, c2), r1 = glm::cross(c2, c0), r2 = glm::cross(c0, c1);
+        float det = glm::dot(c0, r0);
+        float inv = det != 0.0f ? 1.0f / det : 0.0f;
+        normal[e] = glm::mat3(r0 * inv, r1 * inv, r2 * inv);
+
+        const glm::vec4 &b = localBounds[e];
+        glm::vec4 center = m * glm::vec4(b.x, b.y, b.z, 1.0f);
+        float scale = std::max(glm::length(c0), std::max(glm::length(c1), glm::length(c2)));
+        worldBounds[e] = glm::vec4(center.x, center.y, center.z, b.w * scale);
+    }
+
+    void update_proxy(Entity e)
+    {
+        if (renderables[e] < 0 && localBounds[e].w <= 0.0f)
+            return;
+        const glm::vec4 &sphere = worldBounds[e];
+        glm::vec3 center(sphere.x, sphere.y, sphere.z), extent(sphere.w);
+        if (proxies[e] == SceneBVH::NONE)
+            proxies[e] = bvh.insert(center - extent, center + extent, e);
+        else
+            bvh.move(proxies[e], center - extent, center + extent);
+    }
+};
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "FrameConstants.h"
+
+// Dynamic bounding volume hierarchy over object boxes, for culling and proximity queries.
+// Each object is a leaf holding a fattened copy of its box, so small movements that stay
+// inside it cost nothing; leaving it removes and reinserts the leaf. Insertion picks the
+// sibling that adds the least surface area and rotations keep the tree balanced, but
+// after many moves the tree still drifts from what a fresh build would give, so it tracks
+// its total internal area and rebuilds top-down once that grows past rebuildRatio times
+// the area right after the last build, or at the first check if it has only been grown
+// by insert().
+class SceneBVH
+{
+public:
+    static const int NONE = -1;
+
+    float margin = 0.1f;         // fattening, as a fraction of the box size
+    float rebuildRatio = 1.5f;
+    unsigned int rebuilds = 0;
+
+    int size() const { return leafCount; }
+
+    // Returns a proxy for the box, passed back by queries as data
+    int insert(const glm::vec3 &lo, const glm::vec3 &hi, uint32_t data)
+    {
+        int leaf = allocate();
+        Node &n = nodes[leaf];
+        fatten(lo, hi, n.lo, n.hi);
+        n.data = data;
+        n.height = 0;
+        insert_leaf(leaf);
+        leafCount++;
+        return leaf;
+    }
+
+    void remove(int proxy)
+    {
+        remove_leaf(proxy);
+        release(proxy);
+        leafCount--;
+    }
+
+    // Updates a proxy's box. Returns whether the tree changed, which only happens when the
+    // box leaves the fattened one.
+    bool move(int proxy, const glm::vec3 &lo, const glm::vec3 &hi)
+    {
+        Node &n = nodes[proxy];
+        if (glm::all(glm::lessThanEqual(n.lo, lo)) && glm::all(glm::greaterThanEqual(n.hi, hi)))
+            return false;
+        remove_leaf(proxy);
+        fatten(lo, hi, nodes[proxy].lo, nodes[proxy].hi);
+        insert_leaf(proxy);
+        if (++movesSinceCheck > std::max(64, leafCount / 8)) {
+            movesSinceCheck = 0;
+            if (builtArea <= 0.0f)
+                builtArea = internal_area();   // only ever grown by insert(): measure from here
+            else if (internal_area() > rebuildRatio * builtArea)
+                rebuild();
+        }
+        return true;
+    }
+
+    uint32_t data(int proxy) const { return nodes[proxy].data; }
+
+    // Sum of internal node surface areas: the expected traversal work of a query
+    float internal_area() const
+    {
+        float area = 0.0f;
+        for (const Node &n: nodes) {
+            if (n.height > 0)
+                area += half_area(n.lo, n.hi);
+        }
+        return area;
+    }
+
+    int height() const { return root == NONE ? 0 : nodes[root].height; }
+
+    // Rebuilds the whole tree top-down, splitting at the median along the longest axis
+    void rebuild()
+    {
+        std::vector<int> leaves;
+        leaves.reserve(leafCount);
+        for (int i = 0; i < (int)nodes.size(); i++) {
+            if (nodes[i].height == 0) {
+                leaves.push_back(i);
+            } else if (nodes[i].height > 0) {
+                release(i);
+            }
+        }
+        root = leaves.empty() ? NONE : build(leaves.data(), (int)leaves.size());
+        if (root != NONE)
+            nodes[root].parent = NONE;
+        builtArea = internal_area();
+        movesSinceCheck = 0;
+        rebuilds++;
+    }
+
+    // Appends the data of every proxy that may be inside the frustum to a vector of uint32_t,
+    // with any allocator
+    template <typename Output>
+    void query_frustum(const Frustum &frustum, Output &out) const
+    {
+        if (root == NONE)
+            return;
+        int stack[128];
+        bool inside[128];   // the frustum contains the whole subtree, so skip the tests
+        int count = 0;
+        stack[count] = root;
+        inside[count++] = false;
+        while (count > 0) {
+            count--;
+            const Node &n = nodes[stack[count]];
+            bool contained = inside[count];
+            if (!contained) {
+                int result = classify(frustum, n.lo, n.hi);
+                if (result < 0)
+                    continue;
+                contained = result > 0;
+            }
+            if (n.height == 0) {
+                out.push_back(n.data);
+            } else if (count + 2 <= 128) {
+                stack[count] = n.child1;
+                inside[count++] = contained;
+                stack[count] = n.child2;
+                inside[count++] = contained;
+            }
+        }
+    }
+
+    // Appends the data of every proxy whose box comes within radius of center
+    template <typename Output>
+    void query_sphere(const glm::vec3 &center, float radius, Output &out) const
+    {
+        if (root == NONE)
+            return;
+        int stack[128];
+        int count = 0;
+        stack[count++] = root;
+        while (count > 0) {
+            const Node &n = nodes[stack[--count]];
+            glm::vec3 closest = glm::clamp(center, n.lo, n.hi);
+            glm::vec3 d = closest - center;
+            if (glm::dot(d, d) > radius * radius)
+                continue;
+            if (n.height == 0) {
+                out.push_back(n.data);
+            } else if (count + 2 <= 128) {
+                stack[count++] = n.child1;
+                stack[count++] = n.child2;
+            }
+        }
+    }
+
+    // Calls visit(data) for each proxy whose box the ray enters before maxDistance.
+    // visit returns the distance to keep searching up to: a closer hit than maxDistance
+    // shortens the search, 0 stops it.
+    template <typename Visit>
+    void query_ray(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, Visit visit) const
+    {
+        if (root == NONE)
+            return;
+        glm::vec3 inverse;
+        for (int i = 0; i < 3; i++) {
+            float d = direction[i];
+            if (std::fabs(d) < 1e-30f)
+                d = d < 0.0f ? -1e-30f : 1e-30f;
+            inverse[i] = 1.0f / d;
+        }
+        int stack[128];
+        int count = 0;
+        stack[count++] = root;
+        while (count > 0) {
+            const Node &n = nodes[stack[--count]];
+            glm::vec3 t1 = (n.lo - origin) * inverse, t2 = (n.hi - origin) * inverse;
+            glm::vec3 enter = glm::min(t1, t2), exit = glm::max(t1, t2);
+            float start = std::max(std::max(enter.x, enter.y), std::max(enter.z, 0.0f));
+            float end = std::min(std::min(exit.x, exit.y), exit.z);
+            if (end < start || start > maxDistance)
+                continue;
+            if (n.height == 0) {
+                maxDistance = std::min(maxDistance, visit(n.data));
+                if (maxDistance <= 0.0f)
+                    return;
+            } else if (count + 2 <= 128) {
+                stack[count++] = n.child1;
+                stack[count++] = n.child2;
+            }
+        }
+    }
+
+private:
+    struct Node
+    {
+        glm::vec3 lo, hi;
+        int parent = NONE;   // next free node while on the free list
+        int child1 = NONE;
+        int child2 = NONE;
+        int height = -1;     // 0 for leaves, -1 for free nodes
+        uint32_t data = 0;
+    };
+
+    std::vector<Node> nodes;
+    int root = NONE;
+    int freeList = NONE;
+    int leafCount = 0;
+    int movesSinceCheck = 0;
+    float builtArea = 0.0f;
+
+    static float half_area(const glm::vec3 &lo, const glm::vec3 &hi)
+    {
+        glm::vec3 d = hi - lo;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    void fatten(const glm::vec3 &lo, const glm::vec3 &hi, glm::vec3 &fatLo, glm::vec3 &fatHi) const
+    {
+        glm::vec3 pad = (hi - lo) * margin;
+        fatLo = lo - pad;
+        fatHi = hi + pad;
+    }
+
+    // -1 outside, 0 intersecting, 1 inside
+    static int classify(const Frustum &frustum, const glm::vec3 &lo, const glm::vec3 &hi)
+    {
+        int result = 1;
+        for (const glm::vec4 &p: frustum.planes) {
+            glm::vec3 normal(p);
+            glm::vec3 positive(normal.x >= 0.0f ? hi.x : lo.x, normal.y >= 0.0f ? hi.y : lo.y, normal.z >= 0.0f ? hi.z : lo.z);
+            glm::vec3 negative(normal.x >= 0.0f ? lo.x : hi.x, normal.y >= 0.0f ? lo.y : hi.y, normal.z >= 0.0f ? lo.z : hi.z);
+            if (glm::dot(normal, positive) + p.w < 0.0f)
+                return -1;
+            if (glm::dot(normal, negative) + p.w < 0.0f)
+                result = 0;
+        }
+        return result;
+    }
+
+    int allocate()
+    {
+        if (freeList == NONE) {
+            nodes.push_back(Node());
+            return (int)nodes.size() - 1;
+        }
+        int index = freeList;
+        freeList = nodes[index].parent;
+        nodes[index] = Node();
+        return index;
+    }
+
+    void release(int index)
+    {
+        nodes[index].parent = freeList;
+        nodes[index].height = -1;
+        freeList = index;
+    }
+
+    void refit(int index)
+    {
+        Node &n = nodes[index];
+        n.lo = glm::min(nodes[n.child1].lo, nodes[n.child2].lo);
+        n.hi = glm::max(nodes[n.child1].hi, nodes[n.child2].hi);
+        n.height = 1 + std::max(nodes[n.child1].height, nodes[n.child2].height);
+    }
+
+    // Descends towards the sibling that minimises the area added to the tree, as in Box2D's
+    // dynamic tree, then walks back up refitting and rotating
+    void insert_leaf(int leaf)
+    {
+        if (root == NONE) {
+            root = leaf;
+            nodes[leaf].parent = NONE;
+            return;
+        }
+        glm::vec3 lo = nodes[leaf].lo, hi = nodes[leaf].hi;
+        int index = root;
+        while (nodes[index].height > 0) {
+            const Node &n = nodes[index];
+            float area = half_area(n.lo, n.hi);
+            float combined = half_area(glm::min(n.lo, lo), glm::max(n.hi, hi));
+            float cost = 2.0f * combined;                 // make a new parent for this node and the leaf
+            float inheritance = 2.0f * (combined - area); // every descendant grows by this much
+            float costs[2];
+            int children[2] = {n.child1, n.child2};
+            for (int c = 0; c < 2; c++) {
+                const Node &child = nodes[children[c]];
+                float grown = half_area(glm::min(child.lo, lo), glm::max(child.hi, hi));
+                costs[c] = child.height == 0 ? grown + inheritance
+                                             : grown - half_area(child.lo, child.hi) + inheritance;
+            }
+            if (cost < costs[0] && cost < costs[1])
+                break;
+            index = costs[0] < costs[1] ? children[0] : children[1];
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int parent = allocate();
+        nodes[parent].parent = oldParent;
+        nodes[parent].child1 = sibling;
+        nodes[parent].child2 = leaf;
+        nodes[sibling].parent = parent;
+        nodes[leaf].parent = parent;
+        if (oldParent == NONE) {
+            root = parent;
+        } else if (nodes[oldParent].child1 == sibling) {
+            nodes[oldParent].child1 = parent;
+        } else {
+            nodes[oldParent].child2 = parent;
+        }
+        refit_upwards(parent);
+    }
+
+    void remove_leaf(int leaf)
+    {
+        if (leaf == root) {
+            root = NONE;
+            return;
+        }
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+        if (grandParent == NONE) {
+            root = sibling;
+            nodes[sibling].parent = NONE;
+        } else {
+            if (nodes[grandParent].child1 == parent)
+                nodes[grandParent].child1 = sibling;
+            else
+                nodes[grandParent].child2 = sibling;
+            nodes[sibling].parent = grandParent;
+            refit_upwards(grandParent);
+        }
+        release(parent);
+    }
+
+    void refit_upwards(int index)
+    {
+        while (index != NONE) {
+            index = balance(index);
+            refit(index);
+            index = nodes[index].parent;
+        }
+    }
+
+    // AVL-style rotation: when one child is two levels taller, promote its taller child.
+    // Returns the node now at index's position.
+    int balance(int a)
+    {
+        Node &nodeA = nodes[a];
+        if (nodeA.height < 2)
+            return a;
+        int b = nodeA.child1, c = nodeA.child2;
+        int difference = nodes[c].height - nodes[b].height;
+        if (difference > 1)
+            return rotate(a, c, b);
+        if (difference < -1)
+            return rotate(a, b, c);
+        return a;
+    }
+
+    // Moves tall child `up` into a's place; a keeps `other` and the shorter of up's children
+    int rotate(int a, int up, int other)
+    {
+        int f = nodes[up].child1, g = nodes[up].child2;
+        int parent = nodes[a].parent;
+        nodes[up].child1 = a;
+        nodes[up].parent = parent;
+        nodes[a].parent = up;
+        if (parent == NONE) {
+            root = up;
+        } else if (nodes[parent].child1 == a) {
+            nodes[parent].child1 = up;
+        } else {
+            nodes[parent].child2 = up;
+        }
+        int keep = nodes[f].height > nodes[g].height ? f : g;
+        int give = keep == f ? g : f;
+        nodes[up].child2 = keep;
+        nodes[a].child1 = other;
+        nodes[a].child2 = give;
+        nodes[give].parent = a;
+        refit(a);
+        refit(up);
+        return up;
+    }
+
+    int build(int *leaves, int count)
+    {
+        if (count == 1)
+            return leaves[0];
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (int i = 0; i < count; i++) {
+            glm::vec3 center = (nodes[leaves[i]].lo + nodes[leaves[i]].hi) * 0.5f;
+            lo = glm::min(lo, center);
+            hi = glm::max(hi, center);
+        }
+        glm::vec3 extent = hi - lo;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        int half = count / 2;
+        std::nth_element(leaves, leaves + half, leaves + count, [&](int a, int b) {
+            return nodes[a].lo[axis] + nodes[a].hi[axis] < nodes[b].lo[axis] + nodes[b].hi[axis];
+        });
+        int left = build(leaves, half);
+        int right = build(leaves + half, count - half);
+        int parent = allocate();
+        nodes[parent].child1 = left;
+        nodes[parent].child2 = right;
+        nodes[left].parent = parent;
+        nodes[right].parent = parent;
+        refit(parent);
+        return parent;
+    }
+};
+
+#endif
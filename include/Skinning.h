@@ -0,0 +1,93 @@
+#ifndef SKINNING_H
+#define SKINNING_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "Mesh.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define SKINNING_SSE
+#include <xmmintrin.h>
+#endif
+
+// Joints one skinned mesh can use; the shaders' JointPalette block has this many matrices
+const unsigned int MAX_PALETTE_JOINTS = 128;
+
+// How a mesh's skin refers to the skeleton. Palette entry i, which the vertices' joint
+// indices select, follows skeleton joint joints[i]; inverseBind[i] takes the mesh's bind
+// pose into that joint's space.
+struct SkinBinding
+{
+    std::vector<std::string> names;      // bone names from the file, resolved to joints later
+    std::vector<int> joints;
+    std::vector<glm::mat4> inverseBind;
+
+    bool empty() const { return inverseBind.empty(); }
+
+    // palette[i] = joint's model transform * inverse bind: bind-pose mesh space to the
+    // posed model space
+    void palette(const std::vector<glm::mat4> &model, glm::mat4 *out) const
+    {
+        for (size_t i = 0; i < joints.size(); i++)
+            out[i] = joints[i] >= 0 ? model[joints[i]] * inverseBind[i] : glm::mat4(1.0f);
+    }
+};
+
+// Linear blend skinning on the CPU, reference version: blends each vertex's joint matrices
+// by weight and transforms its position and normal. out keeps the texcoords.
+inline void skin_vertices_scalar(const glm::mat4 *palette, const Vertex *in, const VertexSkin *skin, size_t count,
+                                 Vertex *out)
+{
+    for (size_t v = 0; v < count; v++) {
+        const VertexSkin &s = skin[v];
+        glm::mat4 m = palette[s.joints[0]] * s.weights[0] + palette[s.joints[1]] * s.weights[1] +
+                      palette[s.joints[2]] * s.weights[2] + palette[s.joints[3]] * s.weights[3];
+        glm::vec3 n = glm::mat3(m) * in[v].normal;
+        float length = glm::length(n);
+        out[v].position = glm::vec3(m * glm::vec4(in[v].position, 1.0f));
+        out[v].normal = length > 0.0f ? n / length : n;
+        out[v].texcoord = in[v].texcoord;
+    }
+}
+
+// Same result with the matrix blend and transforms in SSE registers, one matrix column
+// per register. The normal goes through the blended matrix's upper 3x3, which is exact for
+// rotations and uniform scale, the usual case for skeletons.
+inline void skin_vertices(const glm::mat4 *palette, const Vertex *in, const VertexSkin *skin, size_t count,
+                          Vertex *out)
+{
+#ifdef SKINNING_SSE
+    for (size_t v = 0; v < count; v++) {
+        const VertexSkin &s = skin[v];
+        __m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+        for (int k = 0; k < 4; k++) {
+            const float *m = glm::value_ptr(palette[s.joints[k]]);
+            __m128 w = _mm_set1_ps(s.weights[k]);
+            c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(m), w));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(m + 4), w));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(m + 8), w));
+            c3 = _mm_add_ps(c3, _mm_mul_ps(_mm_loadu_ps(m + 12), w));
+        }
+        const glm::vec3 &p = in[v].position, &n = in[v].normal;
+        __m128 position = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p.x)), _mm_mul_ps(c1, _mm_set1_ps(p.y))),
+                                     _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p.z)), c3));
+        __m128 normal = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n.x)), _mm_mul_ps(c1, _mm_set1_ps(n.y))),
+                                   _mm_mul_ps(c2, _mm_set1_ps(n.z)));
+        float pr[4], nr[4];
+        _mm_storeu_ps(pr, position);
+        _mm_storeu_ps(nr, normal);
+        float length = std::sqrt(nr[0] * nr[0] + nr[1] * nr[1] + nr[2] * nr[2]);
+        float inv = length > 0.0f ? 1.0f / length : 1.0f;
+        out[v].position = glm::vec3(pr[0], pr[1], pr[2]);
+        out[v].normal = glm::vec3(nr[0] * inv, nr[1] * inv, nr[2] * inv);
+        out[v].texcoord = in[v].texcoord;
+    }
+#else
+    skin_vertices_scalar(palette, in, skin, count, out);
+#endif
+}
+
+#endif
@@ -0,0 +1,639 @@
+#ifndef SOFTWARE_RENDERER_H
+#define SOFTWARE_RENDERER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include "FrameConstants.h"
+#include "GoldenImage.h"
+#include "JobSystem.h"
+#include "Mesh.h"
+#include "Profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define SOFTWARE_RENDERER_SSE
+#include <emmintrin.h>
+#endif
+
+// Vertices and triangles for the software renderer to draw, placed by transform. Points at
+// data the caller keeps alive, like BakePart.
+struct SoftwareMesh
+{
+    const std::vector<Vertex> *vertices;
+    const std::vector<unsigned int> *indices;
+    glm::mat4 transform;
+};
+
+// What configureShader hands lighting_frag.glsl, the lighting pass's clear colour and the
+// tonemap step of the post chain
+struct SoftwareShading
+{
+    glm::vec3 clearColor = glm::vec3(0.3f, 0.3f, 0.5f);
+    glm::vec3 materialDiffuse = glm::vec3(1.0f);
+    glm::vec3 materialSpecular = glm::vec3(0.2f);
+    float shininess = 32.0f;
+    glm::vec3 ambient = glm::vec3(0.2f);
+    glm::vec3 diffuse = glm::vec3(0.8f);
+    glm::vec3 specular = glm::vec3(1.0f);
+    bool tonemap = true;
+    float exposure = 1.0f;
+};
+
+// Draws what the shadow and lighting passes draw, on the CPU, so frames can be rendered
+// and checked on machines without a GPU. Each pass transforms the vertices once, then
+// sets up triangles in batches of BATCH_TRIANGLES: clipped in homogeneous space, snapped
+// to 1/16 pixel and binned into the 64x64 tiles they touch. Tiles are then rasterised
+// independently, testing four pixels at a time against the three edge functions with
+// SSE2, and depth tested into a visibility buffer of triangle ids. Once a tile's
+// triangles are all in, each visible pixel is shaded once, as lighting_frag.glsl does,
+// from perspective-correct attributes. All three stages are spread over the job system.
+//
+// Follows GL's conventions, so the images match the GPU's within the golden tolerance:
+// pixel centres at half-integers with a top-left fill rule (in GL's y-up window space),
+// depth from 0 to 1 tested with GL_LESS, clockwise (back) faces culled as the lighting
+// pass culls them, and nothing culled in the shadow pass. Bins hold triangles
+// in submission order, so a tile's depth ties resolve as they would on a GPU and the
+// image doesn't depend on how many threads drew it.
+class SoftwareRenderer
+{
+public:
+    static const int TILE_SIZE = 64;
+    static const int SUBPIXEL_BITS = 4;
+    static const int BATCH_TRIANGLES = 2048;
+    SoftwareShading shading;
+    bool simd = true;    // false rasterises with the scalar loop, to check the SSE2 one against
+
+    // Milliseconds spent in each stage of the last frame
+    struct Timings
+    {
+        double vertices = 0.0;
+        double shadow = 0.0;     // setup and rasterisation of the shadow map
+        double setup = 0.0;      // clipping and binning the camera's triangles
+        double raster = 0.0;     // rasterising and shading the camera's tiles
+        size_t triangles = 0;    // set up for the camera after culling and clipping
+    };
+
+    SoftwareRenderer(int width, int height, int shadowSize, JobSystem *jobs = nullptr)
+        : jobs(jobs)
+    {
+        camera.resize(width, height, true);
+        shadowMap.resize(shadowSize, shadowSize, false);
+    }
+
+    // Renders the meshes from the camera in constants, lit and shadowed from lightDirection,
+    // into image
+    void render(const std::vector<SoftwareMesh> &meshes, const FrameConstants &constants,
+                const glm::vec3 &lightDirection, Image &image)
+    {
+        PROFILE_SCOPE("SoftwareRenderer::render");
+        timings = Timings();
+        double start = now();
+        transform_vertices(meshes, constants);
+        double transformed = now();
+        draw_pass(meshes, &ClipVertex::light, false, shadowMap);
+        double shadowed = now();
+        draw_pass(meshes, &ClipVertex::position, true, camera);
+        double setUp = now();
+
+        image.width = camera.width;
+        image.height = camera.height;
+        image.pixels.resize((size_t)camera.width * camera.height * 3);
+        glm::vec3 toLight = glm::normalize(-lightDirection);
+        parallel_for(camera.tile_count(), 1, [&](size_t first, size_t last) {
+            for (size_t tile = first; tile < last; tile++) {
+                raster_tile(camera, (int)tile);
+                shade_tile((int)tile, constants.viewPosition, toLight, image);
+            }
+        });
+        double finished = now();
+
+        timings.vertices = (transformed - start) * 1000.0;
+        timings.shadow = (shadowed - transformed) * 1000.0;
+        timings.setup = (setUp - shadowed) * 1000.0;
+        timings.raster = (finished - setUp) * 1000.0;
+        for (size_t b = 0; b < batchCount; b++)
+            timings.triangles += batches[b].triangles.size();
+    }
+
+    const Timings &last_timings() const { return timings; }
+
+private:
+    enum : uint32_t { NO_TRIANGLE = 0xffffffffu };
+    static const int ID_BITS = 14;   // a batch's triangle, up to 7 each after clipping
+    static const int TILE_PIXELS = TILE_SIZE * TILE_SIZE;
+    static constexpr float GUARD_BAND = 4.0f;   // x and y are clipped this far out, in half viewports
+
+    // A transformed vertex: clip position for the camera and for the light, and the
+    // world-space position and normal lighting_frag.glsl is given
+    struct ClipVertex
+    {
+        glm::vec4 position;
+        glm::vec4 light;
+        glm::vec3 world;
+        glm::vec3 normal;
+    };
+
+    // A counter-clockwise triangle ready to rasterise
+    struct Triangle
+    {
+        int x[3], y[3];               // window position in 1/16 pixels
+        int minX, minY, maxX, maxY;   // pixels it can cover
+        float z, dzdx, dzdy;          // depth at vertex 0 and its slopes per pixel
+        float weight[3][3];           // each vertex's barycentric over w, as a plane from vertex 0
+        ClipVertex v[3];              // attributes, for the lighting pass only
+    };
+
+    // Triangles set up from a range of one mesh, binned by tile: tile t's are
+    // binned[tileStart[t], tileStart[t + 1])
+    struct Batch
+    {
+        size_t vertexBase;
+        const std::vector<unsigned int> *indices;
+        size_t first, last;
+        std::vector<Triangle> triangles;
+        std::vector<uint32_t> tileStart;
+        std::vector<uint32_t> binned;
+    };
+
+    // Depth, and for the camera triangle ids, stored tile by tile so a tile's rows are
+    // contiguous and no two jobs share a cache line
+    struct Target
+    {
+        int width = 0, height = 0;
+        int tilesX = 0, tilesY = 0;
+        std::vector<float> depth;
+        std::vector<uint32_t> ids;
+
+        void resize(int w, int h, bool withIds)
+        {
+            width = w;
+            height = h;
+            tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+            tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+            depth.assign((size_t)tile_count() * TILE_PIXELS, 1.0f);
+            if (withIds)
+                ids.assign(depth.size(), NO_TRIANGLE);
+        }
+
+        int tile_count() const { return tilesX * tilesY; }
+
+        size_t index(int x, int y) const
+        {
+            unsigned int ux = (unsigned int)x, uy = (unsigned int)y;
+            return (size_t)((uy / TILE_SIZE) * tilesX + ux / TILE_SIZE) * TILE_PIXELS +
+                   (uy % TILE_SIZE) * TILE_SIZE + ux % TILE_SIZE;
+        }
+    };
+
+    JobSystem *jobs;
+    Target camera;
+    Target shadowMap;
+    std::vector<ClipVertex> transformed;
+    std::vector<size_t> vertexBases;
+    std::vector<Batch> batches;      // kept between frames for their storage
+    size_t batchCount = 0;
+    Timings timings;
+
+    static double now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    template <typename Body>
+    void parallel_for(size_t count, size_t grain, const Body &body)
+    {
+        if (jobs)
+            jobs->parallel_for(0, count, grain, body);
+        else
+            body(0, count);
+    }
+
+    void transform_vertices(const std::vector<SoftwareMesh> &meshes, const FrameConstants &constants)
+    {
+        PROFILE_SCOPE("SoftwareRenderer::transform_vertices");
+        size_t total = 0;
+        vertexBases.clear();
+        for (const SoftwareMesh &mesh: meshes) {
+            vertexBases.push_back(total);
+            total += mesh.vertices->size();
+        }
+        transformed.resize(total);
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const SoftwareMesh &mesh = meshes[m];
+            glm::mat3 normalTransform = glm::inverseTranspose(glm::mat3(mesh.transform));
+            ClipVertex *out = transformed.data() + vertexBases[m];
+            parallel_for(mesh.vertices->size(), 8192, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    const Vertex &in = (*mesh.vertices)[i];
+                    glm::vec4 world = mesh.transform * glm::vec4(in.position, 1.0f);
+                    out[i].position = constants.viewProjection * world;
+                    out[i].light = constants.lightSpace * world;
+                    out[i].world = glm::vec3(world);
+                    out[i].normal = normalTransform * in.normal;
+                }
+            });
+        }
+    }
+
+    // Sets up and bins every triangle for one target, then, for the shadow map, rasterises
+    // it. The camera's tiles are rasterised with their shading.
+    void draw_pass(const std::vector<SoftwareMesh> &meshes, glm::vec4 ClipVertex::*position, bool lighting,
+                   Target &target)
+    {
+        PROFILE_SCOPE(lighting ? "SoftwareRenderer::setup" : "SoftwareRenderer::shadow");
+        batchCount = 0;
+        for (size_t m = 0; m < meshes.size(); m++) {
+            size_t triangles = meshes[m].indices->size() / 3;
+            for (size_t first = 0; first < triangles; first += BATCH_TRIANGLES) {
+                if (batchCount == batches.size())
+                    batches.emplace_back();
+                Batch &batch = batches[batchCount++];
+                batch.vertexBase = vertexBases[m];
+                batch.indices = meshes[m].indices;
+                batch.first = first;
+                batch.last = std::min(triangles, first + BATCH_TRIANGLES);
+            }
+        }
+        parallel_for(batchCount, 1, [&](size_t first, size_t last) {
+            for (size_t b = first; b < last; b++)
+                setup_batch(batches[b], position, lighting, target);
+        });
+        if (!lighting) {
+            parallel_for(target.tile_count(), 1, [&](size_t first, size_t last) {
+                for (size_t tile = first; tile < last; tile++)
+                    raster_tile(target, (int)tile);
+            });
+        }
+    }
+
+    // Signed distance to one of the clip volume's planes: near, far and the guard band
+    static float plane_distance(const glm::vec4 &c, int plane)
+    {
+        switch (plane) {
+        case 0: return c.z + c.w;
+        case 1: return c.w - c.z;
+        case 2: return GUARD_BAND * c.w + c.x;
+        case 3: return GUARD_BAND * c.w - c.x;
+        case 4: return GUARD_BAND * c.w + c.y;
+        default: return GUARD_BAND * c.w - c.y;
+        }
+    }
+
+    static unsigned int outcode(const glm::vec4 &c)
+    {
+        unsigned int code = 0;
+        for (int plane = 0; plane < 6; plane++) {
+            if (plane_distance(c, plane) < 0.0f)
+                code |= 1u << plane;
+        }
+        return code;
+    }
+
+    static ClipVertex lerp(const ClipVertex &a, const ClipVertex &b, float t)
+    {
+        ClipVertex v;
+        v.position = a.position + (b.position - a.position) * t;
+        v.light = a.light + (b.light - a.light) * t;
+        v.world = a.world + (b.world - a.world) * t;
+        v.normal = a.normal + (b.normal - a.normal) * t;
+        return v;
+    }
+
+    void setup_batch(Batch &batch, glm::vec4 ClipVertex::*position, bool lighting, const Target &target)
+    {
+        batch.triangles.clear();
+        const unsigned int *indices = batch.indices->data();
+        const ClipVertex *vertices = transformed.data() + batch.vertexBase;
+        for (size_t t = batch.first; t < batch.last; t++) {
+            const ClipVertex &a = vertices[indices[t * 3]];
+            const ClipVertex &b = vertices[indices[t * 3 + 1]];
+            const ClipVertex &c = vertices[indices[t * 3 + 2]];
+            unsigned int codeA = outcode(a.*position), codeB = outcode(b.*position), codeC = outcode(c.*position);
+            if (codeA & codeB & codeC)
+                continue;
+            if ((codeA | codeB | codeC) == 0) {
+                add_triangle(batch, a, b, c, position, lighting, target);
+                continue;
+            }
+            // Sutherland-Hodgman against the planes the triangle crosses, then a fan
+            ClipVertex polygon[2][9];
+            int count = 3;
+            polygon[0][0] = a;
+            polygon[0][1] = b;
+            polygon[0][2] = c;
+            int in = 0;
+            unsigned int crossed = codeA | codeB | codeC;
+            for (int plane = 0; plane < 6 && count >= 3; plane++) {
+                if (!(crossed & (1u << plane)))
+                    continue;
+                int outCount = 0;
+                for (int i = 0; i < count; i++) {
+                    const ClipVertex &p = polygon[in][i], &q = polygon[in][(i + 1) % count];
+                    float dp = plane_distance(p.*position, plane), dq = plane_distance(q.*position, plane);
+                    if (dp >= 0.0f)
+                        polygon[1 - in][outCount++] = p;
+                    if ((dp >= 0.0f) != (dq >= 0.0f))
+                        polygon[1 - in][outCount++] = lerp(p, q, dp / (dp - dq));
+                }
+                count = outCount;
+                in = 1 - in;
+            }
+            for (int i = 1; i + 1 < count; i++)
+                add_triangle(batch, polygon[in][0], polygon[in][i], polygon[in][i + 1], position, lighting, target);
+        }
+        bin_batch(batch, target);
+    }
+
+    void add_triangle(Batch &batch, const ClipVertex &a, const ClipVertex &b, const ClipVertex &c,
+                      glm::vec4 ClipVertex::*position, bool lighting, const Target &target)
+    {
+        const ClipVertex *v[3] = {&a, &b, &c};
+        Triangle t;
+        float z[3], invW[3];
+        for (int i = 0; i < 3; i++) {
+            const glm::vec4 &clip = v[i]->*position;
+            invW[i] = 1.0f / clip.w;
+            float x = (clip.x * invW[i] * 0.5f + 0.5f) * target.width;
+            float y = (clip.y * invW[i] * 0.5f + 0.5f) * target.height;
+            t.x[i] = (int)std::lround(x * (1 << SUBPIXEL_BITS));
+            t.y[i] = (int)std::lround(y * (1 << SUBPIXEL_BITS));
+            z[i] = clip.z * invW[i] * 0.5f + 0.5f;
+        }
+        int64_t area = (int64_t)(t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (int64_t)(t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+        if (area == 0 || (area < 0 && lighting))
+            return;
+        int order[3] = {0, 1, 2};
+        if (area < 0) {
+            // Seen from behind in the shadow pass: wind it the other way
+            std::swap(t.x[1], t.x[2]);
+            std::swap(t.y[1], t.y[2]);
+            std::swap(invW[1], invW[2]);
+            std::swap(z[1], z[2]);
+            std::swap(order[1], order[2]);
+            area = -area;
+        }
+        t.minX = std::max(0, std::min(t.x[0], std::min(t.x[1], t.x[2])) >> SUBPIXEL_BITS);
+        t.minY = std::max(0, std::min(t.y[0], std::min(t.y[1], t.y[2])) >> SUBPIXEL_BITS);
+        t.maxX = std::min(target.width - 1, std::max(t.x[0], std::max(t.x[1], t.x[2])) >> SUBPIXEL_BITS);
+        t.maxY = std::min(target.height - 1, std::max(t.y[0], std::max(t.y[1], t.y[2])) >> SUBPIXEL_BITS);
+        if (t.minX > t.maxX || t.minY > t.maxY)
+            return;
+
+        // Depth is affine in window space; its plane from the snapped positions
+        const float unit = 1.0f / (1 << SUBPIXEL_BITS);
+        float x1 = (t.x[1] - t.x[0]) * unit, y1 = (t.y[1] - t.y[0]) * unit;
+        float x2 = (t.x[2] - t.x[0]) * unit, y2 = (t.y[2] - t.y[0]) * unit;
+        float z1 = z[1] - z[0], z2 = z[2] - z[0];
+        float pixelArea = (float)(area * unit * unit);
+        t.z = z[0];
+        t.dzdx = (z1 * y2 - z2 * y1) / pixelArea;
+        t.dzdy = (x1 * z2 - x2 * z1) / pixelArea;
+        if (lighting) {
+            // Vertex i's barycentric is the edge function of the side facing it over the
+            // area; dividing by w makes the attributes' interpolation perspective correct
+            for (int i = 0; i < 3; i++) {
+                int a = (i + 1) % 3, b = (i + 2) % 3;
+                double ax = (t.x[a] - t.x[0]) * unit, ay = (t.y[a] - t.y[0]) * unit;
+                double bx = (t.x[b] - t.x[0]) * unit, by = (t.y[b] - t.y[0]) * unit;
+                double scale = invW[i] / (area * unit * unit);
+                t.weight[i][0] = (float)(((bx - ax) * -ay + (by - ay) * ax) * scale);
+                t.weight[i][1] = (float)((ay - by) * scale);
+                t.weight[i][2] = (float)((bx - ax) * scale);
+                t.v[i] = *v[order[i]];
+            }
+        }
+        batch.triangles.push_back(t);
+    }
+
+    // Counts each tile's triangles, then lays the ids out tile by tile
+    void bin_batch(Batch &batch, const Target &target)
+    {
+        batch.tileStart.assign(target.tile_count() + 1, 0);
+        for (const Triangle &t: batch.triangles) {
+            for (int ty = t.minY / TILE_SIZE; ty <= t.maxY / TILE_SIZE; ty++) {
+                for (int tx = t.minX / TILE_SIZE; tx <= t.maxX / TILE_SIZE; tx++)
+                    batch.tileStart[ty * target.tilesX + tx + 1]++;
+            }
+        }
+        for (int tile = 0; tile < target.tile_count(); tile++)
+            batch.tileStart[tile + 1] += batch.tileStart[tile];
+        batch.binned.resize(batch.tileStart.back());
+        std::vector<uint32_t> &next = batch.tileStart;   // walks each start forward, then is shifted back
+        for (uint32_t i = 0; i < (uint32_t)batch.triangles.size(); i++) {
+            const Triangle &t = batch.triangles[i];
+            for (int ty = t.minY / TILE_SIZE; ty <= t.maxY / TILE_SIZE; ty++) {
+                for (int tx = t.minX / TILE_SIZE; tx <= t.maxX / TILE_SIZE; tx++)
+                    batch.binned[next[ty * target.tilesX + tx]++] = i;
+            }
+        }
+        for (int tile = target.tile_count(); tile > 0; tile--)
+            next[tile] = next[tile - 1];
+        next[0] = 0;
+    }
+
+    // Clears a tile, then draws each batch's triangles in it, in order
+    void raster_tile(Target &target, int tile)
+    {
+        float *depth = target.depth.data() + (size_t)tile * TILE_PIXELS;
+        uint32_t *ids = target.ids.empty() ? nullptr : target.ids.data() + (size_t)tile * TILE_PIXELS;
+        std::fill(depth, depth + TILE_PIXELS, 1.0f);
+        if (ids)
+            std::fill(ids, ids + TILE_PIXELS, NO_TRIANGLE);
+        int tileX = (tile % target.tilesX) * TILE_SIZE, tileY = (tile / target.tilesX) * TILE_SIZE;
+        for (size_t b = 0; b < batchCount; b++) {
+            const Batch &batch = batches[b];
+            for (uint32_t k = batch.tileStart[tile]; k < batch.tileStart[tile + 1]; k++) {
+                uint32_t i = batch.binned[k];
+                raster_triangle(batch.triangles[i], tileX, tileY, depth, ids, (uint32_t)(b << ID_BITS) | i);
+            }
+        }
+    }
+
+    // Covers the triangle's pixels in one tile, four at a time. An edge that has every
+    // pixel of the block on its inner side is left out; the others fit in 32 bits across
+    // a tile, so each step is an add. Depth is evaluated from the block's corner at every
+    // pixel rather than stepped, so the SSE2 and scalar loops write the same values.
+    void raster_triangle(const Triangle &t, int tileX, int tileY, float *depth, uint32_t *ids, uint32_t id) const
+    {
+        int x0 = std::max(t.minX, tileX) & ~3, x1 = std::min(t.maxX, tileX + TILE_SIZE - 1) | 3;
+        int y0 = std::max(t.minY, tileY), y1 = std::min(t.maxY, tileY + TILE_SIZE - 1);
+        if (x0 > x1 || y0 > y1)
+            return;
+        const int half = 1 << (SUBPIXEL_BITS - 1);
+        int32_t edge[3], stepX[3], stepY[3];
+        for (int e = 0; e < 3; e++) {
+            int ax = t.x[e], ay = t.y[e], bx = t.x[(e + 1) % 3], by = t.y[(e + 1) % 3];
+            int64_t a = ay - by, b = bx - ax;
+            // Pixels on the edge belong to the triangle on its left or top
+            int64_t bias = (a > 0 || (a == 0 && b < 0)) ? 0 : -1;
+            int64_t value = a * ((x0 << SUBPIXEL_BITS) + half - ax) + b * ((y0 << SUBPIXEL_BITS) + half - ay) + bias;
+            int64_t acrossX = a * (1 << SUBPIXEL_BITS) * (x1 - x0), acrossY = b * (1 << SUBPIXEL_BITS) * (y1 - y0);
+            int64_t lowest = value + std::min<int64_t>(acrossX, 0) + std::min<int64_t>(acrossY, 0);
+            int64_t highest = value + std::max<int64_t>(acrossX, 0) + std::max<int64_t>(acrossY, 0);
+            if (highest < 0)
+                return;
+            if (lowest >= 0) {
+                edge[e] = stepX[e] = stepY[e] = 0;
+            } else {
+                edge[e] = (int32_t)value;
+                stepX[e] = (int32_t)(a * (1 << SUBPIXEL_BITS));
+                stepY[e] = (int32_t)(b * (1 << SUBPIXEL_BITS));
+            }
+        }
+        const float unit = 1.0f / (1 << SUBPIXEL_BITS);
+        float zRow = t.z + t.dzdx * (x0 + 0.5f - t.x[0] * unit) + t.dzdy * (y0 + 0.5f - t.y[0] * unit);
+        float *depthRow = depth + (y0 - tileY) * TILE_SIZE - tileX;
+        uint32_t *idRow = ids ? ids + (y0 - tileY) * TILE_SIZE - tileX : nullptr;
+
+#ifdef SOFTWARE_RENDERER_SSE
+        if (simd) {
+            __m128i rowEdge[3], quadStep[3], rowStep[3];
+            for (int e = 0; e < 3; e++) {
+                rowEdge[e] = _mm_add_epi32(_mm_set1_epi32(edge[e]), _mm_setr_epi32(0, stepX[e], 2 * stepX[e], 3 * stepX[e]));
+                quadStep[e] = _mm_set1_epi32(4 * stepX[e]);
+                rowStep[e] = _mm_set1_epi32(stepY[e]);
+            }
+            __m128 dzdx = _mm_set1_ps(t.dzdx), lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+            __m128i idQuad = _mm_set1_epi32((int)id);
+            for (int y = y0; y <= y1; y++) {
+                __m128i e0 = rowEdge[0], e1 = rowEdge[1], e2 = rowEdge[2];
+                __m128 zLine = _mm_set1_ps(zRow + (float)(y - y0) * t.dzdy);
+                for (int x = x0; x <= x1; x += 4) {
+                    __m128 z = _mm_add_ps(zLine, _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)(x - x0)), lanes), dzdx));
+                    // A pixel is outside if any edge function is negative
+                    __m128i outside = _mm_or_si128(e0, _mm_or_si128(e1, e2));
+                    if (_mm_movemask_ps(_mm_castsi128_ps(outside)) != 0xf) {
+                        __m128 stored = _mm_loadu_ps(depthRow + x);
+                        __m128 write = _mm_andnot_ps(_mm_castsi128_ps(_mm_srai_epi32(outside, 31)), _mm_cmplt_ps(z, stored));
+                        _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, stored)));
+                        if (idRow) {
+                            __m128i mask = _mm_castps_si128(write);
+                            __m128i old = _mm_loadu_si128((const __m128i *)(idRow + x));
+                            _mm_storeu_si128((__m128i *)(idRow + x),
+                                             _mm_or_si128(_mm_and_si128(mask, idQuad), _mm_andnot_si128(mask, old)));
+                        }
+                    }
+                    e0 = _mm_add_epi32(e0, quadStep[0]);
+                    e1 = _mm_add_epi32(e1, quadStep[1]);
+                    e2 = _mm_add_epi32(e2, quadStep[2]);
+                }
+                for (int e = 0; e < 3; e++)
+                    rowEdge[e] = _mm_add_epi32(rowEdge[e], rowStep[e]);
+                depthRow += TILE_SIZE;
+                if (idRow)
+                    idRow += TILE_SIZE;
+            }
+            return;
+        }
+#endif
+        for (int y = y0; y <= y1; y++) {
+            int32_t e0 = edge[0], e1 = edge[1], e2 = edge[2];
+            float zLine = zRow + (float)(y - y0) * t.dzdy;
+            for (int x = x0; x <= x1; x++) {
+                float z = zLine + (float)(x - x0) * t.dzdx;
+                if ((e0 | e1 | e2) >= 0 && z < depthRow[x]) {
+                    depthRow[x] = z;
+                    if (idRow)
+                        idRow[x] = id;
+                }
+                e0 += stepX[0];
+                e1 += stepX[1];
+                e2 += stepX[2];
+            }
+            for (int e = 0; e < 3; e++)
+                edge[e] += stepY[e];
+            depthRow += TILE_SIZE;
+            if (idRow)
+                idRow += TILE_SIZE;
+        }
+    }
+
+    // Shades the tile's visible pixels and writes them to the image, top row first
+    void shade_tile(int tile, const glm::vec3 &viewPosition, const glm::vec3 &toLight, Image &image) const
+    {
+        int tileX = (tile % camera.tilesX) * TILE_SIZE, tileY = (tile / camera.tilesX) * TILE_SIZE;
+        const uint32_t *ids = camera.ids.data() + (size_t)tile * TILE_PIXELS;
+        int width = std::min((int)TILE_SIZE, camera.width - tileX), height = std::min((int)TILE_SIZE, camera.height - tileY);
+        for (int y = 0; y < height; y++) {
+            unsigned char *out = &image.pixels[((size_t)(camera.height - 1 - tileY - y) * camera.width + tileX) * 3];
+            for (int x = 0; x < width; x++, out += 3) {
+                uint32_t id = ids[y * TILE_SIZE + x];
+                glm::vec3 color = shading.clearColor;
+                if (id != NO_TRIANGLE) {
+                    const Triangle &t = batches[id >> ID_BITS].triangles[id & ((1u << ID_BITS) - 1)];
+                    color = shade(t, tileX + x, tileY + y, viewPosition, toLight);
+                }
+                if (shading.tonemap)
+                    color = aces(color * shading.exposure);
+                for (int c = 0; c < 3; c++)
+                    out[c] = (unsigned char)(std::min(std::max(color[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    // lighting_frag.glsl for the pixel, from attributes interpolated in proportion to the
+    // screen-space barycentrics over w
+    glm::vec3 shade(const Triangle &t, int x, int y, const glm::vec3 &viewPosition, const glm::vec3 &toLight) const
+    {
+        const float unit = 1.0f / (1 << SUBPIXEL_BITS);
+        float px = x + 0.5f - t.x[0] * unit, py = y + 0.5f - t.y[0] * unit;
+        float weight[3];
+        float sum = 0.0f;
+        for (int i = 0; i < 3; i++) {
+            weight[i] = t.weight[i][0] + t.weight[i][1] * px + t.weight[i][2] * py;
+            sum += weight[i];
+        }
+        glm::vec3 world(0.0f), normal(0.0f);
+        glm::vec4 light(0.0f);
+        for (int i = 0; i < 3; i++) {
+            float w = weight[i] / sum;
+            world += t.v[i].world * w;
+            normal += t.v[i].normal * w;
+            light += t.v[i].light * w;
+        }
+
+        glm::vec3 n = glm::normalize(normal);
+        glm::vec3 viewDir = glm::normalize(viewPosition - world);
+        glm::vec3 halfway = glm::normalize(toLight + viewDir);
+        float diff = std::max(glm::dot(n, toLight), 0.0f);
+        float spec = std::pow(std::max(glm::dot(n, halfway), 0.0f), shading.shininess);
+        // The shader biases with the normal as interpolated, before normalising
+        float shadow = shadow_factor(light, std::max(0.05f * (1.0f - glm::dot(normal, toLight)), 0.005f));
+        glm::vec3 ambient = shading.ambient * shading.materialDiffuse;
+        glm::vec3 diffuse = shading.diffuse * diff * shading.materialDiffuse;
+        glm::vec3 specular = shading.specular * spec * shading.materialSpecular;
+        return ambient + (1.0f - shadow) * (diffuse + specular);
+    }
+
+    // 3x3 PCF over the nearest texels, which read 1.0 beyond the map as its border colour does
+    float shadow_factor(const glm::vec4 &light, float bias) const
+    {
+        glm::vec3 coords = glm::vec3(light) / light.w * 0.5f + 0.5f;
+        if (coords.z > 1.0f)
+            return 0.0f;
+        int size = shadowMap.width;
+        int cx = (int)std::floor(coords.x * size), cy = (int)std::floor(coords.y * size);
+        float shadow = 0.0f;
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                int sx = cx + dx, sy = cy + dy;
+                float closest = sx >= 0 && sy >= 0 && sx < size && sy < size ? shadowMap.depth[shadowMap.index(sx, sy)] : 1.0f;
+                shadow += coords.z - bias > closest ? 1.0f : 0.0f;
+            }
+        }
+        return shadow / 9.0f;
+    }
+
+    // tonemap_frag.glsl's fit of the ACES curve
+    static glm::vec3 aces(const glm::vec3 &x)
+    {
+        glm::vec3 curve = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+        return glm::clamp(curve, 0.0f, 1.0f);
+    }
+};
+
+#endif
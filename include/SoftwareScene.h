@@ -0,0 +1,146 @@
+#ifndef SOFTWARE_SCENE_H
+#define SOFTWARE_SCENE_H
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <glm/glm.hpp>
+#include "AnimationCompression.h"
+#include "FrameConstants.h"
+#include "JobSystem.h"
+#include "Model.h"
+#include "SoftwareRenderer.h"
+#include "Terrain.h"
+#include "VertexAnimation.h"
+
+// The model as Model::animate poses it at time, through its first clip or in its bind pose
+// if it has none, with every part gathered into one mesh. Reads the file with Assimp and
+// needs no GL context.
+inline bool load_posed_model(const std::string &path, float time, std::vector<Vertex> &vertices,
+                             std::vector<unsigned int> &indices)
+{
+    Assimp::Importer importer;
+    const aiScene *model = importer.ReadFile(path, aiProcess_Triangulate);
+    if (!model || !model->mRootNode) {
+        std::cout << importer.GetErrorString() << std::endl;
+        return false;
+    }
+    Skeleton skeleton;
+    Model::add_joints(model->mRootNode, -1, skeleton);
+    std::vector<AnimationClip> imported;
+    Model::process_animations(model, skeleton, imported);
+    std::vector<Model::MeshData> meshes;
+    std::vector<BakePart> parts;
+    import_bake_parts(model, skeleton, meshes, parts);
+
+    std::vector<JointPose> pose = skeleton.bindPose;
+    if (!imported.empty())
+        CompressedClip(imported[0], skeleton).sample(skeleton, time, pose);
+    std::vector<glm::mat4> jointModel;
+    pose_to_model(skeleton, pose, jointModel);
+    vertices.clear();
+    indices.clear();
+    size_t paletteSize = 1;
+    for (const BakePart &part: parts) {
+        unsigned int base = (unsigned int)vertices.size();
+        for (unsigned int i: *part.indices)
+            indices.push_back(base + i);
+        vertices.insert(vertices.end(), part.vertices->begin(), part.vertices->end());
+        paletteSize = std::max(paletteSize, part.binding->joints.size());
+    }
+    std::vector<glm::mat4> palette(paletteSize);
+    pose_bake_parts(parts, jointModel, palette, vertices.data());
+    return true;
+}
+
+// What the software renderer draws in place of the GL scene: the model posed at a time and
+// the terrain chunks TerrainQuadtree selects around the viewer, as Terrain draws them once
+// streaming has caught up. meshes points into the rest, so a scene is rebuilt in place
+// rather than copied.
+struct SoftwareScene
+{
+    std::vector<Vertex> modelVertices;
+    std::vector<unsigned int> modelIndices;
+    std::vector<std::vector<Vertex>> chunks;
+    std::vector<std::vector<unsigned int>> stitchPatterns;   // indexed by TerrainQuadtree::stitch
+    std::vector<SoftwareMesh> meshes;
+
+    SoftwareScene() {}
+    SoftwareScene(const SoftwareScene &) = delete;
+    SoftwareScene &operator=(const SoftwareScene &) = delete;
+
+    // Chunks are generated on the job system if one is given
+    bool build(const std::string &modelFile, float time, const TerrainSettings &settings, const glm::vec3 &viewer,
+               JobSystem *jobs = nullptr)
+    {
+        if (!load_posed_model(modelFile, time, modelVertices, modelIndices))
+            return false;
+        if (stitchPatterns.empty()) {
+            stitchPatterns.resize(16);
+            for (unsigned int stitch = 0; stitch < 16; stitch++)
+                terrain_chunk_indices(stitch, stitchPatterns[stitch]);
+        }
+        TerrainQuadtree quadtree;
+        quadtree.select(settings, viewer, [](uint64_t) { return true; });
+        chunks.resize(quadtree.leaves.size());
+        auto generate = [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                float lo, hi;
+                generate_terrain_chunk(settings, quadtree.leaves[i], chunks[i], lo, hi);
+            }
+        };
+        if (jobs)
+            jobs->parallel_for(0, quadtree.leaves.size(), 4, generate);
+        else
+            generate(0, quadtree.leaves.size());
+
+        meshes.clear();
+        meshes.push_back({&modelVertices, &modelIndices, glm::mat4(1.0f)});
+        for (size_t i = 0; i < chunks.size(); i++)
+            meshes.push_back({&chunks[i], &stitchPatterns[quadtree.stitch[i]], glm::mat4(1.0f)});
+        return true;
+    }
+};
+
+// Renders the scene runs times on job systems of one thread up to every core and prints
+// each stage's average, with the speed-up over one thread
+inline void time_software_renderer(const SoftwareScene &scene, const FrameConstants &constants,
+                                   const glm::vec3 &lightDirection, const SoftwareShading &shading, int width,
+                                   int height, int shadowSize, int runs)
+{
+    typedef std::chrono::steady_clock Clock;
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    Image image;
+    double base = 0.0;
+    for (unsigned int threads = 1; threads <= cores; threads++) {
+        JobSystem jobs;
+        jobs.start(threads - 1);
+        SoftwareRenderer timed(width, height, shadowSize, &jobs);
+        timed.shading = shading;
+        SoftwareRenderer::Timings sum;
+        Clock::time_point start = Clock::now();
+        for (int r = 0; r < runs; r++) {
+            timed.render(scene.meshes, constants, lightDirection, image);
+            const SoftwareRenderer::Timings &t = timed.last_timings();
+            sum.vertices += t.vertices;
+            sum.shadow += t.shadow;
+            sum.setup += t.setup;
+            sum.raster += t.raster;
+            sum.triangles = t.triangles;
+        }
+        double frame = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / runs;
+        if (threads == 1)
+            base = frame;
+        std::cout << threads << " threads: frame " << frame << " ms (" << base / frame << "x); vertices "
+                  << sum.vertices / runs << ", shadow map " << sum.shadow / runs << ", setup " << sum.setup / runs
+                  << ", raster and shade " << sum.raster / runs << " ms; " << sum.triangles << " triangles" << std::endl;
+    }
+}
+
+#endif
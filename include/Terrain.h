@@ -0,0 +1,706 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "FrameConstants.h"
+#include "JobSystem.h"
+#include "Mesh.h"
+#include "Profiler.h"
+#include "RenderStats.h"
+
+// Cells along each side of a chunk; every chunk has the same grid of vertices, whatever its size
+const int TERRAIN_CHUNK_CELLS = 32;
+const int TERRAIN_CHUNK_VERTICES = (TERRAIN_CHUNK_CELLS + 1) * (TERRAIN_CHUNK_CELLS + 1);
+
+// Chunk edges, as bits of a stitch mask. North is towards -z.
+enum TerrainEdge { TERRAIN_EDGE_WEST = 1, TERRAIN_EDGE_EAST = 2, TERRAIN_EDGE_NORTH = 4, TERRAIN_EDGE_SOUTH = 8 };
+
+// Shape and budgets of a heightmap terrain, a square centred on the origin
+struct TerrainSettings
+{
+    float size = 4096.0f;         // metres along each side
+    float finestCell = 1.0f;      // vertex spacing of the most detailed chunks
+    float height = 150.0f;        // highest peaks
+    float featureSize = 600.0f;   // wavelength of the largest hills
+    float flatRadius = 40.0f;     // level ground at y = 0 around the origin, where the scene stands
+    float lodDistance = 2.0f;     // chunks split when the viewer is closer than this many of their widths
+    int uploadsPerFrame = 8;      // chunks streamed in per frame, so a fast camera costs no more
+    int maxPending = 32;          // chunks being generated at once
+    size_t cacheChunks = 1024;    // resident chunks kept for when the viewer comes back
+
+    // Levels below the root chunk, so the finest chunks have cells about finestCell wide
+    unsigned int max_level() const
+    {
+        float levels = std::ceil(std::log2(size / (TERRAIN_CHUNK_CELLS * finestCell)));
+        return (unsigned int)glm::clamp(levels, 0.0f, 20.0f);
+    }
+
+    float node_size(unsigned int level) const { return size / (float)(1u << level); }
+};
+
+// Quadtree nodes by level and position within the level, packed so they sort by level first
+inline uint64_t terrain_node(unsigned int level, unsigned int x, unsigned int z)
+{
+    return (uint64_t)level << 58 | (uint64_t)x << 29 | z;
+}
+
+inline unsigned int terrain_node_level(uint64_t node) { return (unsigned int)(node >> 58); }
+inline unsigned int terrain_node_x(uint64_t node) { return (unsigned int)(node >> 29) & 0x1fffffff; }
+inline unsigned int terrain_node_z(uint64_t node) { return (unsigned int)node & 0x1fffffff; }
+
+inline uint64_t terrain_node_child(uint64_t node, int child)
+{
+    return terrain_node(terrain_node_level(node) + 1, terrain_node_x(node) * 2 + (child & 1),
+                        terrain_node_z(node) * 2 + (child >> 1));
+}
+
+inline uint64_t terrain_node_parent(uint64_t node)
+{
+    return terrain_node(terrain_node_level(node) - 1, terrain_node_x(node) / 2, terrain_node_z(node) / 2);
+}
+
+// Smooth noise in [-1, 1] with features one unit apart, from hashed lattice values
+inline float terrain_noise(float x, float z)
+{
+    float fx = std::floor(x), fz = std::floor(z);
+    int ix = (int)fx, iz = (int)fz;
+    float u = x - fx, v = z - fz;
+    u = u * u * (3.0f - 2.0f * u);
+    v = v * v * (3.0f - 2.0f * v);
+    auto lattice = [](int i, int j) {
+        uint32_t h = (uint32_t)i * 374761393u + (uint32_t)j * 668265263u;
+        h = (h ^ (h >> 13)) * 1274126177u;
+        h ^= h >> 16;
+        return (float)(h & 0xffff) / 32767.5f - 1.0f;
+    };
+    float a = lattice(ix, iz), b = lattice(ix + 1, iz), c = lattice(ix, iz + 1), d = lattice(ix + 1, iz + 1);
+    return a + (b - a) * u + (c - a) * v + (a - b - c + d) * u * v;
+}
+
+// The heightmap: six octaves of noise between 0 and settings.height, faded to level ground
+// around the origin. It is a function rather than an image so any part of a terrain of any
+// size can be generated on its own; a chunk only ever reads the samples it covers.
+inline float terrain_height(const TerrainSettings &settings, float x, float z)
+{
+    float sum = 0.0f, amplitude = 0.5f, frequency = 1.0f / settings.featureSize;
+    for (int octave = 0; octave < 6; octave++) {
+        sum += terrain_noise(x * frequency, z * frequency) * amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    float fade = glm::clamp((std::sqrt(x * x + z * z) - settings.flatRadius) / (settings.flatRadius * 3.0f), 0.0f, 1.0f);
+    fade = fade * fade * (3.0f - 2.0f * fade);
+    return settings.height * (sum * 0.5f + 0.5f) * fade;
+}
+
+// Distance along a ray to where it first meets the heightmap, up to maxDistance: steps of
+// finestCell across the box the terrain fills, then bisection of the step that goes under
+// the surface. That is the surface the finest chunks are built on, and coarser chunks
+// approximate.
+inline bool terrain_intersect_ray(const TerrainSettings &settings, const glm::vec3 &origin,
+                                  const glm::vec3 &direction, float maxDistance, float &t)
+{
+    glm::vec3 lo(-0.5f * settings.size, -1.0f, -0.5f * settings.size);
+    glm::vec3 hi(0.5f * settings.size, settings.height + 1.0f, 0.5f * settings.size);
+    float enter = 0.0f, exit = maxDistance;
+    for (int i = 0; i < 3; i++) {
+        if (std::fabs(direction[i]) < 1e-12f) {
+            if (origin[i] < lo[i] || origin[i] > hi[i])
+                return false;
+            continue;
+        }
+        float a = (lo[i] - origin[i]) / direction[i], b = (hi[i] - origin[i]) / direction[i];
+        enter = std::max(enter, std::min(a, b));
+        exit = std::min(exit, std::max(a, b));
+    }
+    if (enter > exit)
+        return false;
+
+    auto above = [&](float s) {
+        glm::vec3 p = origin + direction * s;
+        return p.y - terrain_height(settings, p.x, p.z);
+    };
+    if (above(enter) <= 0.0f) {
+        t = enter;
+        return true;
+    }
+    float step = settings.finestCell / glm::length(direction);
+    int steps = (int)std::ceil((exit - enter) / step);
+    float previous = enter;
+    for (int i = 1; i <= steps; i++) {
+        float s = std::min(enter + step * i, exit);
+        if (above(s) > 0.0f) {
+            previous = s;
+            continue;
+        }
+        float under = s;
+        for (int k = 0; k < 16; k++) {
+            float middle = 0.5f * (previous + under);
+            if (above(middle) > 0.0f)
+                previous = middle;
+            else
+                under = middle;
+        }
+        t = under;
+        return true;
+    }
+    return false;
+}
+
+// A chunk's vertices in world space, row by row from its north-west corner, with normals
+// from central differences at its own spacing, and the range of its heights. Vertices on
+// an edge shared with another chunk sample the heightmap at the same points as that
+// chunk's, so they meet exactly.
+inline void generate_terrain_chunk(const TerrainSettings &settings, uint64_t node, std::vector<Vertex> &vertices,
+                                   float &lo, float &hi)
+{
+    const int n = TERRAIN_CHUNK_CELLS, border = n + 3;
+    unsigned int level = terrain_node_level(node);
+    float width = settings.node_size(level), cell = width / n;
+    float x0 = -0.5f * settings.size + terrain_node_x(node) * width;
+    float z0 = -0.5f * settings.size + terrain_node_z(node) * width;
+    // Heights with a one sample border for the normals
+    float heights[(TERRAIN_CHUNK_CELLS + 3) * (TERRAIN_CHUNK_CELLS + 3)];
+    for (int j = 0; j < border; j++) {
+        for (int i = 0; i < border; i++)
+            heights[j * border + i] = terrain_height(settings, x0 + (i - 1) * cell, z0 + (j - 1) * cell);
+    }
+    vertices.clear();
+    lo = 1e30f;
+    hi = -1e30f;
+    for (int j = 0; j <= n; j++) {
+        for (int i = 0; i <= n; i++) {
+            const float *h = &heights[(j + 1) * border + i + 1];
+            glm::vec3 position(x0 + i * cell, h[0], z0 + j * cell);
+            glm::vec3 normal = glm::normalize(glm::vec3(h[-1] - h[1], 2.0f * cell, h[-border] - h[border]));
+            vertices.push_back(Vertex(position, normal, glm::vec2((float)i / n, (float)j / n)));
+            lo = std::min(lo, h[0]);
+            hi = std::max(hi, h[0]);
+        }
+    }
+}
+
+// Triangles of a chunk whose edges in `stitch` meet a coarser neighbour. Every other
+// vertex along those edges is folded into the one before it, so the edge follows the
+// neighbour's straight segments and no T-junction opens a crack; the triangles left with
+// two corners the same are dropped. 16 patterns cover every combination of edges.
+inline void terrain_chunk_indices(unsigned int stitch, std::vector<unsigned int> &indices)
+{
+    const int n = TERRAIN_CHUNK_CELLS;
+    auto vertex = [&](int i, int j) {
+        if ((i == 0 && (stitch & TERRAIN_EDGE_WEST)) || (i == n && (stitch & TERRAIN_EDGE_EAST)))
+            j &= ~1;
+        if ((j == 0 && (stitch & TERRAIN_EDGE_NORTH)) || (j == n && (stitch & TERRAIN_EDGE_SOUTH)))
+            i &= ~1;
+        return (unsigned int)(j * (n + 1) + i);
+    };
+    auto triangle = [&](unsigned int a, unsigned int b, unsigned int c) {
+        if (a != b && b != c && c != a) {
+            indices.push_back(a);
+            indices.push_back(b);
+            indices.push_back(c);
+        }
+    };
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            unsigned int a = vertex(i, j), b = vertex(i + 1, j), c = vertex(i, j + 1), d = vertex(i + 1, j + 1);
+            triangle(a, c, b);
+            triangle(b, c, d);
+        }
+    }
+}
+
+// Chooses the chunks to draw for a viewpoint. A node splits into its four children while
+// the viewer is within settings.lodDistance of its widths, but only once all four are
+// resident, so the chosen leaves always cover the terrain exactly once with chunks that
+// can be drawn. Then neighbouring leaves are kept within one level of each other, which is
+// what the stitch patterns can join without cracks. Costs grow with the number of leaves,
+// which grows with the log of the terrain's size, not its area.
+class TerrainQuadtree
+{
+public:
+    std::vector<uint64_t> leaves;    // nodes to draw
+    std::vector<uint8_t> stitch;     // for each leaf, the edges meeting a coarser neighbour
+    std::vector<uint64_t> wanted;    // nodes the view would split into that are not resident, coarsest first
+
+    template <typename Resident>
+    void select(const TerrainSettings &settings, const glm::vec3 &viewer, Resident resident)
+    {
+        maxLevel = settings.max_level();
+        split.clear();
+        wanted.clear();
+        visit(settings, viewer, resident, terrain_node(0, 0, 0));
+        std::sort(split.begin(), split.end());
+        balance();
+        std::sort(wanted.begin(), wanted.end());
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+    }
+
+private:
+    std::vector<uint64_t> split;     // nodes drawn through their children, sorted
+    unsigned int maxLevel = 0;
+
+    // Distance from the viewer to the node's box, which spans every height the terrain can have
+    static float distance(const TerrainSettings &settings, uint64_t node, const glm::vec3 &viewer)
+    {
+        float width = settings.node_size(terrain_node_level(node));
+        glm::vec3 lo(-0.5f * settings.size + terrain_node_x(node) * width, 0.0f,
+                     -0.5f * settings.size + terrain_node_z(node) * width);
+        glm::vec3 hi = lo + glm::vec3(width, settings.height, width);
+        return glm::length(glm::max(glm::max(lo - viewer, viewer - hi), glm::vec3(0.0f)));
+    }
+
+    template <typename Resident>
+    bool children_resident(uint64_t node, Resident &resident)
+    {
+        bool all = true;
+        for (int c = 0; c < 4; c++) {
+            uint64_t child = terrain_node_child(node, c);
+            if (!resident(child)) {
+                wanted.push_back(child);
+                all = false;
+            }
+        }
+        return all;
+    }
+
+    template <typename Resident>
+    void visit(const TerrainSettings &settings, const glm::vec3 &viewer, Resident &resident, uint64_t node)
+    {
+        unsigned int level = terrain_node_level(node);
+        if (level >= maxLevel || distance(settings, node, viewer) >= settings.lodDistance * settings.node_size(level))
+            return;
+        if (!children_resident(node, resident))
+            return;
+        split.push_back(node);
+        for (int c = 0; c < 4; c++)
+            visit(settings, viewer, resident, terrain_node_child(node, c));
+    }
+
+    bool is_split(uint64_t node) const { return std::binary_search(split.begin(), split.end(), node); }
+
+    // Level of the leaf across one edge of a leaf, beside the edge's midpoint, or one more
+    // than the leaf's if it is finer; false at the terrain's edge. Walks up from the leaf's
+    // level, since neighbours are seldom more than a level coarser.
+    bool neighbour_level(uint64_t leaf, int edge, unsigned int &level) const
+    {
+        unsigned int own = terrain_node_level(leaf), span = 1u << (maxLevel - own), extent = 1u << maxLevel;
+        unsigned int x = terrain_node_x(leaf) * span, z = terrain_node_z(leaf) * span;
+        unsigned int px = x + span / 2, pz = z + span / 2;
+        if (edge == TERRAIN_EDGE_WEST)
+            px = x - 1;
+        else if (edge == TERRAIN_EDGE_EAST)
+            px = x + span;
+        else if (edge == TERRAIN_EDGE_NORTH)
+            pz = z - 1;
+        else
+            pz = z + span;
+        if (px >= extent || pz >= extent)
+            return false;
+        auto covering = [&](unsigned int l) { return terrain_node(l, px >> (maxLevel - l), pz >> (maxLevel - l)); };
+        level = own + 1;
+        if (is_split(covering(own)))
+            return true;
+        for (level = own; level > 0 && !is_split(covering(level - 1)); level--) {}
+        return true;
+    }
+
+    void collect_leaves(uint64_t node)
+    {
+        if (!is_split(node)) {
+            leaves.push_back(node);
+            return;
+        }
+        for (int c = 0; c < 4; c++)
+            collect_leaves(terrain_node_child(node, c));
+    }
+
+    // Where a leaf is more than one level finer than a neighbour, merges the leaf into its
+    // parent until no such pair is left. Merging always has something to draw, since the
+    // parents of resident nodes are resident, and only ever lowers levels, so this ends.
+    // It only happens while chunks are streaming in: with a lodDistance of 1.5 or more the
+    // distance test alone keeps neighbours within a level.
+    void balance()
+    {
+        for (bool changed = true; changed;) {
+            changed = false;
+            leaves.clear();
+            collect_leaves(terrain_node(0, 0, 0));
+            stitch.assign(leaves.size(), 0);
+            for (size_t i = 0; i < leaves.size() && !changed; i++) {
+                unsigned int level = terrain_node_level(leaves[i]);
+                for (int edge = TERRAIN_EDGE_WEST; edge <= TERRAIN_EDGE_SOUTH && !changed; edge <<= 1) {
+                    unsigned int other;
+                    if (!neighbour_level(leaves[i], edge, other) || other >= level)
+                        continue;
+                    if (other + 1 < level) {
+                        merge(terrain_node_parent(leaves[i]));
+                        changed = true;
+                    }
+                    stitch[i] |= (uint8_t)edge;
+                }
+            }
+        }
+    }
+
+    // Makes a node a leaf, dropping everything below it
+    void merge(uint64_t node)
+    {
+        unsigned int level = terrain_node_level(node), x = terrain_node_x(node), z = terrain_node_z(node);
+        split.erase(std::remove_if(split.begin(), split.end(), [&](uint64_t n) {
+            unsigned int below = terrain_node_level(n);
+            if (below < level)
+                return false;
+            unsigned int shift = below - level;
+            return (terrain_node_x(n) >> shift) == x && (terrain_node_z(n) >> shift) == z;
+        }), split.end());
+    }
+};
+
+// Heightmap terrain drawn as a chunked quadtree, at a cost that depends on how much detail
+// is near the viewer rather than on the terrain's size. Each frame update() picks leaves
+// with TerrainQuadtree, culls them against the camera and shadow frustums one by one, and
+// asks the job system for the chunks the view would like next. Those are generated on
+// worker threads and uploaded a few per frame; until they arrive their parent is drawn.
+// Chunks that fall out of use stay cached up to settings.cacheChunks, then the least
+// recently drawn are dropped, finest first. The root is loaded up front and never dropped.
+//
+// Chunks live in GPU slots, each a vertex buffer and vertex array that are reused rather
+// than deleted. Every slot shares one index buffer holding the 16 stitch patterns and one
+// identity instance, so the lighting and depth shaders draw chunks like any other mesh.
+class Terrain
+{
+public:
+    enum View { VIEW_CAMERA, VIEW_LIGHT };
+
+    TerrainSettings settings;
+
+    Terrain(const TerrainSettings &s, JobSystem *jobSystem = nullptr): settings(s), jobs(jobSystem)
+    {
+        std::vector<unsigned int> indices;
+        for (unsigned int stitch = 0; stitch < 16; stitch++) {
+            patterns[stitch].first = (unsigned int)indices.size();
+            terrain_chunk_indices(stitch, indices);
+            patterns[stitch].count = (unsigned int)indices.size() - patterns[stitch].first;
+        }
+        glGenBuffers(1, &EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        Instance identity = {glm::mat4(1.0f), glm::mat3(1.0f)};
+        glGenBuffers(1, &instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Instance), &identity, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        Loaded root;
+        root.node = terrain_node(0, 0, 0);
+        generate_terrain_chunk(settings, root.node, root.vertices, root.lo, root.hi);
+        chunks[root.node] = Chunk();
+        upload(root);
+    }
+
+    // Jobs still generating chunks point at this terrain
+    ~Terrain()
+    {
+        if (jobs)
+            jobs->wait(streaming);
+    }
+
+    // Generates everything the view wants right away, so the next frame draws it at full
+    // detail; for the first frame and for tests that need the same image every run
+    void preload(const glm::vec3 &viewer)
+    {
+        if (jobs)
+            jobs->wait(streaming);
+        upload_ready(ready.size());
+        auto resident = [this](uint64_t node) { return is_resident(node); };
+        for (;;) {
+            quadtree.select(settings, viewer, resident);
+            if (quadtree.wanted.empty())
+                break;
+            std::vector<Loaded> loaded(quadtree.wanted.size());
+            auto generate = [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    loaded[i].node = quadtree.wanted[i];
+                    generate_terrain_chunk(settings, loaded[i].node, loaded[i].vertices, loaded[i].lo, loaded[i].hi);
+                }
+            };
+            if (jobs)
+                jobs->parallel_for(0, loaded.size(), 4, generate);
+            else
+                generate(0, loaded.size());
+            for (Loaded &chunk: loaded) {
+                if (chunks.find(chunk.node) == chunks.end())
+                    chunks[chunk.node] = Chunk();
+                upload(chunk);
+            }
+        }
+        evict();
+    }
+
+    // Picks and culls this frame's chunks and streams in the ones the view wants next
+    void update(const glm::vec3 &viewer, const Frustum &camera, const Frustum &light)
+    {
+        PROFILE_FUNCTION();
+        frame++;
+        upload_ready((size_t)settings.uploadsPerFrame);
+        auto resident = [this](uint64_t node) { return is_resident(node); };
+        quadtree.select(settings, viewer, resident);
+        request(quadtree.wanted);
+
+        visible[VIEW_CAMERA].clear();
+        visible[VIEW_LIGHT].clear();
+        for (size_t i = 0; i < quadtree.leaves.size(); i++) {
+            Chunk &chunk = chunks[quadtree.leaves[i]];
+            chunk.lastUsed = frame;
+            DrawChunk draw = {chunk.slot, quadtree.stitch[i]};
+            if (camera.intersects_sphere(glm::vec3(chunk.bounds), chunk.bounds.w))
+                visible[VIEW_CAMERA].push_back(draw);
+            if (light.intersects_sphere(glm::vec3(chunk.bounds), chunk.bounds.w))
+                visible[VIEW_LIGHT].push_back(draw);
+        }
+        evict();
+    }
+
+    void draw(View view)
+    {
+        const std::vector<DrawChunk> &list = visible[view];
+        if (list.empty())
+            return;
+        for (const DrawChunk &chunk: list) {
+            const Pattern &pattern = patterns[chunk.stitch];
+            glBindVertexArray(slots[chunk.slot].VAO);
+            glDrawElements(GL_TRIANGLES, pattern.count, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * pattern.first));
+            render_stats().drawCalls++;
+            render_stats().triangles += pattern.count / 3;
+            render_stats().stateChanges++;
+        }
+        glBindVertexArray(0);
+    }
+
+    // Around the whole terrain, for the scene; chunks are culled on their own in update()
+    glm::vec4 bounding_sphere() const
+    {
+        glm::vec3 corner(0.5f * settings.size, 0.0f, 0.5f * settings.size);
+        return Mesh::sphere_around(-corner, corner + glm::vec3(0.0f, settings.height, 0.0f));
+    }
+
+    size_t leaf_count() const { return quadtree.leaves.size(); }
+    size_t drawn(View view) const { return visible[view].size(); }
+    size_t resident_count() const { return slots.size() - freeSlots.size(); }
+    // Requested and not uploaded yet; each update() uploads some and may request more
+    int pending_count() const { return pending; }
+
+private:
+    struct Chunk
+    {
+        int slot = -1;             // -1 while generating
+        unsigned int lastUsed = 0;
+        glm::vec4 bounds;
+    };
+
+    struct Slot
+    {
+        GLuint VAO;
+        GLuint VBO;
+    };
+
+    struct Pattern
+    {
+        unsigned int first;
+        unsigned int count;
+    };
+
+    struct DrawChunk
+    {
+        int slot;
+        uint8_t stitch;
+    };
+
+    struct Loaded
+    {
+        uint64_t node;
+        std::vector<Vertex> vertices;
+        float lo, hi;
+    };
+
+    JobSystem *jobs;
+    GLuint EBO = 0;
+    GLuint instanceVBO = 0;
+    Pattern patterns[16];
+    TerrainQuadtree quadtree;
+    std::unordered_map<uint64_t, Chunk> chunks;    // resident and generating
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    std::vector<DrawChunk> visible[2];
+    unsigned int frame = 0;
+    int pending = 0;                               // requested and not yet uploaded
+
+    // Handed over by the jobs; vertex arrays go back to `spare` after upload so streaming
+    // reuses them instead of allocating
+    JobCounter streaming;
+    std::mutex mutex;
+    std::vector<Loaded> ready;
+    std::vector<Loaded> uploading;
+    std::vector<std::vector<Vertex>> spare;
+
+    bool is_resident(uint64_t node) const
+    {
+        auto it = chunks.find(node);
+        return it != chunks.end() && it->second.slot >= 0;
+    }
+
+    void request(const std::vector<uint64_t> &nodes)
+    {
+        for (uint64_t node: nodes) {
+            if (pending >= settings.maxPending)
+                return;
+            if (chunks.find(node) != chunks.end())
+                continue;
+            chunks[node] = Chunk();
+            pending++;
+            if (!jobs) {
+                Loaded chunk;
+                chunk.node = node;
+                generate_terrain_chunk(settings, node, chunk.vertices, chunk.lo, chunk.hi);
+                ready.push_back(std::move(chunk));
+                continue;
+            }
+            jobs->run([this, node]() {
+                Loaded chunk;
+                chunk.node = node;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!spare.empty()) {
+                        chunk.vertices.swap(spare.back());
+                        spare.pop_back();
+                    }
+                }
+                generate_terrain_chunk(settings, node, chunk.vertices, chunk.lo, chunk.hi);
+                std::lock_guard<std::mutex> lock(mutex);
+                ready.push_back(std::move(chunk));
+            }, &streaming);
+        }
+    }
+
+    // Uploads up to budget finished chunks, outside the lock so jobs never wait on GL
+    void upload_ready(size_t budget)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t count = std::min(budget, ready.size());
+            for (size_t i = 0; i < count; i++)
+                uploading.push_back(std::move(ready[i]));
+            ready.erase(ready.begin(), ready.begin() + count);
+        }
+        for (Loaded &chunk: uploading) {
+            pending--;
+            // Dropped while it was generating if its parent was evicted meanwhile
+            uint64_t node = chunk.node;
+            if (!is_resident(terrain_node_parent(node))) {
+                chunks.erase(node);
+                continue;
+            }
+            upload(chunk);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Loaded &chunk: uploading)
+            spare.push_back(std::move(chunk.vertices));
+        uploading.clear();
+    }
+
+    void upload(const Loaded &loaded)
+    {
+        Chunk &chunk = chunks[loaded.node];
+        chunk.slot = acquire_slot();
+        chunk.lastUsed = frame;
+        float width = settings.node_size(terrain_node_level(loaded.node));
+        glm::vec3 lo(-0.5f * settings.size + terrain_node_x(loaded.node) * width, loaded.lo,
+                     -0.5f * settings.size + terrain_node_z(loaded.node) * width);
+        chunk.bounds = Mesh::sphere_around(lo, glm::vec3(lo.x + width, loaded.hi, lo.z + width));
+        glBindBuffer(GL_ARRAY_BUFFER, slots[chunk.slot].VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Vertex) * loaded.vertices.size(), loaded.vertices.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    int acquire_slot()
+    {
+        if (!freeSlots.empty()) {
+            int slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
+        Slot slot;
+        glGenVertexArrays(1, &slot.VAO);
+        glGenBuffers(1, &slot.VBO);
+        glBindVertexArray(slot.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, slot.VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * TERRAIN_CHUNK_VERTICES, nullptr, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texcoord));
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (GLuint c = 0; c < 4; c++) {
+            glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  (void*)(offsetof(Instance, transform) + c * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(3 + c);
+            glVertexAttribDivisor(3 + c, 1);
+        }
+        for (GLuint c = 0; c < 3; c++) {
+            glVertexAttribPointer(7 + c, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  (void*)(offsetof(Instance, normal) + c * sizeof(glm::vec3)));
+            glEnableVertexAttribArray(7 + c);
+            glVertexAttribDivisor(7 + c, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        slots.push_back(slot);
+        return (int)slots.size() - 1;
+    }
+
+    bool has_resident_child(uint64_t node) const
+    {
+        for (int c = 0; c < 4; c++) {
+            if (is_resident(terrain_node_child(node, c)))
+                return true;
+        }
+        return false;
+    }
+
+    // Drops the least recently drawn chunks over the cache size. Only chunks without
+    // resident children go, so every resident chunk's parent stays resident and a merge
+    // in TerrainQuadtree::balance always has something to draw.
+    void evict()
+    {
+        while (resident_count() > settings.cacheChunks) {
+            auto victim = chunks.end();
+            for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+                const Chunk &chunk = it->second;
+                if (chunk.slot < 0 || chunk.lastUsed == frame || terrain_node_level(it->first) == 0)
+                    continue;
+                if (victim != chunks.end() && chunk.lastUsed >= victim->second.lastUsed)
+                    continue;
+                if (!has_resident_child(it->first))
+                    victim = it;
+            }
+            if (victim == chunks.end())
+                return;
+            freeSlots.push_back(victim->second.slot);
+            chunks.erase(victim);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,396 @@
+#ifndef VERTEX_ANIMATION_H
+#define VERTEX_ANIMATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include "Animation.h"
+#include "AnimationCompression.h"
+#include "JobSystem.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "RenderStats.h"
+#include "Skinning.h"
+#include "shader.h"
+
+// Every frame of a model's clips, posed ahead of time: the model's parts merged into one
+// mesh, and each frame's model-space vertex positions and normals, frame after frame.
+// Clips loop, so a clip's frames run from its start up to, but not including, its end.
+struct BakedAnimation
+{
+    struct Clip
+    {
+        std::string name;
+        unsigned int firstFrame;
+        unsigned int frameCount;
+        float frameRate;     // frames per second, 0 for a clip without duration
+        float duration;
+    };
+
+    std::vector<Vertex> vertices;          // the bind pose
+    std::vector<unsigned int> indices;
+    std::vector<Clip> clips;
+    std::vector<glm::vec4> positions;      // frame * vertices.size() + vertex
+    std::vector<glm::vec4> normals;
+    uint64_t source = 0;                   // hash_file of the model it was baked from
+
+    size_t frame_count() const { return vertices.empty() ? 0 : positions.size() / vertices.size(); }
+
+    // A text header, then the arrays as they are in memory
+    bool save(const std::string &path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            std::cout << "ERROR::BAKED_ANIMATION::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        file << "VAT2 " << source << ' ' << vertices.size() << ' ' << indices.size() << ' ' << frame_count() << ' ' << clips.size() << '\n';
+        for (const Clip &clip: clips) {
+            file << clip.firstFrame << ' ' << clip.frameCount << ' ' << clip.frameRate << ' ' << clip.duration
+                 << ' ' << clip.name << '\n';
+        }
+        file.write((const char *)vertices.data(), sizeof(Vertex) * vertices.size());
+        file.write((const char *)indices.data(), sizeof(unsigned int) * indices.size());
+        file.write((const char *)positions.data(), sizeof(glm::vec4) * positions.size());
+        file.write((const char *)normals.data(), sizeof(glm::vec4) * normals.size());
+        return (bool)file;
+    }
+
+    // Fails for a file baked from anything but the model whose hash_file is expectedSource,
+    // so a stale bake is redone rather than drawn over the wrong vertices
+    bool load(const std::string &path, uint64_t expectedSource)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::string magic;
+        size_t vertexCount = 0, indexCount = 0, frames = 0, clipCount = 0;
+        if (!file || !(file >> magic >> source >> vertexCount >> indexCount >> frames >> clipCount) || magic != "VAT2")
+            return false;
+        if (source != expectedSource) {
+            std::cout << "Ignoring " << path << ", it was baked from a different model" << std::endl;
+            return false;
+        }
+        clips.resize(clipCount);
+        for (Clip &clip: clips) {
+            file >> clip.firstFrame >> clip.frameCount >> clip.frameRate >> clip.duration;
+            file.get();
+            std::getline(file, clip.name);
+        }
+        if (clipCount == 0)
+            file.get();
+        vertices.assign(vertexCount, Vertex(glm::vec3(0.0f), glm::vec3(0.0f)));
+        indices.resize(indexCount);
+        positions.resize(frames * vertexCount);
+        normals.resize(frames * vertexCount);
+        file.read((char *)vertices.data(), sizeof(Vertex) * vertices.size());
+        file.read((char *)indices.data(), sizeof(unsigned int) * indices.size());
+        file.read((char *)positions.data(), sizeof(glm::vec4) * positions.size());
+        file.read((char *)normals.data(), sizeof(glm::vec4) * normals.size());
+        if (!file)
+            return false;
+        for (unsigned int index: indices) {
+            if (index >= vertexCount)
+                return false;
+        }
+        return true;
+    }
+};
+
+// FNV-1a over a file's bytes, 0 if it can't be read
+inline uint64_t hash_file(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return 0;
+    uint64_t hash = 14695981039346656037ull;
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        for (std::streamsize i = 0; i < file.gcount(); i++)
+            hash = (hash ^ (unsigned char)buffer[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// One placement of a mesh in the model. A part without skin moves rigidly with its joint;
+// a skinned part is posed by its palette and ignores joint.
+struct BakePart
+{
+    const std::vector<Vertex> *vertices;
+    const std::vector<unsigned int> *indices;
+    const std::vector<VertexSkin> *skin;
+    const SkinBinding *binding;
+    int joint;
+};
+
+// Joints of the nodes that reference each mesh, numbering nodes the way Model::add_joints
+// does
+inline void find_mesh_placements(const aiNode *node, int &joint, std::vector<std::vector<int>> &placements)
+{
+    int index = joint++;
+    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+        placements[node->mMeshes[i]].push_back(index);
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+        find_mesh_placements(node->mChildren[i], joint, placements);
+}
+
+// Loads the model's meshes, bound to the skeleton's joints, and makes a part of each place a
+// node references one. The parts point into meshes.
+inline void import_bake_parts(const aiScene *model, const Skeleton &skeleton, std::vector<Model::MeshData> &meshes,
+                              std::vector<BakePart> &parts)
+{
+    meshes.assign(model->mNumMeshes, Model::MeshData());
+    for (unsigned int m = 0; m < model->mNumMeshes; m++) {
+        Model::process_mesh(model->mMeshes[m], meshes[m]);
+        SkinBinding &binding = meshes[m].binding;
+        for (const std::string &name: binding.names)
+            binding.joints.push_back(skeleton.find(name));
+    }
+    std::vector<std::vector<int>> placements(model->mNumMeshes);
+    int joint = 0;
+    find_mesh_placements(model->mRootNode, joint, placements);
+    parts.clear();
+    for (unsigned int m = 0; m < model->mNumMeshes; m++) {
+        const Model::MeshData &data = meshes[m];
+        for (int placement: placements[m])
+            parts.push_back({&data.vertices, &data.indices, &data.skin, &data.binding, placement});
+    }
+}
+
+// Every part's vertices for one pose, in model space, one part after another. model holds
+// the joints' model transforms; palette is scratch for skinning, as large as the largest
+// binding.
+inline void pose_bake_parts(const std::vector<BakePart> &parts, const std::vector<glm::mat4> &model,
+                            std::vector<glm::mat4> &palette, Vertex *out)
+{
+    for (const BakePart &part: parts) {
+        size_t count = part.vertices->size();
+        if (!part.skin->empty() && !part.binding->empty()) {
+            part.binding->palette(model, palette.data());
+            skin_vertices(palette.data(), part.vertices->data(), part.skin->data(), count, out);
+        } else {
+            glm::mat4 transform = part.joint >= 0 ? model[part.joint] : glm::mat4(1.0f);
+            glm::mat3 normalTransform = glm::inverseTranspose(glm::mat3(transform));
+            for (size_t v = 0; v < count; v++) {
+                const Vertex &in = (*part.vertices)[v];
+                out[v].position = glm::vec3(transform * glm::vec4(in.position, 1.0f));
+                out[v].normal = glm::normalize(normalTransform * in.normal);
+                out[v].texcoord = in.texcoord;
+            }
+        }
+        out += count;
+    }
+}
+
+// Poses the parts at frameRate frames per second through each clip, as Model would draw
+// them. Given a job system, frames are posed in parallel. Uses no GL, so it can run offline.
+inline void bake_vertex_animation(const Skeleton &skeleton, const std::vector<CompressedClip> &clips,
+                                  const std::vector<BakePart> &parts, float frameRate, BakedAnimation &baked,
+                                  JobSystem *jobs = nullptr)
+{
+    baked = BakedAnimation();
+    size_t paletteSize = 0;
+    for (const BakePart &part: parts) {
+        unsigned int base = (unsigned int)baked.vertices.size();
+        for (unsigned int i: *part.indices)
+            baked.indices.push_back(base + i);
+        baked.vertices.insert(baked.vertices.end(), part.vertices->begin(), part.vertices->end());
+        paletteSize = std::max(paletteSize, part.binding->joints.size());
+    }
+
+    std::vector<glm::mat4> model, palette(std::max<size_t>(paletteSize, 1));
+    pose_to_model(skeleton, skeleton.bindPose, model);
+    pose_bake_parts(parts, model, palette, baked.vertices.data());
+
+    // Which clip and time each frame shows
+    struct Frame { const CompressedClip *clip; float time; };
+    std::vector<Frame> frames;
+    for (const CompressedClip &clip: clips) {
+        unsigned int count = std::max(1u, (unsigned int)std::lround(clip.duration * frameRate));
+        float rate = clip.duration > 0.0f ? count / clip.duration : 0.0f;
+        baked.clips.push_back({clip.name, (unsigned int)frames.size(), count, rate, clip.duration});
+        for (unsigned int f = 0; f < count; f++)
+            frames.push_back({&clip, rate > 0.0f ? f / rate : 0.0f});
+    }
+
+    size_t vertexCount = baked.vertices.size();
+    baked.positions.resize(frames.size() * vertexCount);
+    baked.normals.resize(frames.size() * vertexCount);
+    auto bake = [&](size_t first, size_t last) {
+        std::vector<JointPose> pose;
+        std::vector<glm::mat4> model, palette(std::max<size_t>(paletteSize, 1));
+        std::vector<Vertex> posed(vertexCount, Vertex(glm::vec3(0.0f), glm::vec3(0.0f)));
+        for (size_t f = first; f < last; f++) {
+            frames[f].clip->sample(skeleton, frames[f].time, pose);
+            pose_to_model(skeleton, pose, model);
+            pose_bake_parts(parts, model, palette, posed.data());
+            for (size_t v = 0; v < vertexCount; v++) {
+                baked.positions[f * vertexCount + v] = glm::vec4(posed[v].position, 1.0f);
+                baked.normals[f * vertexCount + v] = glm::vec4(posed[v].normal, 0.0f);
+            }
+        }
+    };
+    if (jobs)
+        jobs->parallel_for(0, frames.size(), 4, bake);
+    else
+        bake(0, frames.size());
+}
+
+// Where one member of a crowd stands and what it plays. phase is seconds into its clip
+// at time zero; speed scales its playback.
+struct CrowdAgent
+{
+    glm::mat4 transform;
+    unsigned int clip;
+    float phase;
+    float speed;
+};
+
+// Any number of copies of a baked animation in one instanced draw. Each copy's clip, phase
+// and speed are per-instance attributes, and the vertex shader reads its frame's positions
+// and normals from two textures, blending neighbouring frames, so animating the crowd
+// costs the CPU one uniform per frame however many members it has.
+//
+// The textures hold one texel per vertex per frame, in rows TEXTURE_WIDTH wide: positions
+// in 32-bit floats and normals in 16-bit ones. The shaders read them on texture units
+// POSITION_UNIT and NORMAL_UNIT, after the shadow map on unit 0.
+class Crowd
+{
+public:
+    static const int TEXTURE_WIDTH = 1024;    // BAKED_WIDTH in the shaders
+    static const unsigned int MAX_CLIPS = 16; // size of the shaders' bakedClips
+    static const GLuint POSITION_UNIT = 1;
+    static const GLuint NORMAL_UNIT = 2;
+
+    // Empty placeholder with no GL objects; draws nothing
+    Crowd() {}
+
+    // Without room for the baked frames in a texture the crowd is left empty and draws nothing
+    Crowd(const BakedAnimation &baked, const std::vector<CrowdAgent> &agents)
+        : mesh(baked.vertices, baked.indices), vertexCount((int)baked.vertices.size())
+    {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (texture_rows(baked.positions.size()) > maxSize) {
+            std::cout << "ERROR::CROWD::BAKE_TOO_LARGE " << baked.frame_count() << " frames of " << vertexCount
+                      << " vertices need " << texture_rows(baked.positions.size()) << " rows, the limit is "
+                      << maxSize << std::endl;
+            return;
+        }
+        for (size_t c = 0; c < baked.clips.size() && c < MAX_CLIPS; c++) {
+            const BakedAnimation::Clip &clip = baked.clips[c];
+            clipTable.push_back(glm::vec4((float)clip.firstFrame, (float)clip.frameCount, clip.frameRate,
+                                          std::max(clip.duration, 1e-6f)));
+        }
+        std::vector<glm::mat4> transforms;
+        std::vector<glm::vec4> animation;
+        for (const CrowdAgent &agent: agents) {
+            transforms.push_back(agent.transform);
+            float clip = clipTable.empty() ? 0.0f : (float)std::min<size_t>(agent.clip, clipTable.size() - 1);
+            animation.push_back(glm::vec4(clip, agent.phase, agent.speed, 0.0f));
+        }
+        mesh.set_instances(transforms);
+        glBindVertexArray(mesh.VAO);
+        glGenBuffers(1, &animationVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, animationVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * animation.size(), animation.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(12, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glEnableVertexAttribArray(12);
+        glVertexAttribDivisor(12, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        positionTexture = upload_texture(baked.positions, GL_RGBA32F);
+        normalTexture = upload_texture(baked.normals, GL_RGBA16F);
+
+        glm::vec3 lo(1e30f), hi(-1e30f);
+        for (const glm::vec4 &p: baked.positions) {
+            lo = glm::min(lo, glm::vec3(p));
+            hi = glm::max(hi, glm::vec3(p));
+        }
+        for (const glm::mat4 &t: transforms) {
+            for (int corner = 0; corner < 8; corner++) {
+                glm::vec3 p(corner & 1 ? hi.x : lo.x, corner & 2 ? hi.y : lo.y, corner & 4 ? hi.z : lo.z);
+                glm::vec3 q(t * glm::vec4(p, 1.0f));
+                boundsLo = glm::min(boundsLo, q);
+                boundsHi = glm::max(boundsHi, q);
+            }
+        }
+    }
+
+    // Points a shader's baked animation samplers at their units, away from unit 0, where
+    // the shadow pass would otherwise see the shadow map it renders to
+    static void bind_samplers(Shader &shader)
+    {
+        shader.use();
+        shader.set_int("bakedPositions", POSITION_UNIT);
+        shader.set_int("bakedNormals", NORMAL_UNIT);
+    }
+
+    size_t size() const { return mesh.instances.size(); }
+
+    // Around every member in every frame
+    glm::vec4 bounding_sphere() const { return Mesh::sphere_around(boundsLo, boundsHi); }
+
+    // Draws every member time seconds into its animation. Sets `baked`, so shader must be
+    // the one in use. Without clips the members stand in the bind pose.
+    void draw(const Shader &shader, float time)
+    {
+        if (mesh.instances.empty())
+            return;
+        if (clipTable.empty()) {
+            mesh.draw();
+            return;
+        }
+        glActiveTexture(GL_TEXTURE0 + POSITION_UNIT);
+        glBindTexture(GL_TEXTURE_2D, positionTexture);
+        glActiveTexture(GL_TEXTURE0 + NORMAL_UNIT);
+        glBindTexture(GL_TEXTURE_2D, normalTexture);
+        glActiveTexture(GL_TEXTURE0);
+        render_stats().stateChanges += 2;
+        shader.set_bool("baked", true);
+        shader.set_int("bakedVertices", vertexCount);
+        shader.set_float("bakedTime", time);
+        shader.set_vec4_array("bakedClips", clipTable.data(), (int)clipTable.size());
+        mesh.draw();
+        shader.set_bool("baked", false);
+    }
+
+private:
+    Mesh mesh;
+    GLuint animationVBO = 0;
+    GLuint positionTexture = 0;
+    GLuint normalTexture = 0;
+    int vertexCount = 0;
+    std::vector<glm::vec4> clipTable;    // first frame, frame count, frame rate, duration
+    glm::vec3 boundsLo = glm::vec3(1e30f), boundsHi = glm::vec3(-1e30f);
+
+    static int texture_rows(size_t texels)
+    {
+        return (int)std::max<size_t>(1, (texels + TEXTURE_WIDTH - 1) / TEXTURE_WIDTH);
+    }
+
+    static GLuint upload_texture(const std::vector<glm::vec4> &texels, GLenum format)
+    {
+        int rows = texture_rows(texels.size());
+        std::vector<glm::vec4> padded(texels);
+        padded.resize((size_t)rows * TEXTURE_WIDTH);
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, TEXTURE_WIDTH, rows, 0, GL_RGBA, GL_FLOAT, padded.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+};
+
+#endif
@@ -34,10 +34,11 @@ public:
     glm::vec3 front;
     glm::vec3 up;
     glm::vec3 right;    
+    unsigned int version; // bumped by every change made through the methods below
 
     Camera(glm::vec3 position, glm::vec3 up, float init_yaw, float init_pitch);
     
-    glm::mat4 get_view();
+    glm::mat4 get_view() const;
     
     void process_mouse_movement(float xoffset, float yoffset);
     
@@ -45,13 +46,13 @@ public:
     
     void process_keyboard_input(Camera_Direction direction, float dt);
 
+    void set_pose(glm::vec3 new_position, float new_yaw, float new_pitch, float new_fov);
+
 private:
 
     void update_camera_vectors();
 };
 
-#endif 
-
 Camera::Camera(
     glm::vec3 position,
     glm::vec3 world_up = glm::vec3(0.0f, 1.0f, 0.0f),
@@ -64,12 +65,13 @@ Camera::Camera(
     pitch(init_pitch),
     speed(SPEED),
     sensitivity(SENSITIVTY),
-    fov(FOV)
+    fov(FOV),
+    version(0)
 {
     update_camera_vectors();
 }
 
-glm::mat4 Camera::get_view()
+glm::mat4 Camera::get_view() const
 {
     glm::vec3 target = position + front;
     return glm::lookAt(position, target, world_up);
@@ -88,6 +90,7 @@ void Camera::process_mouse_movement(float xoffset, float yoffset)
 	pitch = -89.0f;
     }
     update_camera_vectors();
+    version++;
 }
 
 void Camera::process_mouse_scroll(float yoffset)
@@ -99,6 +102,7 @@ void Camera::process_mouse_scroll(float yoffset)
     } else if (fov >= 45.0f) {
 	fov = 45.0f;
     }
+    version++;
 }
 
 void Camera::process_keyboard_input(Camera_Direction direction, float dt)
@@ -116,6 +120,21 @@ void Camera::process_keyboard_input(Camera_Direction direction, float dt)
 	position += world_up * move_speed;
     if (direction == DOWN)
 	position -= world_up * move_speed;
+    version++;
+}
+
+void Camera::set_pose(glm::vec3 new_position, float new_yaw, float new_pitch, float new_fov)
+{
+    // Setting the same pose every frame must not invalidate cached matrices
+    if (new_position == position && new_yaw == yaw && new_pitch == pitch && new_fov == fov) {
+	return;
+    }
+    position = new_position;
+    yaw = new_yaw;
+    pitch = new_pitch;
+    fov = new_fov;
+    update_camera_vectors();
+    version++;
 }
 
 void Camera::update_camera_vectors()
@@ -127,4 +146,5 @@ void Camera::update_camera_vectors()
     right = glm::normalize(glm::cross(front, world_up));
     up = glm::normalize(glm::cross(right, front));
 }
-    
+
+#endif
@@ -4,10 +4,13 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cassert>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include "Profiler.h"
+#include "RenderStats.h"
 
 class Shader
 {
@@ -15,20 +18,24 @@ public:
     unsigned int ID;
     Shader(const std::string vertex_path, const std::string fragment_path);
     void use();
-    void set_bool(const std::string &name, bool value) const;
-    void set_int(const std::string &name, int value) const;
-    void set_float(const std::string &name, float value) const;
-    void set_mat4(const std::string &name, glm::mat4 value) const;
-    void set_vec3(const std::string &name, glm::vec3 value) const;
-    void set_vec3(const std::string &name, float x, float y, float z) const;
+    void set_bool(const char *name, bool value) const;
+    void set_int(const char *name, int value) const;
+    void set_float(const char *name, float value) const;
+    void set_mat3(const char *name, glm::mat3 value) const;
+    void set_mat4(const char *name, glm::mat4 value) const;
+    void set_vec2(const char *name, float x, float y) const;
+    void set_vec3(const char *name, glm::vec3 value) const;
+    void set_vec3(const char *name, float x, float y, float z) const;
+    void set_vec4_array(const char *name, const glm::vec4 *values, int count) const;
+    void bind_block(const char *name, GLuint binding) const;
 private:
     void check_compile_errors(unsigned int shader, std::string type);
 };
 
-#endif
     
 Shader::Shader(const std::string vertex_path, const std::string fragment_path)
 {
+    PROFILE_SCOPE("Shader::Shader");
     std::string vertex_code, fragment_code;
     std::ifstream vshader_file, fshader_file;
     // ensure ifstream objects can throw exceptions
@@ -73,42 +80,67 @@ Shader::Shader(const std::string vertex_path, const std::string fragment_path)
 void Shader::use()
 {
     glUseProgram(ID);
+    render_stats().stateChanges++;
+}
+
+void Shader::set_bool(const char *name, bool value) const
+{
+    glUniform1i(glGetUniformLocation(ID, name), (int)value); 
 }
 
-void Shader::set_bool(const std::string &name, bool value) const
+void Shader::set_int(const char *name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+    glUniform1i(glGetUniformLocation(ID, name), value);     
 }
 
-void Shader::set_int(const std::string &name, int value) const
+void Shader::set_float(const char *name, float value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);     
+    glUniform1f(glGetUniformLocation(ID, name), value);     
 }
 
-void Shader::set_float(const std::string &name, float value) const
+void Shader::set_mat3(const char *name, glm::mat3 value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);     
+    glUniformMatrix3fv(glGetUniformLocation(ID, name), 1, GL_FALSE, glm::value_ptr(value));
 }
 
-void Shader::set_mat4(const std::string &name, glm::mat4 value) const
+void Shader::set_mat4(const char *name, glm::mat4 value) const
 {
-	auto location = glGetUniformLocation(ID, name.c_str());
+	auto location = glGetUniformLocation(ID, name);
     assert(location != -1);
     if (location == -1) {
-        std::cout << "ERROR::SHADER::UNIFORM_NOT_FOUND " << name.c_str() << std::endl;
+        std::cout << "ERROR::SHADER::UNIFORM_NOT_FOUND " << name << std::endl;
     }
     glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
 }
 
-void Shader::set_vec3(const std::string &name, glm::vec3 value) const
+void Shader::set_vec2(const char *name, float x, float y) const
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+    glUniform2f(glGetUniformLocation(ID, name), x, y);
 }
 
-void Shader::set_vec3(const std::string &name, float x, float y, float z) const
+void Shader::set_vec3(const char *name, glm::vec3 value) const
+{
+    glUniform3fv(glGetUniformLocation(ID, name), 1, glm::value_ptr(value));
+}
+
+void Shader::set_vec3(const char *name, float x, float y, float z) const
 {
     glm::vec3 v(x, y, z);
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(v));
+    glUniform3fv(glGetUniformLocation(ID, name), 1, glm::value_ptr(v));
+}
+
+// Sets the first count elements of a vec4 array uniform
+void Shader::set_vec4_array(const char *name, const glm::vec4 *values, int count) const
+{
+    glUniform4fv(glGetUniformLocation(ID, name), count, (const GLfloat *)values);
+}
+
+// Points a uniform block at a buffer binding; does nothing if the program has no such block
+void Shader::bind_block(const char *name, GLuint binding) const
+{
+    GLuint index = glGetUniformBlockIndex(ID, name);
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(ID, index, binding);
 }
     
 void Shader::check_compile_errors(unsigned int shader, std::string type)
@@ -131,3 +163,5 @@ void Shader::check_compile_errors(unsigned int shader, std::string type)
 		}
     }
 }
+
+#endif
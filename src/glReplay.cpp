@@ -0,0 +1,393 @@
+#include <glad/glad.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "GlCapture.h"
+#include "HeadlessContext.h"
+#include "FrameStats.h"
+
+using namespace GlCapture;
+
+// One decoded argument of a captured call
+struct Arg
+{
+	uint8_t tag;
+	int64_t i;
+	float f;
+	uint8_t ns;
+	uint32_t name;
+	const uint8_t *data;
+	uint32_t size;
+};
+
+// Re-issues a capture written by GlCapture. Object names and uniform locations are
+// translated to the ones the replay context hands out, and the default framebuffer is
+// replaced by an offscreen target of the captured size.
+class Replayer
+{
+public:
+	uint32_t width = 0;
+	uint32_t height = 0;
+	unsigned int calls = 0;   // GL calls issued by the last run
+
+	bool load(const std::string &path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			std::cout << "ERROR::GL_REPLAY::FILE_NOT_SUCCESSFULLY_READ " << path << std::endl;
+			return false;
+		}
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		uint32_t header[3];
+		if (data.size() < 5 + sizeof(header) || std::memcmp(data.data(), "GLCAP", 5) != 0) {
+			std::cout << "ERROR::GL_REPLAY::NOT_A_CAPTURE " << path << std::endl;
+			return false;
+		}
+		std::memcpy(header, data.data() + 5, sizeof(header));
+		if (header[0] != VERSION) {
+			std::cout << "ERROR::GL_REPLAY::UNSUPPORTED_VERSION " << header[0] << std::endl;
+			return false;
+		}
+		width = header[1];
+		height = header[2];
+
+		// Split the stream into setup and frames up front so the timed loop only executes
+		size_t pos = 5 + sizeof(header);
+		setupEnd = 0;
+		size_t frameStart = 0;
+		while (pos < data.size()) {
+			size_t start = pos;
+			Op op;
+			if (!decode(pos, op, args)) {
+				std::cout << "ERROR::GL_REPLAY::TRUNCATED_RECORD at byte " << start << std::endl;
+				return false;
+			}
+			if (op == OP_FRAME_BEGIN) {
+				if (frames.empty() && setupEnd == 0)
+					setupEnd = start;
+				frameStart = pos;
+			} else if (op == OP_FRAME_END) {
+				frames.push_back(std::make_pair(frameStart, start));
+			}
+		}
+		if (frames.empty()) {
+			std::cout << "ERROR::GL_REPLAY::NO_FRAMES_CAPTURED" << std::endl;
+			return false;
+		}
+		setupBegin = 5 + sizeof(header);
+		return true;
+	}
+
+	void set_target(GLuint framebuffer) { names[NS_FRAMEBUFFER][0] = framebuffer; }
+
+	unsigned int frame_count() const { return frames.size(); }
+
+	void run_setup() { run(setupBegin, setupEnd); }
+
+	void run_frames()
+	{
+		calls = 0;
+		for (const std::pair<size_t, size_t> &frame: frames)
+			run(frame.first, frame.second);
+	}
+
+private:
+	std::vector<uint8_t> data;
+	size_t setupBegin = 0;
+	size_t setupEnd = 0;
+	std::vector<std::pair<size_t, size_t>> frames;
+	std::map<uint32_t, GLuint> names[NS_COUNT];
+	std::map<uint64_t, GLint> locations;        // (program, captured location) -> location
+	std::map<uint64_t, GLuint> blockIndices;    // (program, captured index) -> index
+	uint32_t currentProgram = 0;
+	std::vector<Arg> args;
+
+	template <typename T>
+	bool read(size_t &pos, T &value)
+	{
+		if (pos + sizeof(T) > data.size())
+			return false;
+		std::memcpy(&value, data.data() + pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	bool decode(size_t &pos, Op &op, std::vector<Arg> &out)
+	{
+		uint16_t code;
+		uint8_t count;
+		if (!read(pos, code) || !read(pos, count) || code >= OP_COUNT)
+			return false;
+		op = (Op)code;
+		out.resize(count);
+		for (Arg &arg: out) {
+			if (!read(pos, arg.tag))
+				return false;
+			int32_t i32;
+			uint32_t u32;
+			switch (arg.tag) {
+			case TAG_INT:
+				if (!read(pos, i32)) return false;
+				arg.i = i32;
+				break;
+			case TAG_UINT:
+				if (!read(pos, u32)) return false;
+				arg.i = u32;
+				break;
+			case TAG_INT64:
+				if (!read(pos, arg.i)) return false;
+				break;
+			case TAG_FLOAT:
+				if (!read(pos, arg.f)) return false;
+				break;
+			case TAG_NAME:
+				if (!read(pos, arg.ns) || !read(pos, arg.name) || arg.ns >= NS_COUNT) return false;
+				break;
+			case TAG_BLOB:
+				if (!read(pos, arg.size) || pos + arg.size > data.size()) return false;
+				arg.data = arg.size ? data.data() + pos : NULL;
+				pos += arg.size;
+				break;
+			default:
+				return false;
+			}
+		}
+		return true;
+	}
+
+	GLuint name(const Arg &arg)
+	{
+		auto it = names[arg.ns].find(arg.name);
+		if (it != names[arg.ns].end())
+			return it->second;
+		return arg.name;
+	}
+
+	GLint location(const Arg &arg)
+	{
+		if (arg.i < 0)
+			return (GLint)arg.i;
+		auto it = locations.find(((uint64_t)currentProgram << 32) | (uint32_t)arg.i);
+		return it != locations.end() ? it->second : -1;
+	}
+
+	const GLfloat *floats(const Arg &arg) { return (const GLfloat *)arg.data; }
+	GLsizei count(const Arg &arg, unsigned int elementSize) { return arg.size / elementSize; }
+
+	void generate(Namespace ns, const Arg &arg, void (APIENTRYP gen)(GLsizei, GLuint *))
+	{
+		GLsizei n = count(arg, 4);
+		std::vector<GLuint> captured(n), created(n);
+		std::memcpy(captured.data(), arg.data, arg.size);
+		gen(n, created.data());
+		for (GLsizei i = 0; i < n; i++)
+			names[ns][captured[i]] = created[i];
+	}
+
+	void remove(Namespace ns, const Arg &arg, void (APIENTRYP del)(GLsizei, const GLuint *))
+	{
+		GLsizei n = count(arg, 4);
+		std::vector<GLuint> captured(n), replayed(n);
+		std::memcpy(captured.data(), arg.data, arg.size);
+		for (GLsizei i = 0; i < n; i++) {
+			Arg a = {TAG_NAME, 0, 0.0f, (uint8_t)ns, captured[i], NULL, 0};
+			replayed[i] = name(a);
+			if (captured[i] != 0)
+				names[ns].erase(captured[i]);
+		}
+		del(n, replayed.data());
+	}
+
+	void run(size_t pos, size_t end)
+	{
+		Op op;
+		while (pos < end) {
+			decode(pos, op, args);
+			execute(op, args);
+			calls++;
+		}
+	}
+
+	void execute(Op op, const std::vector<Arg> &a)
+	{
+		switch (op) {
+		case OP_FRAME_BEGIN: case OP_FRAME_END: break;
+		case OP_ACTIVE_TEXTURE: glActiveTexture(a[0].i); break;
+		case OP_ATTACH_SHADER: glAttachShader(name(a[0]), name(a[1])); break;
+		case OP_BIND_BUFFER: glBindBuffer(a[0].i, name(a[1])); break;
+		case OP_BIND_BUFFER_BASE: glBindBufferBase(a[0].i, a[1].i, name(a[2])); break;
+		case OP_BIND_FRAMEBUFFER: glBindFramebuffer(a[0].i, name(a[1])); break;
+		case OP_BIND_RENDERBUFFER: glBindRenderbuffer(a[0].i, name(a[1])); break;
+		case OP_BIND_TEXTURE: glBindTexture(a[0].i, name(a[1])); break;
+		case OP_BIND_VERTEX_ARRAY: glBindVertexArray(name(a[0])); break;
+		case OP_BLEND_FUNC: glBlendFunc(a[0].i, a[1].i); break;
+		case OP_BUFFER_DATA: glBufferData(a[0].i, a[1].i, a[2].data, a[3].i); break;
+		case OP_BUFFER_SUB_DATA: glBufferSubData(a[0].i, a[1].i, a[2].size, a[2].data); break;
+		case OP_CLEAR: glClear(a[0].i); break;
+		case OP_CLEAR_COLOR: glClearColor(a[0].f, a[1].f, a[2].f, a[3].f); break;
+		case OP_COLOR_MASK: glColorMask(a[0].i, a[1].i, a[2].i, a[3].i); break;
+		case OP_COMPILE_SHADER: glCompileShader(name(a[0])); break;
+		case OP_CREATE_PROGRAM: names[NS_PROGRAM][a[0].name] = glCreateProgram(); break;
+		case OP_CREATE_SHADER: names[NS_PROGRAM][a[1].name] = glCreateShader(a[0].i); break;
+		case OP_CULL_FACE: glCullFace(a[0].i); break;
+		case OP_DELETE_BUFFERS: remove(NS_BUFFER, a[0], glDeleteBuffers); break;
+		case OP_DELETE_FRAMEBUFFERS: remove(NS_FRAMEBUFFER, a[0], glDeleteFramebuffers); break;
+		case OP_DELETE_PROGRAM: glDeleteProgram(name(a[0])); break;
+		case OP_DELETE_RENDERBUFFERS: remove(NS_RENDERBUFFER, a[0], glDeleteRenderbuffers); break;
+		case OP_DELETE_SHADER: glDeleteShader(name(a[0])); break;
+		case OP_DELETE_TEXTURES: remove(NS_TEXTURE, a[0], glDeleteTextures); break;
+		case OP_DELETE_VERTEX_ARRAYS: remove(NS_VERTEX_ARRAY, a[0], glDeleteVertexArrays); break;
+		case OP_DEPTH_FUNC: glDepthFunc(a[0].i); break;
+		case OP_DEPTH_MASK: glDepthMask(a[0].i); break;
+		case OP_DISABLE: glDisable(a[0].i); break;
+		case OP_DISABLE_VERTEX_ATTRIB_ARRAY: glDisableVertexAttribArray(a[0].i); break;
+		case OP_DRAW_ARRAYS: glDrawArrays(a[0].i, a[1].i, a[2].i); break;
+		case OP_DRAW_BUFFER: glDrawBuffer(a[0].i); break;
+		case OP_DRAW_BUFFERS: glDrawBuffers(count(a[0], 4), (const GLenum *)a[0].data); break;
+		case OP_DRAW_ELEMENTS: glDrawElements(a[0].i, a[1].i, a[2].i, (const void *)(intptr_t)a[3].i); break;
+		case OP_DRAW_ELEMENTS_INSTANCED:
+			glDrawElementsInstanced(a[0].i, a[1].i, a[2].i, (const void *)(intptr_t)a[3].i, a[4].i);
+			break;
+		case OP_ENABLE: glEnable(a[0].i); break;
+		case OP_ENABLE_VERTEX_ATTRIB_ARRAY: glEnableVertexAttribArray(a[0].i); break;
+		case OP_FINISH: glFinish(); break;
+		case OP_FLUSH: glFlush(); break;
+		case OP_FRAMEBUFFER_RENDERBUFFER: glFramebufferRenderbuffer(a[0].i, a[1].i, a[2].i, name(a[3])); break;
+		case OP_FRAMEBUFFER_TEXTURE_2D: glFramebufferTexture2D(a[0].i, a[1].i, a[2].i, name(a[3]), a[4].i); break;
+		case OP_GEN_BUFFERS: generate(NS_BUFFER, a[0], glGenBuffers); break;
+		case OP_GEN_FRAMEBUFFERS: generate(NS_FRAMEBUFFER, a[0], glGenFramebuffers); break;
+		case OP_GEN_RENDERBUFFERS: generate(NS_RENDERBUFFER, a[0], glGenRenderbuffers); break;
+		case OP_GEN_TEXTURES: generate(NS_TEXTURE, a[0], glGenTextures); break;
+		case OP_GEN_VERTEX_ARRAYS: generate(NS_VERTEX_ARRAY, a[0], glGenVertexArrays); break;
+		case OP_GET_UNIFORM_BLOCK_INDEX:
+			blockIndices[((uint64_t)a[0].name << 32) | (uint32_t)a[2].i] =
+				glGetUniformBlockIndex(name(a[0]), (const GLchar *)a[1].data);
+			break;
+		case OP_GET_UNIFORM_LOCATION:
+			locations[((uint64_t)a[0].name << 32) | (uint32_t)a[2].i] =
+				glGetUniformLocation(name(a[0]), (const GLchar *)a[1].data);
+			break;
+		case OP_LINK_PROGRAM: glLinkProgram(name(a[0])); break;
+		case OP_PIXEL_STOREI: glPixelStorei(a[0].i, a[1].i); break;
+		case OP_POLYGON_OFFSET: glPolygonOffset(a[0].f, a[1].f); break;
+		case OP_READ_BUFFER: glReadBuffer(a[0].i); break;
+		case OP_RENDERBUFFER_STORAGE: glRenderbufferStorage(a[0].i, a[1].i, a[2].i, a[3].i); break;
+		case OP_SCISSOR: glScissor(a[0].i, a[1].i, a[2].i, a[3].i); break;
+		case OP_SHADER_SOURCE: {
+			const GLchar *source = (const GLchar *)a[1].data;
+			glShaderSource(name(a[0]), 1, &source, NULL);
+			break;
+		}
+		case OP_TEX_IMAGE_2D:
+			glTexImage2D(a[0].i, a[1].i, a[2].i, a[3].i, a[4].i, a[5].i, a[6].i, a[7].i, a[8].data);
+			break;
+		case OP_TEX_PARAMETERF: glTexParameterf(a[0].i, a[1].i, a[2].f); break;
+		case OP_TEX_PARAMETERFV: glTexParameterfv(a[0].i, a[1].i, floats(a[2])); break;
+		case OP_TEX_PARAMETERI: glTexParameteri(a[0].i, a[1].i, a[2].i); break;
+		case OP_TEX_SUB_IMAGE_2D:
+			glTexSubImage2D(a[0].i, a[1].i, a[2].i, a[3].i, a[4].i, a[5].i, a[6].i, a[7].i, a[8].data);
+			break;
+		case OP_UNIFORM_1F: glUniform1f(location(a[0]), a[1].f); break;
+		case OP_UNIFORM_1FV: glUniform1fv(location(a[0]), count(a[1], 4), floats(a[1])); break;
+		case OP_UNIFORM_1I: glUniform1i(location(a[0]), a[1].i); break;
+		case OP_UNIFORM_1IV: glUniform1iv(location(a[0]), count(a[1], 4), (const GLint *)a[1].data); break;
+		case OP_UNIFORM_2F: glUniform2f(location(a[0]), a[1].f, a[2].f); break;
+		case OP_UNIFORM_2FV: glUniform2fv(location(a[0]), count(a[1], 8), floats(a[1])); break;
+		case OP_UNIFORM_3F: glUniform3f(location(a[0]), a[1].f, a[2].f, a[3].f); break;
+		case OP_UNIFORM_3FV: glUniform3fv(location(a[0]), count(a[1], 12), floats(a[1])); break;
+		case OP_UNIFORM_4F: glUniform4f(location(a[0]), a[1].f, a[2].f, a[3].f, a[4].f); break;
+		case OP_UNIFORM_4FV: glUniform4fv(location(a[0]), count(a[1], 16), floats(a[1])); break;
+		case OP_UNIFORM_BLOCK_BINDING: {
+			auto it = blockIndices.find(((uint64_t)a[0].name << 32) | (uint32_t)a[1].i);
+			glUniformBlockBinding(name(a[0]), it != blockIndices.end() ? it->second : (GLuint)a[1].i, a[2].i);
+			break;
+		}
+		case OP_UNIFORM_MATRIX_3FV: glUniformMatrix3fv(location(a[0]), count(a[2], 36), a[1].i, floats(a[2])); break;
+		case OP_UNIFORM_MATRIX_4FV: glUniformMatrix4fv(location(a[0]), count(a[2], 64), a[1].i, floats(a[2])); break;
+		case OP_USE_PROGRAM:
+			currentProgram = a[0].name;
+			glUseProgram(name(a[0]));
+			break;
+		case OP_VERTEX_ATTRIB_DIVISOR: glVertexAttribDivisor(a[0].i, a[1].i); break;
+		case OP_VERTEX_ATTRIB_IPOINTER:
+			glVertexAttribIPointer(a[0].i, a[1].i, a[2].i, a[3].i, (const void *)(intptr_t)a[4].i);
+			break;
+		case OP_VERTEX_ATTRIB_POINTER:
+			glVertexAttribPointer(a[0].i, a[1].i, a[2].i, a[3].i, a[4].i, (const void *)(intptr_t)a[5].i);
+			break;
+		case OP_VIEWPORT: glViewport(a[0].i, a[1].i, a[2].i, a[3].i); break;
+		default: break;
+		}
+	}
+};
+
+double currentTime()
+{
+	static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Usage: glReplay capture.bin [--loops N] [--warmup N]
+// Runs the captured setup once, then the captured frames in a loop. "submit" is the CPU
+// time spent issuing the calls, i.e. application-side plus driver overhead; "frame" also
+// waits for the GPU to finish.
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		std::cout << "Usage: glReplay capture.bin [--loops N] [--warmup N]" << std::endl;
+		return -1;
+	}
+	std::string path = argv[1];
+	int loops = 500;
+	int warmup = 20;
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--loops" && i + 1 < argc) {
+			loops = std::atoi(argv[++i]);
+		} else if (arg == "--warmup" && i + 1 < argc) {
+			warmup = std::atoi(argv[++i]);
+		} else {
+			std::cout << "Unknown option " << arg << std::endl;
+			return -1;
+		}
+	}
+
+	HeadlessContext context;
+	if (!context.create()) { return -1; }
+	Replayer replayer;
+	if (!replayer.load(path)) {
+		context.destroy();
+		return -1;
+	}
+	replayer.set_target(context.create_target(replayer.width, replayer.height));
+
+	double start = currentTime();
+	replayer.run_setup();
+	glFinish();
+	std::cout << "setup: " << (currentTime() - start) * 1000.0 << " ms" << std::endl;
+
+	std::vector<double> submitTimes, frameTimes;
+	for (int i = 0; i < warmup + loops; i++) {
+		start = currentTime();
+		replayer.run_frames();
+		double submitted = currentTime();
+		glFinish();
+		double end = currentTime();
+		if (i >= warmup) {
+			submitTimes.push_back((submitted - start) * 1000.0);
+			frameTimes.push_back((end - start) * 1000.0);
+		}
+	}
+
+	std::cout << replayer.frame_count() << " captured frame(s), " << replayer.calls
+			  << " GL calls per loop at " << replayer.width << "x" << replayer.height << std::endl;
+	FrameStats::compute(submitTimes).print("submit");
+	FrameStats::compute(frameTimes).print("frame");
+	context.destroy();
+	return 0;
+}
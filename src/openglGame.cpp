@@ -2,10 +2,18 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <cmath>
+#include <cfloat>
 #include <vector>
 #include <sstream>
 #include <map>
 #include <utility>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <random>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -14,18 +22,142 @@
 #include "stb_image.h"
 #include "camera.h"
 #include "Model.h"
+#include "FrameGraph.h"
+#include "PostProcess.h"
+#include "GpuProfiler.h"
+#include "Profiler.h"
+#include "HeadlessContext.h"
+#include "FrameStats.h"
+#include "CameraPath.h"
+#include "RenderStats.h"
+#include "GlCapture.h"
+#include "GoldenImage.h"
+#include "GameLoop.h"
+#include "InputQueue.h"
+#include "FramePacer.h"
+#include "FrameConstants.h"
+#include "CpuUsage.h"
+#include "Scene.h"
+#include "MeshBVH.h"
+#include "Picking.h"
+#include "JobSystem.h"
+#include "FrameArena.h"
+#include "VertexAnimation.h"
+#include "Terrain.h"
+#include "SoftwareScene.h"
 
+#ifdef TRACK_ALLOCATIONS
+// Counts every C++ heap allocation, on any thread, for printAllocations
+void *operator new(std::size_t size)
+{
+	allocation_count().fetch_add(1, std::memory_order_relaxed);
+	if (void *p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+#endif
+
+// What a scene entity draws, stored in Scene::renderables
+enum Renderable { RENDER_MODEL, RENDER_TERRAIN, RENDER_CROWD };
+
+// Everything the render passes draw with, owned by main()
+struct SceneResources
+{
+	Model &model;
+	Terrain &terrain;
+	Crowd &crowd;               // empty unless --crowd
+	Mesh &screenQuad;
+	Shader &lightingShader;
+	Shader &depthShader;
+	Shader &screenShader;
+	PostProcess &post;
+	Scene &entities;            // transforms of everything drawn, updated once per frame
+	GLuint outputFramebuffer;   // 0 for the window, an offscreen target when headless
+	FrameVector<uint32_t> cameraVisible;   // entities to draw in each pass, from cullScene
+	FrameVector<uint32_t> lightVisible;
+};
+
+struct Options
+{
+	bool headless = false;
+	bool benchmark = false;
+	int frames = 300;
+	int warmupFrames = 60;
+	std::string gpuCsvPath;
+	std::string tracePath = "trace.json";
+	std::string cameraPath;         // benchmark path to replay, the built-in orbit if empty
+	std::string recordPath;         // where to save the camera path flown in the window
+	std::string benchmarkJsonPath = "benchmark.json";
+	std::string benchmarkLabel;
+	std::string capturePath;        // GL command capture for the glReplay tool
+	int captureFrames = 1;
+	std::string goldenDir;          // golden.txt and reference images to check against
+	bool goldenUpdate = false;      // re-record the references and budgets instead
+	double tickRate = 60.0;         // simulation updates per second in the window
+	bool updateThread = false;      // run simulation ticks on their own thread
+	int framesInFlight = 2;         // frames the CPU may queue ahead of the GPU
+	int swapInterval = 1;           // 0 disables vsync
+	bool idle = false;              // stop redrawing while nothing changes
+	int sceneBenchEntities = 0;     // time Scene::update() over this many entities and exit
+	bool bvhBench = false;          // time MeshBVH builds and queries on the dragon and exit
+	bool jobBench = false;          // time job system scaling from 1 to N threads and exit
+	int workers = -1;               // job system worker threads, -1 for one per extra core
+	bool cpuSkinning = false;       // skin on the CPU instead of in the vertex shader
+	int skinningBenchCharacters = 0;   // time animating this many characters and exit
+	int animationBenchCharacters = 0;  // time compressed clip sampling for this many characters and exit
+	int crowdSize = 0;              // boxguys drawn from baked vertex animation
+	bool bakeCrowd = false;         // bake the crowd's vertex animation and exit
+	float terrainSize = 4096.0f;    // metres along each side of the terrain
+	bool terrainBench = false;      // time terrain chunk selection on terrains from 1 to 64 km and exit
+	bool software = false;          // render on the CPU with the software rasteriser and exit
+	std::string softwarePath = "software.ppm";   // where --software saves its frame
+};
+
+bool parseOptions(int argc, char **argv, Options &options);
 bool setupWindow(GLFWwindow *window);
 void framebufferSizeCallback(GLFWwindow *window, int width, int height);
-void processInput(GLFWwindow *window);
+void window_refresh_callback(GLFWwindow *window);
+bool needsRedraw(const SceneResources &scene, double oldestInput, unsigned int renderedCameraVersion);
+double processInput(GLFWwindow *window);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+void pickAtCursor(GLFWwindow *window, const Scene &entities, const Picker &picker);
 void configureShader(Shader &shader, bool shadow);
-void setupScreenBuffer(GLuint &fbo, GLuint &texture, GLuint &rbo);
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+void cullScene(SceneResources &scene);
+void drawEntities(SceneResources &scene, Shader &shader, bool normals, const FrameVector<uint32_t> &visible);
+void buildFrameGraph(FrameGraph &graph, SceneResources &scene);
+void renderFrame(FrameGraph &graph, SceneResources &scene, GpuProfiler &gpuProfiler);
+int runBenchmark(GLFWwindow *window, FrameGraph &graph, SceneResources &scene, GpuProfiler &gpuProfiler);
+int runGoldenTests(SceneResources &scene, GpuProfiler &gpuProfiler);
+int runSceneBenchmark(int count);
+int runBvhBenchmark(const std::string &path);
+int runJobBenchmark();
+void importClips(const aiScene *model, Skeleton &skeleton, std::vector<AnimationClip> &clips);
+int runSkinningBenchmark(const std::string &path, int characters);
+int runAnimationBenchmark(const std::string &path, int characters);
+bool bakeCrowd(const std::string &path, const std::string &bakePath, BakedAnimation &baked);
+std::vector<CrowdAgent> placeCrowd(const BakedAnimation &baked, int count);
+int runTerrainBenchmark();
+int runSoftwareRenderer();
+void printAllocations(const std::string &label, uint64_t allocations, int frames);
+double currentTime();
 Mesh getScreenQuad();
-Mesh getPlane(float xsize, float zsize);
 
 glm::vec3 lightDirection(1.0, -0.8, -0.5);
 Camera camera(glm::vec3(-10, 5, 0));
+FrameConstants FRAME_CONSTANTS;
 
 float SCR_WIDTH = 1920;
 float SCR_HEIGHT = 1080;
@@ -34,14 +166,35 @@ float SHADOW_HEIGHT = 2 * 1024;
 
 float DELTA_TIME = 0;
 float LAST_FRAME = 0;
+float ANIMATION_TIME = 0;       // seconds into the model's clip; fixed for golden tests
 double LAST_X = 400;
 double LAST_Y = 300;
 bool FIRST_MOUSE = true;
 
-const std::string rootdir = "C:/Users/Roderick/Documents/Projects/OpenGLGame/";
-const std::string dragonPath = rootdir + "model/dragon/dragon.obj";
-const std::string modelPath = rootdir + "model/boxguy/export/boxguy.fbx";
-const std::string shaderdir = rootdir + "src/shaders/";
+PostProcessSettings POST_SETTINGS;
+bool REBUILD_FRAME_GRAPH = false;
+bool PRINT_GPU_TIMINGS = false;
+bool WRITE_CPU_TRACE = false;
+bool REDRAW_REQUESTED = false;
+bool CURSOR_FREE = false;       // F7: the cursor points instead of turning the camera
+bool PICK_REQUESTED = false;
+double PICK_X = 0;
+double PICK_Y = 0;
+Options OPTIONS;
+Simulation SIMULATION;
+// The first frames size the frame arenas, job queues and GPU query pools, so steady-state
+// allocations are counted from this frame on
+const int ALLOCATION_WARMUP_FRAMES = 2 * FrameArena::FRAMES + GpuProfiler::FRAME_LATENCY;
+JobSystem JOBS;
+InputQueue INPUT_QUEUE;
+std::vector<bool> KEYS_HELD(512, false);
+
+// Asset paths are relative to ROOT_DIR, which --root overrides
+std::string ROOT_DIR = "C:/Users/Roderick/Documents/Projects/OpenGLGame/";
+const std::string dragonPath = "model/dragon/dragon.obj";
+const std::string modelPath = "model/boxguy/export/boxguy.fbx";
+const std::string crowdBakePath = "model/boxguy/export/boxguy.vat";
+const std::string shaderdir = "src/shaders/";
 const std::string lightingVertex = shaderdir + "lighting_vert.glsl";
 const std::string lightingFragment = shaderdir + "lighting_frag.glsl";
 const std::string depthVertex = shaderdir + "depth_vert.glsl";
@@ -49,62 +202,1351 @@ const std::string emptyFragment = shaderdir + "empty_frag.glsl";
 const std::string screenVertex = shaderdir + "screen_vert.glsl";
 const std::string screenFragment = shaderdir + "screen_frag.glsl";
 
-int main()
+int main(int argc, char **argv)
 {
-	glfwInit();		
-	GLFWwindow *window = glfwCreateWindow((int)SCR_WIDTH, (int)SCR_HEIGHT, "OpenGL Game", NULL, NULL);
-	if (!setupWindow(window)) {	return -1; }
+	if (!parseOptions(argc, argv, OPTIONS)) { return -1; }
+	if (OPTIONS.sceneBenchEntities > 0) { return runSceneBenchmark(OPTIONS.sceneBenchEntities); }
+	if (OPTIONS.bvhBench) { return runBvhBenchmark(ROOT_DIR + dragonPath); }
+	if (OPTIONS.jobBench) { return runJobBenchmark(); }
+	if (OPTIONS.skinningBenchCharacters > 0) { 
+		return runSkinningBenchmark(ROOT_DIR + modelPath, OPTIONS.skinningBenchCharacters); 
+	}
+	if (OPTIONS.animationBenchCharacters > 0) {
+		return runAnimationBenchmark(ROOT_DIR + modelPath, OPTIONS.animationBenchCharacters);
+	}
+	if (OPTIONS.terrainBench) { return runTerrainBenchmark(); }
+	JOBS.start(OPTIONS.workers >= 0 ? OPTIONS.workers : std::max(1u, std::thread::hardware_concurrency()) - 1);
+	if (OPTIONS.bakeCrowd) {
+		BakedAnimation baked;
+		return bakeCrowd(ROOT_DIR + modelPath, ROOT_DIR + crowdBakePath, baked) ? 0 : -1;
+	}
+	if (OPTIONS.software) { return runSoftwareRenderer(); }
+
+	GLFWwindow *window = NULL;
+	HeadlessContext headless;
+	if (OPTIONS.headless) {
+		if (!headless.create()) { return -1; }
+	} else {
+		glfwInit();		
+		window = glfwCreateWindow((int)SCR_WIDTH, (int)SCR_HEIGHT, "OpenGL Game", NULL, NULL);
+		if (!setupWindow(window)) {	return -1; }
+		glfwSwapInterval(OPTIONS.swapInterval);
+	}
+	if (!OPTIONS.capturePath.empty()) {
+		GlCapture::install(OPTIONS.capturePath, OPTIONS.captureFrames, (int)SCR_WIDTH, (int)SCR_HEIGHT);
+	}
 	
-	Model model(modelPath);
-	Shader lightingShader(lightingVertex, lightingFragment);
-	Shader depthShader(depthVertex, emptyFragment);
-	Shader screenShader(screenVertex, screenFragment);
+	Model model(ROOT_DIR + modelPath, &JOBS);
+	Shader lightingShader(ROOT_DIR + lightingVertex, ROOT_DIR + lightingFragment);
+	Shader depthShader(ROOT_DIR + depthVertex, ROOT_DIR + emptyFragment);
+	Shader screenShader(ROOT_DIR + screenVertex, ROOT_DIR + screenFragment);
+	lightingShader.bind_block("JointPalette", JOINT_PALETTE_BINDING);
+	depthShader.bind_block("JointPalette", JOINT_PALETTE_BINDING);
+	bind_default_joint_palette();
+	Crowd::bind_samplers(lightingShader);
+	Crowd::bind_samplers(depthShader);
+	model.cpuSkinning = OPTIONS.cpuSkinning;
 	Mesh screenQuad = getScreenQuad();
-	Mesh plane = getPlane(20.0, 20.0);
-
-	GLuint fbo, texture, depthMap;
-	setupScreenBuffer(fbo, texture, depthMap);
-
-	while (!glfwWindowShouldClose(window)) {
-		processInput(window);
-		float current_frame = glfwGetTime();
-		DELTA_TIME = current_frame - LAST_FRAME;
-		LAST_FRAME = current_frame;
-
-		//lightDirection = glm::vec3(1.0, -0.8, std::sin(current_frame));
-		glEnable(GL_DEPTH_TEST);
-		glClearColor(0.1, 0.1, 0.1, 1.0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		configureShader(depthShader, true);
-
-		// Render to depth map
-		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		model.draw();
-		plane.draw();
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-		// Render Scene
-		glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-		glClearColor(0.3f, 0.3f, 0.5f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);
-		lightingShader.set_int("shadowMap", 0);
-		glBindTexture(GL_TEXTURE_2D, depthMap);
-		configureShader(lightingShader, false);
-		model.draw();
-		plane.draw();
-
-		glfwSwapBuffers(window);
-		glfwPollEvents();
-	}
-	glfwTerminate();
+	TerrainSettings terrainSettings;
+	terrainSettings.size = OPTIONS.terrainSize;
+	Terrain terrain(terrainSettings, &JOBS);
+	terrain.preload(camera.position);
+	FRAME_CONSTANTS.set_view_distance(terrainSettings.size);
+	Crowd crowd;
+	if (OPTIONS.crowdSize > 0) {
+		// Baked offline with --bake-crowd, or now if there is no bake yet
+		BakedAnimation baked;
+		if (!baked.load(ROOT_DIR + crowdBakePath, hash_file(ROOT_DIR + modelPath)) && !bakeCrowd(ROOT_DIR + modelPath, ROOT_DIR + crowdBakePath, baked)) {
+			return -1;
+		}
+		crowd = Crowd(baked, placeCrowd(baked, OPTIONS.crowdSize));
+	}
+
+	GpuProfiler gpuProfiler;
+	PostProcess post(ROOT_DIR + shaderdir, screenQuad, gpuProfiler);
+	post.settings = POST_SETTINGS;
+
+	GLuint outputFramebuffer = 0;
+	if (OPTIONS.headless) {
+		outputFramebuffer = headless.create_target((int)SCR_WIDTH, (int)SCR_HEIGHT);
+	}
+	Scene entities;
+	Entity terrainEntity = entities.create(NO_ENTITY, RENDER_TERRAIN);
+	entities.set_bounds(terrainEntity, terrain.bounding_sphere());
+	Entity modelEntity = entities.create(NO_ENTITY, RENDER_MODEL);
+	entities.set_bounds(modelEntity, model.bounding_sphere());
+	if (crowd.size() > 0) {
+		Entity crowdEntity = entities.create(NO_ENTITY, RENDER_CROWD);
+		entities.set_bounds(crowdEntity, crowd.bounding_sphere());
+	}
+	SceneResources scene = {model, terrain, crowd, screenQuad, lightingShader, depthShader, screenShader, post, 
+							entities, outputFramebuffer};
+
+	FrameGraph frameGraph;
+	buildFrameGraph(frameGraph, scene);
+	frameGraph.compile();
+	frameGraph.print_summary();
+
+	if (!OPTIONS.goldenDir.empty()) {
+		int result = runGoldenTests(scene, gpuProfiler);
+		headless.destroy();
+		return result;
+	}
+
+	if (OPTIONS.benchmark) {
+		int result = runBenchmark(window, frameGraph, scene, gpuProfiler);
+		if (OPTIONS.headless) {
+			headless.destroy();
+		} else {
+			glfwTerminate();
+		}
+		return result;
+	}
+
+	if (OPTIONS.headless) {
+		// Each frame is finished before the next so the times cover the whole GPU workload
+		std::vector<double> frameTimes;
+		frameTimes.reserve(OPTIONS.frames);
+		uint64_t steadyAllocations = 0;
+		for (int i = 0; i < OPTIONS.frames; i++) {
+			uint64_t allocations = allocation_count();
+			double start = currentTime();
+			ANIMATION_TIME = (float)start;
+			renderFrame(frameGraph, scene, gpuProfiler);
+			glFinish();
+			frameTimes.push_back((currentTime() - start) * 1000.0);
+			if (i >= ALLOCATION_WARMUP_FRAMES) {
+				steadyAllocations += allocation_count() - allocations;
+			}
+		}
+		FrameStats::compute(frameTimes).print("headless " + std::to_string((int)SCR_WIDTH) + "x" + 
+											  std::to_string((int)SCR_HEIGHT));
+		printAllocations("headless", steadyAllocations, OPTIONS.frames - ALLOCATION_WARMUP_FRAMES);
+		gpuProfiler.print();
+	} else {
+		CameraPath recording;
+		Picker picker;
+		picker.add_renderable(RENDER_MODEL, model.get_meshes());
+		picker.add_terrain(RENDER_TERRAIN, terrain.settings);
+		FramePacer pacer(OPTIONS.framesInFlight);
+		std::vector<double> inputLatency;
+		inputLatency.reserve(1 << 16);
+		uint64_t steadyAllocations = 0;
+		unsigned int renderedCameraVersion = camera.version - 1;
+		double activeWall = 0.0, activeCpu = 0.0, idleWall = 0.0, idleCpu = 0.0;
+		unsigned int renderedFrames = 0, idleWaits = 0;
+		SIMULATION.reset(camera, OPTIONS.tickRate);
+		if (OPTIONS.updateThread) {
+			SIMULATION.start();
+		}
+		while (!glfwWindowShouldClose(window)) {
+			// Wait for a free frame slot first, then sample input as late as possible before
+			// the view is built
+			pacer.wait();
+			glfwPollEvents();
+			JOBS.run_main_thread_jobs();
+			double oldestInput = processInput(window);
+			if (!SIMULATION.threaded()) {
+				SIMULATION.update(currentTime());
+			}
+			CameraKey view = SIMULATION.sample();
+			camera.set_pose(view.position, view.yaw, view.pitch, view.fov);
+			if (PICK_REQUESTED) {
+				// Animated parts have moved since the picker last saw them
+				picker.update_instances(RENDER_MODEL, model.get_meshes());
+				pickAtCursor(window, entities, picker);
+				PICK_REQUESTED = false;
+			}
+
+			// The last frame stays on screen because nothing is swapped while idle
+			if (OPTIONS.idle && !needsRedraw(scene, oldestInput, renderedCameraVersion)) {
+				double waitStart = currentTime(), waitCpu = process_cpu_time();
+				glfwWaitEventsTimeout(0.5);
+				idleWall += currentTime() - waitStart;
+				idleCpu += process_cpu_time() - waitCpu;
+				idleWaits++;
+				if (!SIMULATION.threaded()) {
+					SIMULATION.skip_to(currentTime());
+				}
+				continue;
+			}
+
+			uint64_t frameAllocations = allocation_count();
+			double frameStart = currentTime(), frameCpu = process_cpu_time();
+			REDRAW_REQUESTED = false;
+			renderedCameraVersion = camera.version;
+			ANIMATION_TIME = (float)frameStart;
+			renderFrame(frameGraph, scene, gpuProfiler);
+			if (oldestInput >= 0.0) {
+				inputLatency.push_back((currentTime() - oldestInput) * 1000.0);
+			}
+			if (!OPTIONS.recordPath.empty() && 
+				(recording.keys.empty() || LAST_FRAME - recording.keys.back().time >= 0.25f)) {
+				recording.record(LAST_FRAME, camera);
+			}
+			glfwSwapBuffers(window);
+			pacer.end_frame();
+			activeWall += currentTime() - frameStart;
+			activeCpu += process_cpu_time() - frameCpu;
+			if (renderedFrames >= (unsigned int)ALLOCATION_WARMUP_FRAMES) {
+				steadyAllocations += allocation_count() - frameAllocations;
+			}
+			renderedFrames++;
+		}
+		pacer.destroy();
+		if (OPTIONS.idle) {
+			std::cout << "rendering: " << renderedFrames << " frames, " << activeWall << " s, " 
+					  << (activeWall > 0.0 ? 100.0 * activeCpu / activeWall : 0.0) << "% CPU" << std::endl;
+			std::cout << "idle: " << idleWaits << " waits, " << idleWall << " s, " 
+					  << (idleWall > 0.0 ? 100.0 * idleCpu / idleWall : 0.0) << "% CPU" << std::endl;
+		}
+		SIMULATION.stop();
+		FrameStats::compute(inputLatency).print("input to submit");
+		printAllocations("window", steadyAllocations, (int)renderedFrames - ALLOCATION_WARMUP_FRAMES);
+		if (SIMULATION.dropped_time() > 0.0) {
+			std::cout << "Simulation fell behind, dropped " << SIMULATION.dropped_time() << " s" << std::endl;
+		}
+		if (!OPTIONS.recordPath.empty() && recording.save(OPTIONS.recordPath)) {
+			std::cout << "Saved camera path to " << OPTIONS.recordPath << std::endl;
+		}
+	}
+
+	if (!OPTIONS.gpuCsvPath.empty()) {
+		gpuProfiler.write_csv(OPTIONS.gpuCsvPath);
+	}
+	if (OPTIONS.headless) {
+		headless.destroy();
+	} else {
+		glfwTerminate();
+	}
+	return 0;
+}
+
+void renderFrame(FrameGraph &frameGraph, SceneResources &scene, GpuProfiler &gpuProfiler)
+{
+	PROFILE_SCOPE("frame");
+	float current_frame = currentTime();
+	DELTA_TIME = current_frame - LAST_FRAME;
+	LAST_FRAME = current_frame;
+	FrameArena::begin_frame();
+
+	if (REBUILD_FRAME_GRAPH) {
+		scene.post.settings = POST_SETTINGS;
+		frameGraph.reset();
+		buildFrameGraph(frameGraph, scene);
+		frameGraph.compile();
+		frameGraph.print_summary();
+		REBUILD_FRAME_GRAPH = false;
+	}
+	if (WRITE_CPU_TRACE) {
+		Profiler::write_chrome_trace(OPTIONS.tracePath);
+		WRITE_CPU_TRACE = false;
+	}
+	if (PRINT_GPU_TIMINGS) {
+		gpuProfiler.print();
+		PRINT_GPU_TIMINGS = false;
+	}
+
+	//lightDirection = glm::vec3(1.0, -0.8, std::sin(current_frame));
+	render_stats().reset();
+	scene.model.animate(ANIMATION_TIME);
+	scene.entities.update();
+	FRAME_CONSTANTS.update(camera, SCR_WIDTH / SCR_HEIGHT, lightDirection);
+	scene.terrain.update(FRAME_CONSTANTS.viewPosition, FRAME_CONSTANTS.frustum, FRAME_CONSTANTS.lightFrustum);
+	cullScene(scene);
+	GlCapture::begin_frame();
+	gpuProfiler.begin_frame();
+	frameGraph.execute(&gpuProfiler);
+	gpuProfiler.end_frame();
+	GlCapture::end_frame();
+}
+
+void writeStatsJson(std::ofstream &file, const std::string &name, const FrameStats &stats)
+{
+	file << "  \"" << name << "\": {\"mean\": " << stats.mean << ", \"min\": " << stats.min
+		 << ", \"p50\": " << stats.p50 << ", \"p95\": " << stats.p95 << ", \"p99\": " << stats.p99
+		 << ", \"max\": " << stats.max << "}";
+}
+
+// Replays a camera path with a fixed simulated timestep, so every run renders the same
+// frames regardless of how fast they are produced. Warm-up frames are rendered but not
+// measured; the results go to stdout and to OPTIONS.benchmarkJsonPath.
+int runBenchmark(GLFWwindow *window, FrameGraph &frameGraph, SceneResources &scene, GpuProfiler &gpuProfiler)
+{
+	CameraPath path = CameraPath::orbit(12.0f, 5.0f, 20.0f);
+	if (!OPTIONS.cameraPath.empty() && !path.load(OPTIONS.cameraPath)) {
+		std::cout << "Camera path needs at least two keys: " << OPTIONS.cameraPath << std::endl;
+		return -1;
+	}
+
+	const float timestep = 1.0f / 60.0f;
+	std::vector<double> cpuTimes, frameTimes, drawCalls;
+	cpuTimes.reserve(OPTIONS.frames);
+	frameTimes.reserve(OPTIONS.frames);
+	drawCalls.reserve(OPTIONS.frames);
+	uint64_t steadyAllocations = 0;
+	int total = OPTIONS.warmupFrames + OPTIONS.frames;
+	for (int i = 0; i < total; i++) {
+		if (window && glfwWindowShouldClose(window)) {
+			break;
+		}
+		if (i == OPTIONS.warmupFrames) {
+			gpuProfiler.record_zone("frame");
+		}
+		path.apply(i * timestep, camera);
+		ANIMATION_TIME = i * timestep;
+
+		uint64_t allocations = allocation_count();
+		double start = currentTime();
+		renderFrame(frameGraph, scene, gpuProfiler);
+		double submitted = currentTime();
+		if (window) {
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		} else {
+			glFinish();
+		}
+		double end = currentTime();
+
+		if (i >= OPTIONS.warmupFrames) {
+			cpuTimes.push_back((submitted - start) * 1000.0);
+			frameTimes.push_back((end - start) * 1000.0);
+			drawCalls.push_back(render_stats().drawCalls);
+			steadyAllocations += allocation_count() - allocations;
+		}
+	}
+	gpuProfiler.flush();
+	printAllocations("benchmark", steadyAllocations, (int)frameTimes.size());
+
+	FrameStats cpu = FrameStats::compute(cpuTimes);
+	FrameStats frame = FrameStats::compute(frameTimes);
+	FrameStats gpu = FrameStats::compute(gpuProfiler.recorded_samples());
+	FrameStats draws = FrameStats::compute(drawCalls);
+	cpu.print("cpu");
+	gpu.print("gpu");
+	frame.print("frame");
+	std::cout << "draw calls: " << draws.mean << " mean, " << draws.max << " max" << std::endl;
+
+	std::ofstream file(OPTIONS.benchmarkJsonPath);
+	if (!file) {
+		std::cout << "ERROR::BENCHMARK::CANNOT_WRITE " << OPTIONS.benchmarkJsonPath << std::endl;
+		return -1;
+	}
+	file << "{\n";
+	file << "  \"label\": \"";
+	Profiler::write_escaped(file, OPTIONS.benchmarkLabel.c_str());
+	file << "\",\n  \"camera_path\": \"";
+	Profiler::write_escaped(file, OPTIONS.cameraPath.empty() ? "orbit" : OPTIONS.cameraPath.c_str());
+	file << "\",\n";
+	file << "  \"headless\": " << (OPTIONS.headless ? "true" : "false") << ",\n";
+	file << "  \"width\": " << (int)SCR_WIDTH << ",\n  \"height\": " << (int)SCR_HEIGHT << ",\n";
+	file << "  \"warmup_frames\": " << OPTIONS.warmupFrames << ",\n";
+	file << "  \"frames\": " << cpu.count << ",\n";
+	writeStatsJson(file, "cpu_ms", cpu);
+	file << ",\n";
+	writeStatsJson(file, "gpu_ms", gpu);
+	file << ",\n";
+	writeStatsJson(file, "frame_ms", frame);
+	file << ",\n";
+	writeStatsJson(file, "draw_calls", draws);
+	file << ",\n  \"passes\": {";
+	std::vector<GpuProfiler::Stats> passes = gpuProfiler.get_stats();
+	for (unsigned int i = 0; i < passes.size(); i++) {
+		file << (i ? ", " : "") << "\"";
+		Profiler::write_escaped(file, passes[i].name.c_str());
+		file << "\": {\"avg\": " << passes[i].avg 
+			 << ", \"p99\": " << passes[i].p99 << "}";
+	}
+	file << "}\n}\n";
+	std::cout << "Wrote benchmark results to " << OPTIONS.benchmarkJsonPath << std::endl;
+	return 0;
+}
+
+// Renders each case in OPTIONS.goldenDir/golden.txt headless and fails if the image differs
+// perceptibly from <name>.ppm or a budget is exceeded. Frame time budgets are only
+// meaningful on the machine that recorded them; --golden-update re-records images and
+// budgets, allowing 50% frame time headroom and none on the counters. Cases that were never
+// recorded are skipped, and the run returns GOLDEN_NOT_RECORDED instead of passing.
+int runGoldenTests(SceneResources &scene, GpuProfiler &gpuProfiler)
+{
+	const float threshold = 0.1f;        // per-pixel perceptual difference
+	const float maxDiffering = 0.001f;   // fraction of pixels allowed over it
+	const int warmupFrames = 10;
+	const int measuredFrames = 30;
+
+	std::string manifest = OPTIONS.goldenDir + "golden.txt";
+	std::vector<GoldenCase> cases;
+	if (!load_golden_cases(manifest, cases)) {
+		return -1;
+	}
+	int width = (int)SCR_WIDTH, height = (int)SCR_HEIGHT;
+	int failures = 0, skipped = 0;
+	for (GoldenCase &c: cases) {
+		std::string referencePath = OPTIONS.goldenDir + c.name + ".ppm";
+		Image reference;
+		bool hasReference = !OPTIONS.goldenUpdate && reference.load(referencePath);
+		if (!OPTIONS.goldenUpdate && !hasReference && !c.recorded()) {
+			std::cout << c.name << ": SKIP not recorded yet, run with --golden-update" << std::endl;
+			skipped++;
+			continue;
+		}
+		Model model(ROOT_DIR + c.model, &JOBS);
+		for (Entity e = 0; e < scene.entities.size(); e++) {
+			if (scene.entities.renderables[e] == RENDER_MODEL) {
+				scene.entities.set_bounds(e, model.bounding_sphere());
+			}
+		}
+		SceneResources caseScene = {model, scene.terrain, scene.crowd, scene.screenQuad, scene.lightingShader,
+									scene.depthShader, scene.screenShader, scene.post, scene.entities,
+									scene.outputFramebuffer};
+		FrameGraph frameGraph;
+		buildFrameGraph(frameGraph, caseScene);
+		frameGraph.compile();
+		camera.set_pose(c.position, c.yaw, c.pitch, c.fov);
+		scene.terrain.preload(c.position);
+
+		std::vector<double> frameTimes;
+		for (int i = 0; i < warmupFrames + measuredFrames; i++) {
+			double start = currentTime();
+			renderFrame(frameGraph, caseScene, gpuProfiler);
+			glFinish();
+			if (i >= warmupFrames) {
+				frameTimes.push_back((currentTime() - start) * 1000.0);
+			}
+		}
+		FrameStats frame = FrameStats::compute(frameTimes);
+		RenderStats counters = render_stats();
+		Image image = Image::read_framebuffer(scene.outputFramebuffer, width, height);
+
+		if (OPTIONS.goldenUpdate) {
+			image.save(referencePath);
+			c.maxFrameMs = (float)(frame.p50 * 1.5);
+			c.maxDrawCalls = counters.drawCalls;
+			c.maxStateChanges = counters.stateChanges;
+			std::cout << c.name << ": recorded " << referencePath << std::endl;
+			continue;
+		}
+
+		bool passed = true;
+		if (!hasReference) {
+			std::cout << c.name << ": FAIL no reference image " << referencePath 
+					  << ", run with --golden-update" << std::endl;
+			failures++;
+			continue;
+		}
+		ImageDiff diff = compare_images(reference, image, threshold);
+		if (diff.fraction > maxDiffering) {
+			std::cout << c.name << ": FAIL image differs in " << diff.fraction * 100.0f 
+					  << "% of pixels (max delta " << diff.maxDelta << ")" << std::endl;
+			image.save(OPTIONS.goldenDir + c.name + "_actual.ppm");
+			if (!diff.visual.pixels.empty()) {
+				diff.visual.save(OPTIONS.goldenDir + c.name + "_diff.ppm");
+			}
+			passed = false;
+		}
+		if (c.maxFrameMs > 0.0f && frame.p50 > c.maxFrameMs) {
+			std::cout << c.name << ": FAIL frame time " << frame.p50 << " ms over budget " 
+					  << c.maxFrameMs << " ms" << std::endl;
+			passed = false;
+		}
+		if (c.maxDrawCalls > 0 && counters.drawCalls > c.maxDrawCalls) {
+			std::cout << c.name << ": FAIL " << counters.drawCalls << " draw calls over budget " 
+					  << c.maxDrawCalls << std::endl;
+			passed = false;
+		}
+		if (c.maxStateChanges > 0 && counters.stateChanges > c.maxStateChanges) {
+			std::cout << c.name << ": FAIL " << counters.stateChanges << " state changes over budget " 
+					  << c.maxStateChanges << std::endl;
+			passed = false;
+		}
+		if (passed) {
+			std::cout << c.name << ": PASS " << frame.p50 << " ms, " << counters.drawCalls 
+					  << " draw calls, " << counters.stateChanges << " state changes" << std::endl;
+		} else {
+			failures++;
+		}
+	}
+
+	if (OPTIONS.goldenUpdate) {
+		return save_golden_cases(manifest, cases) ? 0 : -1;
+	}
+	std::cout << cases.size() - failures - skipped << "/" << cases.size() << " golden cases passed";
+	if (skipped > 0) {
+		std::cout << ", " << skipped << " not recorded";
+	}
+	std::cout << std::endl;
+	if (failures > 0) {
+		return 1;
+	}
+	return skipped > 0 ? GOLDEN_NOT_RECORDED : 0;
+}
+
+// Builds a random hierarchy of count entities, a root every 16 with children attached a
+// few entities back, and times Scene::update() with every root moving (so every entity is
+// recomputed) and with only 1% of the entities moving, and reports how the scene BVH's
+// area drifted and how often that made it rebuild. Then times frustum and sphere
+// queries through the scene BVH against a linear test of every entity's bounds.
+int runSceneBenchmark(int count)
+{
+	const int frames = 200;
+	const int queries = 1000;
+	const float worldSize = 4.0f * std::sqrt((float)count);   // keeps the density constant
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	Scene entities;
+	std::vector<Entity> roots;
+	for (int i = 0; i < count; i++) {
+		Entity parent = NO_ENTITY;
+		if (i % 16 != 0) {
+			parent = (Entity)(i - 1 - (int)(rng() % std::min(i % 16, 4)));
+		}
+		Entity e = entities.create(parent);
+		glm::vec3 position(unit(rng), 0.0f, unit(rng));
+		entities.set_position(e, position * (parent == NO_ENTITY ? worldSize : 5.0f));
+		entities.set_bounds(e, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		if (parent == NO_ENTITY) {
+			roots.push_back(e);
+		}
+	}
+	entities.update();
+	float insertedArea = entities.bvh.internal_area();
+
+	std::vector<double> allMoving, fewMoving;
+	double updatedAll = 0.0, updatedFew = 0.0;
+	for (int frame = 0; frame < frames; frame++) {
+		glm::quat spin = glm::angleAxis(0.01f * frame, glm::vec3(0.0f, 1.0f, 0.0f));
+		for (Entity root: roots) {
+			entities.set_rotation(root, spin);
+		}
+		double start = currentTime();
+		entities.update();
+		allMoving.push_back((currentTime() - start) * 1000.0);
+		updatedAll += entities.updated;
+
+		for (int i = 0; i < count / 100; i++) {
+			entities.set_rotation((Entity)(rng() % count), spin);
+		}
+		start = currentTime();
+		entities.update();
+		fewMoving.push_back((currentTime() - start) * 1000.0);
+		updatedFew += entities.updated;
+	}
+	std::cout << count << " entities, " << roots.size() << " roots" << std::endl;
+	FrameStats::compute(allMoving).print("update, all moving (" + std::to_string((int)(updatedAll / frames)) + " updated)");
+	FrameStats::compute(fewMoving).print("update, 1% moving (" + std::to_string((int)(updatedFew / frames)) + " updated)");
+	std::cout << "BVH height " << entities.bvh.height() << ", internal area " << insertedArea << " as inserted, "
+			  << entities.bvh.internal_area() << " after " << frames << " frames of moves, " << entities.bvh.rebuilds
+			  << " rebuilds" << std::endl;
+
+	// Views from head height looking along the ground, and spheres of radius 5
+	std::vector<Frustum> frustums;
+	std::vector<glm::vec3> centers;
+	for (int i = 0; i < queries; i++) {
+		glm::vec3 eye(unit(rng) * worldSize, 2.0f, unit(rng) * worldSize);
+		float angle = unit(rng) * 6.2831853f;
+		glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(std::cos(angle), 0.0f, std::sin(angle)), glm::vec3(0.0f, 1.0f, 0.0f));
+		frustums.push_back(Frustum::from_matrix(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 50.0f) * view));
+		centers.push_back(glm::vec3(unit(rng) * worldSize, 0.0f, unit(rng) * worldSize));
+	}
+	std::vector<uint32_t> found;
+	size_t treeResults = 0, linearResults = 0;
+	double start = currentTime();
+	for (const Frustum &f: frustums) {
+		found.clear();
+		entities.bvh.query_frustum(f, found);
+		treeResults += found.size();
+	}
+	double treeTime = currentTime() - start;
+	start = currentTime();
+	for (const Frustum &f: frustums) {
+		for (Entity e = 0; e < entities.size(); e++) {
+			const glm::vec4 &b = entities.worldBounds[e];
+			linearResults += f.intersects_sphere(glm::vec3(b.x, b.y, b.z), b.w);
+		}
+	}
+	double linearTime = currentTime() - start;
+	std::cout << "frustum query: BVH " << treeTime * 1e6 / queries << " us (" << treeResults / queries 
+			  << " found), linear " << linearTime * 1e6 / queries << " us (" << linearResults / queries << " found)" << std::endl;
+
+	treeResults = linearResults = 0;
+	start = currentTime();
+	for (const glm::vec3 &c: centers) {
+		found.clear();
+		entities.bvh.query_sphere(c, 5.0f, found);
+		treeResults += found.size();
+	}
+	treeTime = currentTime() - start;
+	start = currentTime();
+	for (const glm::vec3 &c: centers) {
+		for (Entity e = 0; e < entities.size(); e++) {
+			const glm::vec4 &b = entities.worldBounds[e];
+			linearResults += glm::length(glm::vec3(b.x, b.y, b.z) - c) <= 5.0f + b.w;
+		}
+	}
+	linearTime = currentTime() - start;
+	std::cout << "sphere query: BVH " << treeTime * 1e6 / queries << " us (" << treeResults / queries 
+			  << " found), linear " << linearTime * 1e6 / queries << " us (" << linearResults / queries << " found)" << std::endl;
+	return 0;
+}
+
+// Loads the triangles straight from Assimp, so no GL context is needed, and times BVH
+// builds on one thread and on all of them, then closest-hit rays fired across the model
+// from a surrounding sphere and small box queries inside it. A sample of the rays is
+// checked against a brute-force loop over every triangle.
+int runBvhBenchmark(const std::string &path)
+{
+	const int buildRuns = 5;
+	const int rayCount = 1000000;
+	const int checkedRays = 200;
+	const int boxCount = 100000;
+
+	Assimp::Importer importer;
+	const aiScene *model = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+	if (!model) {
+		std::cout << importer.GetErrorString() << std::endl;
+		return -1;
+	}
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> indices;
+	for (unsigned int m = 0; m < model->mNumMeshes; m++) {
+		const aiMesh *mesh = model->mMeshes[m];
+		unsigned int base = (unsigned int)positions.size();
+		for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
+			positions.push_back(glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z));
+		}
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+			if (mesh->mFaces[i].mNumIndices != 3) {
+				continue;
+			}
+			for (unsigned int k = 0; k < 3; k++) {
+				indices.push_back(base + mesh->mFaces[i].mIndices[k]);
+			}
+		}
+	}
+	std::cout << path << ": " << indices.size() / 3 << " triangles" << std::endl;
+
+	MeshBVH bvh;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int t: {1u, threads}) {
+		std::vector<double> buildTimes;
+		for (int i = 0; i < buildRuns; i++) {
+			double start = currentTime();
+			bvh.build(positions, indices, t);
+			buildTimes.push_back((currentTime() - start) * 1000.0);
+		}
+		FrameStats::compute(buildTimes).print("build, " + std::to_string(t) + " threads");
+	}
+	std::cout << bvh.nodes.size() << " nodes, SAH cost " << bvh.sah_cost() << std::endl;
+
+	glm::vec3 lo = bvh.bounds_min(), hi = bvh.bounds_max();
+	glm::vec3 center = (lo + hi) * 0.5f;
+	float radius = glm::length(hi - lo) * 0.5f;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	auto randomDirection = [&]() {
+		glm::vec3 d;
+		do {
+			d = glm::vec3(unit(rng), unit(rng), unit(rng));
+		} while (glm::dot(d, d) > 1.0f || glm::dot(d, d) < 1e-4f);
+		return glm::normalize(d);
+	};
+	std::vector<glm::vec3> origins(rayCount), directions(rayCount);
+	for (int i = 0; i < rayCount; i++) {
+		origins[i] = center + randomDirection() * (radius * 1.5f);
+		glm::vec3 target = center + randomDirection() * (radius * 0.5f);
+		directions[i] = glm::normalize(target - origins[i]);
+	}
+
+	int hits = 0;
+	double start = currentTime();
+	for (int i = 0; i < rayCount; i++) {
+		RayHit hit;
+		hits += bvh.intersect_ray(origins[i], directions[i], hit);
+	}
+	double rayTime = currentTime() - start;
+	std::cout << "rays: " << rayCount / rayTime / 1e6 << " M/s, " << 100.0 * hits / rayCount << "% hit" << std::endl;
+
+	int mismatches = 0;
+	for (int i = 0; i < checkedRays; i++) {
+		RayHit hit;
+		bool found = bvh.intersect_ray(origins[i], directions[i], hit);
+		float best = FLT_MAX;
+		for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+			glm::vec3 a = positions[indices[t]];
+			glm::vec3 e1 = positions[indices[t + 1]] - a, e2 = positions[indices[t + 2]] - a;
+			glm::vec3 p = glm::cross(directions[i], e2);
+			float det = glm::dot(e1, p);
+			if (std::fabs(det) < 1e-12f) {
+				continue;
+			}
+			glm::vec3 s = origins[i] - a, q = glm::cross(s, e1);
+			float u = glm::dot(s, p) / det, v = glm::dot(directions[i], q) / det, d = glm::dot(e2, q) / det;
+			if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && d > 0.0f) {
+				best = std::min(best, d);
+			}
+		}
+		if (found != (best < FLT_MAX) || (found && std::fabs(best - hit.t) > 1e-4f * radius)) {
+			mismatches++;
+		}
+	}
+	std::cout << "brute-force check: " << mismatches << " of " << checkedRays << " rays differ" << std::endl;
+
+	std::vector<uint32_t> found;
+	size_t results = 0;
+	glm::vec3 halfSize(radius * 0.02f);
+	start = currentTime();
+	for (int i = 0; i < boxCount; i++) {
+		glm::vec3 p = center + randomDirection() * radius;
+		found.clear();
+		bvh.query_aabb(p - halfSize, p + halfSize, found);
+		results += found.size();
+	}
+	double boxTime = currentTime() - start;
+	std::cout << "box queries: " << boxCount / boxTime / 1e6 << " M/s, " 
+			  << (double)results / boxCount << " triangles each" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Runs two workloads on job systems with 1 to N threads (the caller plus N-1 workers) and
+// prints the time and speedup of each: sphere-against-frustum culling of a million
+// objects, which is mostly memory bound, and transforming a million vertices and normals
+// by a matrix, which is mostly arithmetic
+int runJobBenchmark()
+{
+	const size_t objects = 1000000;
+	const size_t grain = 16384;
+	const int runs = 20;
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(-100.0f, 100.0f);
+	std::vector<glm::vec4> spheres(objects);
+	std::vector<Vertex> vertices;
+	vertices.reserve(objects);
+	for (size_t i = 0; i < objects; i++) {
+		spheres[i] = glm::vec4(unit(rng), unit(rng), unit(rng), 1.0f);
+		vertices.push_back(Vertex(glm::vec3(unit(rng), unit(rng), unit(rng)), glm::vec3(0.0f, 1.0f, 0.0f)));
+	}
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = Frustum::from_matrix(glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f) * view);
+	glm::mat4 transform = glm::rotate(glm::mat4(1.0f), 0.3f, glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat3 normalTransform = glm::inverseTranspose(glm::mat3(transform));
+	std::vector<unsigned char> visible(objects);
+	std::vector<Vertex> transformed(vertices);
+
+	double baseCull = 0.0, baseTransform = 0.0;
+	for (unsigned int threads = 1; threads <= cores; threads++) {
+		JobSystem jobs;
+		jobs.start(threads - 1);
+		double start = currentTime();
+		for (int r = 0; r < runs; r++) {
+			jobs.parallel_for(0, objects, grain, [&](size_t first, size_t last) {
+				for (size_t i = first; i < last; i++) {
+					const glm::vec4 &s = spheres[i];
+					visible[i] = frustum.intersects_sphere(glm::vec3(s.x, s.y, s.z), s.w);
+				}
+			});
+		}
+		double cull = (currentTime() - start) * 1000.0 / runs;
+		start = currentTime();
+		for (int r = 0; r < runs; r++) {
+			jobs.parallel_for(0, objects, grain, [&](size_t first, size_t last) {
+				for (size_t i = first; i < last; i++) {
+					transformed[i].position = glm::vec3(transform * glm::vec4(vertices[i].position, 1.0f));
+					transformed[i].normal = glm::normalize(normalTransform * vertices[i].normal);
+				}
+			});
+		}
+		double vertex = (currentTime() - start) * 1000.0 / runs;
+		if (threads == 1) {
+			baseCull = cull;
+			baseTransform = vertex;
+		}
+		std::cout << threads << " threads: cull " << cull << " ms (" << baseCull / cull << "x), vertices " 
+				  << vertex << " ms (" << baseTransform / vertex << "x)" << std::endl;
+	}
+	return 0;
+}
+
+// The model's skeleton and clips. A model without animations gets a generated swing on
+// every joint, baked to a key per frame at 30 Hz the way exporters write clips.
+void importClips(const aiScene *model, Skeleton &skeleton, std::vector<AnimationClip> &clips)
+{
+	Model::add_joints(model->mRootNode, -1, skeleton);
+	Model::process_animations(model, skeleton, clips);
+	if (!clips.empty()) {
+		return;
+	}
+	const int frames = 30;
+	AnimationClip swing;
+	swing.name = "generated swing";
+	swing.duration = 1.0f;
+	swing.tracks.resize(skeleton.size());
+	for (size_t j = 0; j < skeleton.size(); j++) {
+		const JointPose &bind = skeleton.bindPose[j];
+		JointTrack &track = swing.tracks[j];
+		for (int f = 0; f <= frames; f++) {
+			float time = (float)f / frames;
+			float angle = 0.4f * std::sin(glm::radians(360.0f * time));
+			track.rotations.push_back({time, bind.rotation * glm::angleAxis(angle, glm::vec3(1.0f, 0.0f, 0.0f))});
+			track.translations.push_back({time, bind.translation});
+		}
+	}
+	clips.push_back(swing);
+}
+
+// Poses and skins `characters` copies of the model, each at its own point in its clip and
+// blended with a second pose. Meshes without bone weights are bound rigidly to the node
+// that places them, so every vertex goes through the skinning path. Clips are compressed,
+// as Model keeps them.
+int runSkinningBenchmark(const std::string &path, int characters)
+{
+	const int runs = 20;
+
+	Assimp::Importer importer;
+	const aiScene *model = importer.ReadFile(path, aiProcess_Triangulate);
+	if (!model || !model->mRootNode) {
+		std::cout << importer.GetErrorString() << std::endl;
+		return -1;
+	}
+	Skeleton skeleton;
+	std::vector<AnimationClip> clips;
+	importClips(model, skeleton, clips);
+
+	std::vector<std::vector<int>> placements(model->mNumMeshes);
+	int joint = 0;
+	find_mesh_placements(model->mRootNode, joint, placements);
+	std::vector<Model::MeshData> meshes(model->mNumMeshes);
+	size_t vertexCount = 0, paletteSize = 0;
+	for (unsigned int m = 0; m < model->mNumMeshes; m++) {
+		Model::MeshData &data = meshes[m];
+		Model::process_mesh(model->mMeshes[m], data);
+		SkinBinding &binding = data.binding;
+		if (binding.empty()) {
+			VertexSkin rigid = {{0, 0, 0, 0}, {1.0f, 0.0f, 0.0f, 0.0f}};
+			data.skin.assign(data.vertices.size(), rigid);
+			binding.joints.push_back(placements[m].empty() ? 0 : placements[m][0]);
+			binding.inverseBind.push_back(glm::mat4(1.0f));
+		} else {
+			for (const std::string &name: binding.names) {
+				binding.joints.push_back(skeleton.find(name));
+			}
+		}
+		vertexCount += data.vertices.size();
+		paletteSize += binding.joints.size();
+	}
+	std::cout << path << ": " << skeleton.size() << " joints, " << meshes.size() << " meshes, " << vertexCount 
+			  << " vertices, clip \"" << clips[0].name << "\" " << clips[0].duration << " s" << std::endl;
+
+	// Per character outputs, as a renderer would keep them
+	const CompressedClip clip(clips[0], skeleton);
+	const CompressedClip other(clips.size() > 1 ? clips[1] : clips[0], skeleton);
+	std::vector<std::vector<JointPose>> poses(characters), blendPoses(characters);
+	std::vector<std::vector<glm::mat4>> jointModels(characters), palettes(characters);
+	std::vector<std::vector<Vertex>> skinned(characters);
+	for (int c = 0; c < characters; c++) {
+		palettes[c].resize(paletteSize);
+		skinned[c].assign(vertexCount, Vertex(glm::vec3(0.0f), glm::vec3(0.0f)));
+	}
+	auto pose = [&](int c, float time) {
+		clip.sample(skeleton, time + c * 0.013f, poses[c]);
+		other.sample(skeleton, time + c * 0.029f + 0.37f, blendPoses[c]);
+		blend_poses(poses[c], blendPoses[c], 0.3f, poses[c]);
+		pose_to_model(skeleton, poses[c], jointModels[c]);
+		glm::mat4 *palette = palettes[c].data();
+		for (const Model::MeshData &data: meshes) {
+			data.binding.palette(jointModels[c], palette);
+			palette += data.binding.joints.size();
+		}
+	};
+	auto skin = [&](int c, bool simd) {
+		const glm::mat4 *palette = palettes[c].data();
+		Vertex *out = skinned[c].data();
+		for (const Model::MeshData &data: meshes) {
+			if (simd) {
+				skin_vertices(palette, data.vertices.data(), data.skin.data(), data.vertices.size(), out);
+			} else {
+				skin_vertices_scalar(palette, data.vertices.data(), data.skin.data(), data.vertices.size(), out);
+			}
+			palette += data.binding.joints.size();
+			out += data.vertices.size();
+		}
+	};
+	auto report = [&](const char *label, double ms) {
+		std::cout << label << ": " << ms << " ms per frame, " << characters / ms << " characters per ms" << std::endl;
+	};
+
+	double start = currentTime();
+	for (int r = 0; r < runs; r++) {
+		for (int c = 0; c < characters; c++) {
+			pose(c, r / 60.0f);
+		}
+	}
+	double poseTime = (currentTime() - start) * 1000.0 / runs;
+	report("pose and palette (GPU skinning's CPU cost)", poseTime);
+
+	start = currentTime();
+	for (int r = 0; r < runs; r++) {
+		for (int c = 0; c < characters; c++) {
+			skin(c, false);
+		}
+	}
+	double scalarTime = (currentTime() - start) * 1000.0 / runs;
+	std::vector<std::vector<Vertex>> reference(skinned);
+	start = currentTime();
+	for (int r = 0; r < runs; r++) {
+		for (int c = 0; c < characters; c++) {
+			skin(c, true);
+		}
+	}
+	double simdTime = (currentTime() - start) * 1000.0 / runs;
+	report("pose and scalar CPU skinning", poseTime + scalarTime);
+	report("pose and SIMD CPU skinning", poseTime + simdTime);
+	float largestError = 0.0f;
+	for (int c = 0; c < characters; c++) {
+		for (size_t v = 0; v < vertexCount; v++) {
+			largestError = std::max(largestError, glm::length(skinned[c][v].position - reference[c][v].position));
+		}
+	}
+	std::cout << "SIMD skinning differs from scalar by at most " << largestError << std::endl;
+
+	JOBS.start(OPTIONS.workers >= 0 ? OPTIONS.workers : std::max(1u, std::thread::hardware_concurrency()) - 1);
+	start = currentTime();
+	for (int r = 0; r < runs; r++) {
+		JOBS.parallel_for(0, characters, 16, [&](size_t first, size_t last) {
+			for (size_t c = first; c < last; c++) {
+				pose((int)c, r / 60.0f);
+				skin((int)c, true);
+			}
+		});
+	}
+	double parallelTime = (currentTime() - start) * 1000.0 / runs;
+	std::cout << JOBS.worker_count() + 1 << " threads, ";
+	report("pose and SIMD CPU skinning", parallelTime);
 	return 0;
 }
 
+// Compresses each of the model's clips, then measures how far the compressed clip strays
+// from the imported one, in each joint's local space and in joint positions relative to the
+// model, and how fast each samples poses for `characters` characters playing the clips.
+int runAnimationBenchmark(const std::string &path, int characters)
+{
+	const int runs = 20;
+
+	Assimp::Importer importer;
+	const aiScene *model = importer.ReadFile(path, aiProcess_Triangulate);
+	if (!model || !model->mRootNode) {
+		std::cout << importer.GetErrorString() << std::endl;
+		return -1;
+	}
+	Skeleton skeleton;
+	std::vector<AnimationClip> clips;
+	importClips(model, skeleton, clips);
+	std::cout << path << ": " << skeleton.size() << " joints, " << clips.size() << " clips" << std::endl;
+
+	std::vector<CompressedClip> compressed;
+	size_t rawBytes = 0, compressedBytes = 0;
+	std::vector<JointPose> rawPose, compressedPose;
+	std::vector<glm::mat4> rawModel, compressedModel;
+	for (const AnimationClip &clip: clips) {
+		double start = currentTime();
+		compressed.push_back(CompressedClip(clip, skeleton));
+		double compressTime = (currentTime() - start) * 1000.0;
+		const CompressedClip &packed = compressed.back();
+		rawBytes += clip.size_bytes();
+		compressedBytes += packed.size_bytes();
+
+		float rotationError = 0.0f, translationError = 0.0f, positionError = 0.0f;
+		const float step = 1.0f / 240.0f;
+		for (float time = 0.0f; time < std::max(clip.duration, step); time += step) {
+			clip.sample(skeleton, time, rawPose);
+			packed.sample(skeleton, time, compressedPose);
+			for (size_t j = 0; j < skeleton.size(); j++) {
+				rotationError = std::max(rotationError, rotation_error(rawPose[j].rotation, compressedPose[j].rotation));
+				translationError = std::max(translationError, glm::length(rawPose[j].translation - compressedPose[j].translation));
+			}
+			pose_to_model(skeleton, rawPose, rawModel);
+			pose_to_model(skeleton, compressedPose, compressedModel);
+			for (size_t j = 0; j < skeleton.size(); j++) {
+				positionError = std::max(positionError, glm::length(glm::vec3(rawModel[j][3] - compressedModel[j][3])));
+			}
+		}
+		std::cout << "\"" << clip.name << "\" " << clip.duration << " s: " << clip.key_count() << " keys, " 
+				  << clip.size_bytes() << " bytes -> " << packed.key_count() << " keys, " << packed.size_bytes() 
+				  << " bytes (" << (double)clip.size_bytes() / packed.size_bytes() << "x) in " << compressTime 
+				  << " ms; largest error " << glm::degrees(rotationError) << " degrees, " << translationError 
+				  << " local, " << positionError << " in joint positions" << std::endl;
+	}
+	std::cout << "all clips: " << rawBytes << " bytes -> " << compressedBytes << " bytes (" 
+			  << (double)rawBytes / compressedBytes << "x)" << std::endl;
+
+	std::vector<std::vector<JointPose>> poses(characters);
+	auto time = [&](const auto &source) {
+		double start = currentTime();
+		for (int r = 0; r < runs; r++) {
+			for (int c = 0; c < characters; c++) {
+				source[c % source.size()].sample(skeleton, r / 60.0f + c * 0.013f, poses[c]);
+			}
+		}
+		double ms = (currentTime() - start) * 1000.0 / runs;
+		double joints = (double)characters * skeleton.size();
+		return std::make_pair(ms, joints / (ms * 1000.0));
+	};
+	time(clips);   // sizes the poses
+	std::pair<double, double> raw = time(clips);
+	std::pair<double, double> packed = time(compressed);
+	std::cout << characters << " poses: imported " << raw.first << " ms (" << raw.second << " joints per us), compressed " 
+			  << packed.first << " ms (" << packed.second << " joints per us)" << std::endl;
+	return 0;
+}
+
+// Bakes every clip of the model at 30 frames per second for Crowd, posing the parts as
+// Model draws them, and saves it to bakePath. Needs no GL context.
+bool bakeCrowd(const std::string &path, const std::string &bakePath, BakedAnimation &baked)
+{
+	Assimp::Importer importer;
+	const aiScene *model = importer.ReadFile(path, aiProcess_Triangulate);
+	if (!model || !model->mRootNode) {
+		std::cout << importer.GetErrorString() << std::endl;
+		return false;
+	}
+	Skeleton skeleton;
+	std::vector<AnimationClip> imported;
+	importClips(model, skeleton, imported);
+	std::vector<CompressedClip> clips;
+	for (const AnimationClip &clip: imported) {
+		clips.push_back(CompressedClip(clip, skeleton));
+	}
+
+	std::vector<Model::MeshData> meshes;
+	std::vector<BakePart> parts;
+	import_bake_parts(model, skeleton, meshes, parts);
+
+	double start = currentTime();
+	bake_vertex_animation(skeleton, clips, parts, 30.0f, baked, &JOBS);
+	baked.source = hash_file(path);
+	double ms = (currentTime() - start) * 1000.0;
+	size_t bytes = baked.positions.size() * sizeof(glm::vec4) + baked.normals.size() * sizeof(glm::vec4) / 2;
+	std::cout << "baked " << baked.clips.size() << " clips, " << baked.frame_count() << " frames of " 
+			  << baked.vertices.size() << " vertices in " << ms << " ms, " << bytes / 1024 << " KB of textures" << std::endl;
+	return baked.save(bakePath);
+}
+
+// A square grid of crowd members beside the model, each turned, playing a clip from a
+// phase and at a speed of its own. Seeded, so every run places the same crowd.
+std::vector<CrowdAgent> placeCrowd(const BakedAnimation &baked, int count)
+{
+	glm::vec3 lo(1e30f), hi(-1e30f);
+	for (const Vertex &v: baked.vertices) {
+		lo = glm::min(lo, v.position);
+		hi = glm::max(hi, v.position);
+	}
+	float spacing = std::max(hi.x - lo.x, hi.z - lo.z) * 1.5f + 0.1f;
+	int side = (int)std::ceil(std::sqrt((float)count));
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<CrowdAgent> agents;
+	for (int i = 0; i < count; i++) {
+		glm::vec3 position((i % side + 1) * spacing, 0.0f, (i / side - side / 2) * spacing);
+		glm::mat4 transform = glm::rotate(glm::translate(glm::mat4(1.0f), position), unit(random) * glm::radians(360.0f), 
+										  glm::vec3(0.0f, 1.0f, 0.0f));
+		unsigned int clip = baked.clips.empty() ? 0 : (unsigned int)(i % baked.clips.size());
+		float duration = baked.clips.empty() ? 0.0f : baked.clips[clip].duration;
+		agents.push_back({transform, clip, unit(random) * duration, 0.8f + 0.4f * unit(random)});
+	}
+	return agents;
+}
+
+// Selects chunks along a straight flight 30 m above terrains from 1 to 64 km on a side, with
+// every chunk resident, to show that a frame's cost follows the detail near the viewer rather
+// than the terrain's size. Then times generating chunks, which streaming spreads over the
+// job system's workers.
+int runTerrainBenchmark()
+{
+	const int steps = 1000;
+	const int generated = 256;
+	for (float size = 1024.0f; size <= 65536.0f; size *= 4.0f) {
+		TerrainSettings settings;
+		settings.size = size;
+		std::vector<glm::vec3> flight;
+		for (int i = 0; i < steps; i++) {
+			float t = (float)i / steps - 0.5f;
+			glm::vec3 position(0.8f * size * t, 0.0f, 0.6f * size * t);
+			position.y = terrain_height(settings, position.x, position.z) + 30.0f;
+			flight.push_back(position);
+		}
+		TerrainQuadtree quadtree;
+		size_t leaves = 0, most = 0;
+		double start = currentTime();
+		for (const glm::vec3 &viewer: flight) {
+			quadtree.select(settings, viewer, [](uint64_t) { return true; });
+			leaves += quadtree.leaves.size();
+			most = std::max(most, quadtree.leaves.size());
+		}
+		double selectUs = (currentTime() - start) * 1e6 / steps;
+
+		std::vector<Vertex> vertices;
+		float lo, hi;
+		unsigned int level = settings.max_level(), side = 1u << level;
+		start = currentTime();
+		for (int i = 0; i < generated; i++) {
+			generate_terrain_chunk(settings, terrain_node(level, (i * 37) % side, (i * 101) % side), vertices, lo, hi);
+		}
+		double generateUs = (currentTime() - start) * 1e6 / generated;
+		std::cout << size / 1000.0f << " km, " << level + 1 << " levels: " << (double)leaves / steps << " chunks ("
+				  << most << " at most), " << (double)leaves / steps * 2 * TERRAIN_CHUNK_CELLS * TERRAIN_CHUNK_CELLS
+				  << " triangles, selected in " << selectUs << " us; " << generateUs << " us to generate a chunk" << std::endl;
+	}
+	return 0;
+}
+
+// Renders the shadow and lighting passes with SoftwareRenderer, without GL. With --golden,
+// checks each case against <name>_software.ppm beside its GPU reference, which it leaves
+// alone along with the budgets, and that the scalar rasteriser draws exactly what the SSE2
+// one does; --golden-update records them. As in runGoldenTests, cases never recorded skip
+// the reference comparison and the run returns GOLDEN_NOT_RECORDED. Otherwise saves the
+// camera's view to --software-out and times that frame from one thread to all cores. Bloom
+// and FXAA have no software version, so the images are tonemapped only.
+int runSoftwareRenderer()
+{
+	const float threshold = 0.1f;        // as in runGoldenTests
+	const float maxDiffering = 0.001f;
+	const int runs = 5;
+	int width = (int)SCR_WIDTH, height = (int)SCR_HEIGHT;
+	float aspect = SCR_WIDTH / SCR_HEIGHT;
+	TerrainSettings terrainSettings;
+	terrainSettings.size = OPTIONS.terrainSize;
+	FRAME_CONSTANTS.set_view_distance(terrainSettings.size);
+	SoftwareShading shading;
+	shading.tonemap = POST_SETTINGS.tonemap;
+	shading.exposure = POST_SETTINGS.exposure;
+	SoftwareRenderer renderer(width, height, (int)SHADOW_WIDTH, &JOBS);
+	renderer.shading = shading;
+	SoftwareScene scene;
+	Image image;
+
+	if (!OPTIONS.goldenDir.empty()) {
+		std::vector<GoldenCase> cases;
+		if (!load_golden_cases(OPTIONS.goldenDir + "golden.txt", cases)) {
+			return -1;
+		}
+		int failures = 0, skipped = 0;
+		for (const GoldenCase &c: cases) {
+			camera.set_pose(c.position, c.yaw, c.pitch, c.fov);
+			FRAME_CONSTANTS.update(camera, aspect, lightDirection);
+			if (!scene.build(ROOT_DIR + c.model, ANIMATION_TIME, terrainSettings, c.position, &JOBS)) {
+				return -1;
+			}
+			double start = currentTime();
+			renderer.render(scene.meshes, FRAME_CONSTANTS, lightDirection, image);
+			double ms = (currentTime() - start) * 1000.0;
+			std::string referencePath = OPTIONS.goldenDir + c.name + "_software.ppm";
+
+			if (OPTIONS.goldenUpdate) {
+				if (!image.save(referencePath)) {
+					return -1;
+				}
+				std::cout << c.name << ": recorded " << referencePath << std::endl;
+				continue;
+			}
+			Image scalar;
+			renderer.simd = false;
+			renderer.render(scene.meshes, FRAME_CONSTANTS, lightDirection, scalar);
+			renderer.simd = true;
+			if (scalar.pixels != image.pixels) {
+				std::cout << c.name << ": FAIL the scalar and SSE2 rasterisers drew different images" << std::endl;
+				failures++;
+				continue;
+			}
+			Image reference;
+			bool hasReference = reference.load(referencePath);
+			if (!hasReference && !c.recorded()) {
+				std::cout << c.name << ": SKIP not recorded yet, run with --software --golden-update" << std::endl;
+				skipped++;
+				continue;
+			}
+			if (!hasReference) {
+				std::cout << c.name << ": FAIL no reference image " << referencePath 
+						  << ", run with --software --golden-update" << std::endl;
+				failures++;
+				continue;
+			}
+			ImageDiff diff = compare_images(reference, image, threshold);
+			if (diff.fraction > maxDiffering) {
+				std::cout << c.name << ": FAIL image differs in " << diff.fraction * 100.0f 
+						  << "% of pixels (max delta " << diff.maxDelta << ")" << std::endl;
+				image.save(OPTIONS.goldenDir + c.name + "_software_actual.ppm");
+				if (!diff.visual.pixels.empty()) {
+					diff.visual.save(OPTIONS.goldenDir + c.name + "_software_diff.ppm");
+				}
+				failures++;
+			} else {
+				std::cout << c.name << ": PASS " << ms << " ms on the CPU" << std::endl;
+			}
+		}
+		if (OPTIONS.goldenUpdate) {
+			return 0;
+		}
+		std::cout << cases.size() - failures - skipped << "/" << cases.size() << " software golden cases passed";
+		if (skipped > 0) {
+			std::cout << ", " << skipped << " not recorded";
+		}
+		std::cout << std::endl;
+		if (failures > 0) {
+			return 1;
+		}
+		return skipped > 0 ? GOLDEN_NOT_RECORDED : 0;
+	}
+
+	FRAME_CONSTANTS.update(camera, aspect, lightDirection);
+	if (!scene.build(ROOT_DIR + modelPath, ANIMATION_TIME, terrainSettings, camera.position, &JOBS)) {
+		return -1;
+	}
+	renderer.render(scene.meshes, FRAME_CONSTANTS, lightDirection, image);
+	if (!image.save(OPTIONS.softwarePath)) {
+		return -1;
+	}
+	std::cout << "Saved " << width << "x" << height << " frame to " << OPTIONS.softwarePath << std::endl;
+
+	time_software_renderer(scene, FRAME_CONSTANTS, lightDirection, shading, width, height, (int)SHADOW_WIDTH, runs);
+	return 0;
+}
+
+// Only meaningful when built with TRACK_ALLOCATIONS, which counts calls to operator new
+void printAllocations(const std::string &label, uint64_t allocations, int frames)
+{
+#ifdef TRACK_ALLOCATIONS
+	if (frames > 0) {
+		std::cout << label << ": " << allocations << " heap allocations in " << frames 
+				  << " steady-state frames" << std::endl;
+	}
+#endif
+}
+
+double currentTime()
+{
+	static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// --headless renders --frames N frames at --size WxH offscreen and prints timing statistics.
+// --benchmark replays --camera-path (or a built-in orbit) for --warmup plus --frames frames and
+// writes --bench-json; it works both windowed and headless.
+// --golden DIR checks rendering against reference images and budgets (headless, see
+// runGoldenTests); add --golden-update to re-record them.
+// --tick-rate HZ sets the fixed simulation rate in the window; --update-thread runs it on its own thread.
+// --frames-in-flight N bounds how far the CPU runs ahead of the GPU; --swap-interval N sets vsync.
+// --idle stops redrawing while there is no input and nothing moves, blocking on window events.
+// --workers N sets the job system's worker threads (default one per core besides the main thread);
+// --bench-jobs times parallel culling and vertex processing from 1 to all cores, without GL.
+// --cpu-skinning skins the model on the CPU with SIMD instead of in the vertex shader;
+// --bench-skinning N times posing and skinning N boxguys, without GL.
+// --crowd N adds N boxguys drawn with one instanced call from baked vertex animation;
+// --bake-crowd bakes it to boxguy.vat beside the model and exits; a bake of a different model
+// file is redone at startup.
+// --terrain-size METRES sets the side of the square terrain (default 4096); --bench-terrain times
+// chunk selection on terrains from 1 to 64 km and chunk generation, without GL.
+// --software renders the shadow and lighting passes on the CPU to --software-out FILE (default
+// software.ppm) and times them from 1 to all cores, without GL; with --golden it checks the
+// <name>_software.ppm references instead.
+// --bench-animation N reports clip compression ratios and errors, and times sampling N poses, without GL.
+// --bench-bvh times BVH builds and ray and box queries over the dragon's triangles, without GL.
+// --bench-scene N times transform updates and BVH queries over N generated entities, without GL.
+// --capture FILE records every GL call from startup through --capture-frames frames for glReplay.
+bool parseOptions(int argc, char **argv, Options &options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--headless") {
+			options.headless = true;
+		} else if (arg == "--benchmark") {
+			options.benchmark = true;
+		} else if (arg == "--warmup" && hasValue) {
+			options.warmupFrames = std::atoi(argv[++i]);
+		} else if (arg == "--camera-path" && hasValue) {
+			options.cameraPath = argv[++i];
+		} else if (arg == "--record-path" && hasValue) {
+			options.recordPath = argv[++i];
+		} else if (arg == "--bench-json" && hasValue) {
+			options.benchmarkJsonPath = argv[++i];
+		} else if (arg == "--bench-label" && hasValue) {
+			options.benchmarkLabel = argv[++i];
+		} else if (arg == "--frames" && hasValue) {
+			options.frames = std::atoi(argv[++i]);
+		} else if (arg == "--size" && hasValue) {
+			int width, height;
+			if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+				std::cout << "Invalid --size, expected WIDTHxHEIGHT" << std::endl;
+				return false;
+			}
+			SCR_WIDTH = width;
+			SCR_HEIGHT = height;
+		} else if (arg == "--root" && hasValue) {
+			ROOT_DIR = argv[++i];
+			if (!ROOT_DIR.empty() && ROOT_DIR.back() != '/') {
+				ROOT_DIR += '/';
+			}
+		} else if (arg == "--gpu-csv" && hasValue) {
+			options.gpuCsvPath = argv[++i];
+		} else if (arg == "--capture" && hasValue) {
+			options.capturePath = argv[++i];
+		} else if (arg == "--capture-frames" && hasValue) {
+			options.captureFrames = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--golden" && hasValue) {
+			options.goldenDir = argv[++i];
+			if (!options.goldenDir.empty() && options.goldenDir.back() != '/') {
+				options.goldenDir += '/';
+			}
+			options.headless = true;
+		} else if (arg == "--golden-update") {
+			options.goldenUpdate = true;
+		} else if (arg == "--tick-rate" && hasValue) {
+			options.tickRate = std::max(1.0, std::atof(argv[++i]));
+		} else if (arg == "--update-thread") {
+			options.updateThread = true;
+		} else if (arg == "--frames-in-flight" && hasValue) {
+			options.framesInFlight = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--swap-interval" && hasValue) {
+			options.swapInterval = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "--idle") {
+			options.idle = true;
+		} else if (arg == "--workers" && hasValue) {
+			options.workers = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "--cpu-skinning") {
+			options.cpuSkinning = true;
+		} else if (arg == "--bench-skinning" && hasValue) {
+			options.skinningBenchCharacters = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--crowd" && hasValue) {
+			options.crowdSize = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "--bake-crowd") {
+			options.bakeCrowd = true;
+		} else if (arg == "--terrain-size" && hasValue) {
+			options.terrainSize = std::max(64.0f, (float)std::atof(argv[++i]));
+		} else if (arg == "--bench-terrain") {
+			options.terrainBench = true;
+		} else if (arg == "--software") {
+			options.software = true;
+		} else if (arg == "--software-out" && hasValue) {
+			options.softwarePath = argv[++i];
+		} else if (arg == "--bench-animation" && hasValue) {
+			options.animationBenchCharacters = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--bench-jobs") {
+			options.jobBench = true;
+		} else if (arg == "--bench-bvh") {
+			options.bvhBench = true;
+		} else if (arg == "--bench-scene" && hasValue) {
+			options.sceneBenchEntities = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--trace" && hasValue) {
+			options.tracePath = argv[++i];
+		} else {
+			std::cout << "Unknown option " << arg << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
 Mesh getScreenQuad()
 {
 	float squad[] = {  
@@ -122,74 +1564,141 @@ Mesh getScreenQuad()
 	return Mesh(vertices, indices);
 }
 
-Mesh getPlane(float xsize, float zsize)
+void buildFrameGraph(FrameGraph &graph, SceneResources &scene)
 {
-	float quad[] = {
-		-xsize,  zsize, 
-		-xsize, -zsize,
-		 xsize, -zsize,
-		 xsize,  zsize
-	};
-	std::vector<Vertex> vertices;
-	for (int i = 0; i < 4; i++) {
-		vertices.push_back(Vertex(glm::vec3(quad[2*i], 0.0, quad[2*i + 1]), 
-								  glm::vec3(0.0, 1.0, 0.0)));
-	}
-	std::vector<unsigned int> indices = {0, 2, 1, 2, 0, 3};
-	return Mesh(vertices, indices);
-}
+	Mesh &screenQuad = scene.screenQuad;
+	Shader &lightingShader = scene.lightingShader;
+	Shader &depthShader = scene.depthShader;
+	Shader &screenShader = scene.screenShader;
+	PostProcess &post = scene.post;
+	TextureDesc screenDesc = {(GLsizei)SCR_WIDTH, (GLsizei)SCR_HEIGHT, GL_RGBA8};
+	TextureDesc shadowDesc = {(GLsizei)SHADOW_WIDTH, (GLsizei)SHADOW_HEIGHT, GL_DEPTH_COMPONENT};
+	FrameGraph::Resource backbuffer = graph.import_target("backbuffer", screenDesc, scene.outputFramebuffer);
+	FrameGraph::Resource shadowMap;
+	FrameGraph::Resource sceneColor;
 
-void setupScreenBuffer(GLuint &fbo, GLuint &texture, GLuint &depthMap)
-{
-	glGenFramebuffers(1, &fbo);  
+	// Render to depth map
+	graph.add_pass("shadow", [&](FrameGraph::Builder &builder) {
+		shadowMap = builder.create("shadowMap", shadowDesc);
+		return [&](const FrameGraph::Context &context) {
+			context.bind_target();
+			glEnable(GL_DEPTH_TEST);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			configureShader(depthShader, true);
+			drawEntities(scene, depthShader, false, scene.lightVisible);
+		};
+	});
 
-	glGenTextures(1, &depthMap);
-	glBindTexture(GL_TEXTURE_2D, depthMap);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, 
-				 GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER); 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);  
-	float borderColor[] = {1.0, 1.0, 1.0, 1.0};
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+	// Render Scene
+	graph.add_pass("lighting", [&](FrameGraph::Builder &builder) {
+		FrameGraph::Resource shadow = builder.read(shadowMap);
+		TextureDesc sceneDesc = post.scene_desc(screenDesc);
+		sceneColor = builder.create("sceneColor", sceneDesc);
+		sceneDesc.internalFormat = GL_DEPTH_COMPONENT24;
+		builder.create("sceneDepth", sceneDesc);
+		return [&, shadow](const FrameGraph::Context &context) {
+			context.bind_target();
+			glClearColor(0.3f, 0.3f, 0.5f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glEnable(GL_DEPTH_TEST);
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_BACK);
+			configureShader(lightingShader, false);
+			lightingShader.set_int("shadowMap", 0);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, context.texture(shadow));
+			render_stats().stateChanges++;
+			drawEntities(scene, lightingShader, true, scene.cameraVisible);
+		};
+	});
 
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
+	post.add_passes(graph, sceneColor, backbuffer);
 
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-	glBindFramebuffer(GL_FRAMEBUFFER, 0); 
+	// Depth map visualisation; nothing consumes it, so the graph culls it
+	graph.add_pass("shadowDebug", [&](FrameGraph::Builder &builder) {
+		FrameGraph::Resource shadow = builder.read(shadowMap);
+		builder.create("shadowDebugView", screenDesc);
+		return [&, shadow](const FrameGraph::Context &context) {
+			context.bind_target();
+			glDisable(GL_DEPTH_TEST);
+			screenShader.use();
+			screenShader.set_int("screenTexture", 0);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, context.texture(shadow));
+			render_stats().stateChanges++;
+			screenQuad.draw();
+		};
+	});
+}
+
+// Finds what the camera and the shadow map see, as two jobs, before the passes run. The
+// lists are sorted into entity order so frames stay reproducible. Each job builds its list
+// in its own thread's frame arena, replacing last frame's, so culling never touches the heap.
+void cullScene(SceneResources &scene)
+{
+	PROFILE_FUNCTION();
+	const SceneBVH &bvh = scene.entities.bvh;
+	JobCounter culled;
+	JOBS.run([&]() {
+		FrameVector<uint32_t> visible;
+		visible.reserve(bvh.size());
+		bvh.query_frustum(FRAME_CONSTANTS.frustum, visible);
+		std::sort(visible.begin(), visible.end());
+		scene.cameraVisible.swap(visible);
+	}, &culled);
+	JOBS.run([&]() {
+		FrameVector<uint32_t> visible;
+		visible.reserve(bvh.size());
+		bvh.query_frustum(FRAME_CONSTANTS.lightFrustum, visible);
+		std::sort(visible.begin(), visible.end());
+		scene.lightVisible.swap(visible);
+	}, &culled);
+	JOBS.wait(culled);
+	render_stats().culled = 2 * bvh.size() - (unsigned int)(scene.cameraVisible.size() + scene.lightVisible.size());
+}
+
+// Draws the visible renderable entities with their world matrices. Normal matrices come
+// precomputed from Scene::update(), so only passes that light need to upload them.
+void drawEntities(SceneResources &scene, Shader &shader, bool normals, const FrameVector<uint32_t> &visible)
+{
+	const Scene &entities = scene.entities;
+	for (uint32_t e: visible) {
+		int renderable = entities.renderables[e];
+		if (renderable < 0) {
+			continue;
+		}
+		shader.set_mat4("model", entities.world[e]);
+		if (normals) {
+			shader.set_mat3("normalMatrix", entities.normal[e]);
+		}
+		if (renderable == RENDER_MODEL) {
+			scene.model.draw(shader);
+		} else if (renderable == RENDER_TERRAIN) {
+			// Chunks were culled for each pass in Terrain::update; only the lighting pass wants normals
+			scene.terrain.draw(normals ? Terrain::VIEW_CAMERA : Terrain::VIEW_LIGHT);
+		} else if (renderable == RENDER_CROWD) {
+			scene.crowd.draw(shader, ANIMATION_TIME);
+		}
+	}
 }
 
 void configureShader(Shader &shader, bool shadows)
 {
+	PROFILE_FUNCTION();
 	shader.use();
-	glm::mat4 model(1.0);
-	
-	float near_plane = 1.0f, far_plane = 50.0f;
-	glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, 
-											far_plane); 
-	glm::mat4 lightView = glm::lookAt(glm::vec3(-10, -10, -10) * lightDirection, 
-										glm::vec3( 0.0f, 0.0f,  0.0f), 
-										glm::vec3( 0.0f, 1.0f,  0.0f)); 
-	glm::mat4x4 lightSpaceMatrix = lightProjection * lightView;
+	// Per-object matrices are set by drawEntities; the rest come from FRAME_CONSTANTS,
+	// updated once per frame in renderFrame
+	const FrameConstants &constants = FRAME_CONSTANTS;
 	if (shadows) {
-		shader.set_mat4("lightSpaceMatrix", lightSpaceMatrix);
-		shader.set_mat4("model", model);
+		shader.set_mat4("lightSpaceMatrix", constants.lightSpace);
 	}
 	else {
 		//glm::vec3 color(0.5, 0.8, 0.1);
 		glm::vec3 color(1.0, 1.0, 1.0);
-		glm::mat4 view = camera.get_view();
-		glm::mat4 projection = glm::perspective(glm::radians(camera.fov), SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f);
-		shader.set_mat4("lightSpaceMatrix", lightSpaceMatrix);
-		shader.set_mat4("model", model);
-		shader.set_mat4("projection", projection);
-		shader.set_mat4("view", view);
-		shader.set_vec3("viewPos", camera.position);
+		shader.set_mat4("lightSpaceMatrix", constants.lightSpace);
+		shader.set_mat4("projection", constants.projection);
+		shader.set_mat4("view", constants.view);
+		shader.set_vec3("viewPos", constants.viewPosition);
 		shader.set_vec3("material.diffuse", color);
 		shader.set_vec3("material.specular", 0.2, 0.2, 0.2);
 		shader.set_float("material.shininess", 32.0f);
@@ -217,52 +1726,164 @@ bool setupWindow(GLFWwindow* window)
 	}
 	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 	glfwSetCursorPosCallback(window, mouse_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	glfwSetKeyCallback(window, key_callback);
 	return true;
 }
 
 void framebufferSizeCallback(GLFWwindow *window, int width, int height)
 {
 	glViewport(0, 0, width, height);
+	REDRAW_REQUESTED = true;
 }
 
-void processInput(GLFWwindow *window)
+void window_refresh_callback(GLFWwindow *window)
 {
-	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
+	REDRAW_REQUESTED = true;
+}
+
+// Whether the next frame could differ from the one on screen: new input, camera motion,
+// a pending rebuild or request, anything animating, or terrain chunks still streaming in,
+// which only Terrain::update() uploads. Held movement keys send no events but move the
+// camera every tick, so they keep the camera version changing.
+bool needsRedraw(const SceneResources &scene, double oldestInput, unsigned int renderedCameraVersion)
+{
+	bool animating = !scene.model.clips.empty() || scene.crowd.size() > 0;
+	bool streaming = scene.terrain.pending_count() > 0;
+	return oldestInput >= 0.0 || camera.version != renderedCameraVersion || REDRAW_REQUESTED ||
+		   REBUILD_FRAME_GRAPH || PRINT_GPU_TIMINGS || WRITE_CPU_TRACE || animating || streaming;
+}
+
+// Applies the queued input and returns the time of the oldest event, or -1 if there was none
+double processInput(GLFWwindow *window)
+{
+	PROFILE_FUNCTION();
+	static std::vector<InputEvent> events;
+	INPUT_QUEUE.drain(events);
+	for (const InputEvent &event: events) {
+		if (event.type == InputEvent::KEY) {
+			if (event.key >= 0 && event.key < (int)KEYS_HELD.size()) {
+				KEYS_HELD[event.key] = event.action != GLFW_RELEASE;
+			}
+			continue;
+		}
+		if (event.type == InputEvent::MOUSE_BUTTON) {
+			if (event.key == GLFW_MOUSE_BUTTON_LEFT && event.action == GLFW_PRESS) {
+				PICK_REQUESTED = true;
+				PICK_X = event.x;
+				PICK_Y = event.y;
+			}
+			continue;
+		}
+		if (CURSOR_FREE) {
+			continue;
+		}
+		if (FIRST_MOUSE) {
+			LAST_X = event.x;
+			LAST_Y = event.y;
+			FIRST_MOUSE = false;
+		}
+		float x_offset = event.x - LAST_X;
+		float y_offset = LAST_Y - event.y; // positive y is toward bottom of window
+		LAST_X = event.x;
+		LAST_Y = event.y;
+		SIMULATION.add_mouse(x_offset, y_offset);
+	}
+	if (KEYS_HELD[GLFW_KEY_ESCAPE]) {
 		glfwSetWindowShouldClose(window, true);
 	}
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-		camera.process_keyboard_input(FORWARD, DELTA_TIME);
+	// Movement is applied by the simulation ticks, which scale it by the fixed step
+	bool move[6];
+	move[FORWARD] = KEYS_HELD[GLFW_KEY_W];
+	move[BACKWARD] = KEYS_HELD[GLFW_KEY_S];
+	move[LEFT] = KEYS_HELD[GLFW_KEY_A];
+	move[RIGHT] = KEYS_HELD[GLFW_KEY_D];
+	move[UP] = KEYS_HELD[GLFW_KEY_SPACE];
+	move[DOWN] = KEYS_HELD[GLFW_KEY_LEFT_SHIFT];
+	SIMULATION.set_keys(move);
+	return events.empty() ? -1.0 : events.front().time;
+}
+
+void mouse_callback(GLFWwindow* window, double x_pos, double y_pos)
+{
+	InputEvent event = {InputEvent::MOUSE_MOVE, currentTime(), 0, 0, x_pos, y_pos};
+	INPUT_QUEUE.push(event);
+}
+
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+	InputEvent event = {InputEvent::MOUSE_BUTTON, currentTime(), button, action, 0.0, 0.0};
+	glfwGetCursorPos(window, &event.x, &event.y);
+	INPUT_QUEUE.push(event);
+}
+
+// Picks what is under the cursor, or under the centre of the screen while the cursor is
+// captured for looking around, and prints it
+void pickAtCursor(GLFWwindow *window, const Scene &entities, const Picker &picker)
+{
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+	double x = CURSOR_FREE ? PICK_X : width * 0.5;
+	double y = CURSOR_FREE ? PICK_Y : height * 0.5;
+	glm::mat4 projection = glm::perspective(glm::radians(camera.fov), (float)width / height, 
+											FRAME_CONSTANTS.nearPlane, FRAME_CONSTANTS.farPlane);
+	glm::vec3 origin, direction;
+	cursor_ray(x, y, (float)width, (float)height, projection * camera.get_view(), origin, direction);
+	double start = currentTime();
+	PickResult hit = picker.pick(entities, origin, direction);
+	double elapsed = (currentTime() - start) * 1e6;
+	if (!hit.hit) {
+		std::cout << "pick: nothing (" << elapsed << " us)" << std::endl;
+		return;
 	}
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-		camera.process_keyboard_input(BACKWARD, DELTA_TIME);
+	std::cout << "pick: entity " << hit.entity << ", mesh " << hit.mesh << " instance " << hit.instance 
+			  << ", triangle " << hit.triangle << " at (" << hit.u << ", " << hit.v << "), distance " 
+			  << hit.distance << " (" << elapsed << " us)" << std::endl;
+}
+
+// F1-F3 toggle bloom, tonemapping and FXAA, F4 cycles the internal resolution, F5 prints GPU timings,
+// F6 writes the CPU trace (only populated when built with ENABLE_PROFILER), F7 frees the cursor
+// for picking; left click picks under the cursor, or the screen centre while it is captured
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	if (action != GLFW_REPEAT) {
+		InputEvent event = {InputEvent::KEY, currentTime(), key, action, 0.0, 0.0};
+		INPUT_QUEUE.push(event);
 	}
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-		camera.process_keyboard_input(LEFT, DELTA_TIME);
+	if (action != GLFW_PRESS) {
+		return;
 	}
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-		camera.process_keyboard_input(RIGHT, DELTA_TIME);
+	if (key == GLFW_KEY_F1) {
+		POST_SETTINGS.bloom = !POST_SETTINGS.bloom;
+		REBUILD_FRAME_GRAPH = true;
 	}
-	if (glfwGetKey(window, GLFW_KEY_SPACE)) {
-		camera.process_keyboard_input(UP, DELTA_TIME);
+	if (key == GLFW_KEY_F2) {
+		POST_SETTINGS.tonemap = !POST_SETTINGS.tonemap;
+		REBUILD_FRAME_GRAPH = true;
 	}
-	if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT)) {
-		camera.process_keyboard_input(DOWN, DELTA_TIME);
+	if (key == GLFW_KEY_F3) {
+		POST_SETTINGS.fxaa = !POST_SETTINGS.fxaa;
+		REBUILD_FRAME_GRAPH = true;
 	}
-}
-
-void mouse_callback(GLFWwindow* window, double x_pos, double y_pos)
-{
-	if (FIRST_MOUSE) {
-		LAST_X = x_pos;
-		LAST_Y = y_pos;
-		FIRST_MOUSE = false;
+	if (key == GLFW_KEY_F4) {
+		POST_SETTINGS.renderScale = POST_SETTINGS.renderScale > 0.6f ? POST_SETTINGS.renderScale - 0.25f : 1.0f;
+		REBUILD_FRAME_GRAPH = true;
 	}
-
-	float x_offset = x_pos - LAST_X;
-	float y_offset = LAST_Y - y_pos; // positive y is toward bottom of window
-	LAST_X = x_pos;
-	LAST_Y = y_pos;
-	camera.process_mouse_movement(x_offset, y_offset);
-}
\ No newline at end of file
+	if (key == GLFW_KEY_F5) {
+		PRINT_GPU_TIMINGS = true;
+	}
+	if (key == GLFW_KEY_F6) {
+		WRITE_CPU_TRACE = true;
+	}
+	if (key == GLFW_KEY_F7) {
+		CURSOR_FREE = !CURSOR_FREE;
+		glfwSetInputMode(window, GLFW_CURSOR, CURSOR_FREE ? GLFW_CURSOR_NORMAL : GLFW_CURSOR_DISABLED);
+		FIRST_MOUSE = true;
+	}
+}
@@ -0,0 +1,40 @@
+#version 330 core
+out vec4 fragColor;
+
+in vec2 texCoords;
+
+uniform sampler2D sourceTexture;
+uniform vec2 sourceTexelSize;
+uniform bool prefilter;
+uniform float threshold;
+
+// 13-tap downsample: a 4x4 box made of five overlapping 2x2 boxes, weighted to avoid the
+// pulsing a plain 2x2 box filter gives when bright pixels move.
+void main()
+{
+    vec2 t = sourceTexelSize;
+    vec3 a = texture(sourceTexture, texCoords + t * vec2(-2.0,  2.0)).rgb;
+    vec3 b = texture(sourceTexture, texCoords + t * vec2( 0.0,  2.0)).rgb;
+    vec3 c = texture(sourceTexture, texCoords + t * vec2( 2.0,  2.0)).rgb;
+    vec3 d = texture(sourceTexture, texCoords + t * vec2(-2.0,  0.0)).rgb;
+    vec3 e = texture(sourceTexture, texCoords).rgb;
+    vec3 f = texture(sourceTexture, texCoords + t * vec2( 2.0,  0.0)).rgb;
+    vec3 g = texture(sourceTexture, texCoords + t * vec2(-2.0, -2.0)).rgb;
+    vec3 h = texture(sourceTexture, texCoords + t * vec2( 0.0, -2.0)).rgb;
+    vec3 i = texture(sourceTexture, texCoords + t * vec2( 2.0, -2.0)).rgb;
+    vec3 j = texture(sourceTexture, texCoords + t * vec2(-1.0,  1.0)).rgb;
+    vec3 k = texture(sourceTexture, texCoords + t * vec2( 1.0,  1.0)).rgb;
+    vec3 l = texture(sourceTexture, texCoords + t * vec2(-1.0, -1.0)).rgb;
+    vec3 m = texture(sourceTexture, texCoords + t * vec2( 1.0, -1.0)).rgb;
+
+    vec3 color = e * 0.125;
+    color += (a + c + g + i) * 0.03125;
+    color += (b + d + f + h) * 0.0625;
+    color += (j + k + l + m) * 0.125;
+
+    if (prefilter) {
+        float brightness = max(color.r, max(color.g, color.b));
+        color *= max(brightness - threshold, 0.0) / max(brightness, 0.0001);
+    }
+    fragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,25 @@
+#version 330 core
+out vec4 fragColor;
+
+in vec2 texCoords;
+
+uniform sampler2D sourceTexture;
+uniform sampler2D currentTexture;
+uniform vec2 sourceTexelSize;
+
+// 3x3 tent filter over the smaller level, added onto the matching downsample level
+void main()
+{
+    vec2 t = sourceTexelSize;
+    vec3 color = texture(sourceTexture, texCoords).rgb * 4.0;
+    color += texture(sourceTexture, texCoords + t * vec2(-1.0,  0.0)).rgb * 2.0;
+    color += texture(sourceTexture, texCoords + t * vec2( 1.0,  0.0)).rgb * 2.0;
+    color += texture(sourceTexture, texCoords + t * vec2( 0.0, -1.0)).rgb * 2.0;
+    color += texture(sourceTexture, texCoords + t * vec2( 0.0,  1.0)).rgb * 2.0;
+    color += texture(sourceTexture, texCoords + t * vec2(-1.0, -1.0)).rgb;
+    color += texture(sourceTexture, texCoords + t * vec2( 1.0, -1.0)).rgb;
+    color += texture(sourceTexture, texCoords + t * vec2(-1.0,  1.0)).rgb;
+    color += texture(sourceTexture, texCoords + t * vec2( 1.0,  1.0)).rgb;
+    color /= 16.0;
+    fragColor = vec4(color + texture(currentTexture, texCoords).rgb, 1.0);
+}
@@ -1,10 +1,58 @@
 #version 330 core
 layout (location = 0) in vec3 pos;
+layout (location = 3) in mat4 instanceTransform;
+layout (location = 10) in uvec4 joints;
+layout (location = 11) in vec4 weights;
+layout (location = 12) in vec4 bakedInstance;   // crowd member's clip, phase and playback speed
 
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
+uniform bool skinned;
+
+layout (std140) uniform JointPalette {
+    mat4 palette[128];
+};
+
+// Baked vertex animation for crowds, see VertexAnimation.h
+uniform bool baked;
+uniform sampler2D bakedPositions;
+uniform int bakedVertices;
+uniform float bakedTime;
+uniform vec4 bakedClips[16];    // first frame, frame count, frames per second, duration
+
+const int BAKED_WIDTH = 1024;
+
+vec4 bakedTexel(sampler2D frames, int frame)
+{
+    int i = frame * bakedVertices + gl_VertexID;
+    return texelFetch(frames, ivec2(i % BAKED_WIDTH, i / BAKED_WIDTH), 0);
+}
+
+// The member's two frames around now and the blend between them
+void bakedFrames(out int first, out int second, out float t)
+{
+    vec4 clip = bakedClips[int(bakedInstance.x)];
+    float frame = mod(bakedTime * bakedInstance.z + bakedInstance.y, clip.w) * clip.z;
+    int count = int(clip.y);
+    int f = min(int(frame), count - 1);
+    first = int(clip.x) + f;
+    second = int(clip.x) + (f + 1) % count;
+    t = frame - float(f);
+}
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(pos, 1.0);
+    vec3 position = pos;
+    if (baked) {
+        int first, second;
+        float t;
+        bakedFrames(first, second, t);
+        position = mix(bakedTexel(bakedPositions, first).xyz, bakedTexel(bakedPositions, second).xyz, t);
+    }
+    mat4 skin = mat4(1.0);
+    if (skinned) {
+        skin = palette[joints.x] * weights.x + palette[joints.y] * weights.y +
+               palette[joints.z] * weights.z + palette[joints.w] * weights.w;
+    }
+    gl_Position = lightSpaceMatrix * model * instanceTransform * skin * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,45 @@
+#version 330 core
+out vec4 fragColor;
+
+in vec2 texCoords;
+
+uniform sampler2D screenTexture;
+uniform vec2 inverseScreenSize;
+
+#define FXAA_SPAN_MAX 8.0
+#define FXAA_REDUCE_MUL (1.0 / 8.0)
+#define FXAA_REDUCE_MIN (1.0 / 128.0)
+
+void main()
+{
+    vec2 t = inverseScreenSize;
+    vec3 rgbNW = texture(screenTexture, texCoords + vec2(-1.0, -1.0) * t).rgb;
+    vec3 rgbNE = texture(screenTexture, texCoords + vec2( 1.0, -1.0) * t).rgb;
+    vec3 rgbSW = texture(screenTexture, texCoords + vec2(-1.0,  1.0) * t).rgb;
+    vec3 rgbSE = texture(screenTexture, texCoords + vec2( 1.0,  1.0) * t).rgb;
+    vec3 rgbM  = texture(screenTexture, texCoords).rgb;
+
+    vec3 luma = vec3(0.299, 0.587, 0.114);
+    float lumaNW = dot(rgbNW, luma);
+    float lumaNE = dot(rgbNE, luma);
+    float lumaSW = dot(rgbSW, luma);
+    float lumaSE = dot(rgbSE, luma);
+    float lumaM  = dot(rgbM,  luma);
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+    // Blur along the edge, perpendicular to the local luma gradient
+    vec2 dir;
+    dir.x = -((lumaNW + lumaNE) - (lumaSW + lumaSE));
+    dir.y =  ((lumaNW + lumaSW) - (lumaNE + lumaSE));
+    float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * (0.25 * FXAA_REDUCE_MUL), FXAA_REDUCE_MIN);
+    float rcpDirMin = 1.0 / (min(abs(dir.x), abs(dir.y)) + dirReduce);
+    dir = min(vec2(FXAA_SPAN_MAX), max(vec2(-FXAA_SPAN_MAX), dir * rcpDirMin)) * t;
+
+    vec3 rgbA = 0.5 * (texture(screenTexture, texCoords + dir * (1.0 / 3.0 - 0.5)).rgb +
+                       texture(screenTexture, texCoords + dir * (2.0 / 3.0 - 0.5)).rgb);
+    vec3 rgbB = rgbA * 0.5 + 0.25 * (texture(screenTexture, texCoords + dir * -0.5).rgb +
+                                     texture(screenTexture, texCoords + dir * 0.5).rgb);
+    float lumaB = dot(rgbB, luma);
+    fragColor = vec4((lumaB < lumaMin || lumaB > lumaMax) ? rgbA : rgbB, 1.0);
+}
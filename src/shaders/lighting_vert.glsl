@@ -1,6 +1,11 @@
 #version 330 core
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 norm;
+layout (location = 3) in mat4 instanceTransform;
+layout (location = 7) in mat3 instanceNormal;
+layout (location = 10) in uvec4 joints;
+layout (location = 11) in vec4 weights;
+layout (location = 12) in vec4 bakedInstance;   // crowd member's clip, phase and playback speed
 
 out VS_OUT {
     vec3 fragPos;
@@ -12,11 +17,60 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 uniform mat4 lightSpaceMatrix;
+uniform mat3 normalMatrix;
+uniform bool skinned;
+
+layout (std140) uniform JointPalette {
+    mat4 palette[128];
+};
+
+// Baked vertex animation for crowds, see VertexAnimation.h
+uniform bool baked;
+uniform sampler2D bakedPositions;
+uniform sampler2D bakedNormals;
+uniform int bakedVertices;
+uniform float bakedTime;
+uniform vec4 bakedClips[16];    // first frame, frame count, frames per second, duration
+
+const int BAKED_WIDTH = 1024;
+
+vec4 bakedTexel(sampler2D frames, int frame)
+{
+    int i = frame * bakedVertices + gl_VertexID;
+    return texelFetch(frames, ivec2(i % BAKED_WIDTH, i / BAKED_WIDTH), 0);
+}
+
+// The member's two frames around now and the blend between them
+void bakedFrames(out int first, out int second, out float t)
+{
+    vec4 clip = bakedClips[int(bakedInstance.x)];
+    float frame = mod(bakedTime * bakedInstance.z + bakedInstance.y, clip.w) * clip.z;
+    int count = int(clip.y);
+    int f = min(int(frame), count - 1);
+    first = int(clip.x) + f;
+    second = int(clip.x) + (f + 1) % count;
+    t = frame - float(f);
+}
 
 void main()
 {
-    vs_out.fragPos = vec3(model * vec4(pos, 1.0));
-    vs_out.normal = mat3(transpose(inverse(model))) * norm;
-    vs_out.fragPosLightSpace = lightSpaceMatrix * vec4(vs_out.fragPos, 1.0);
-    gl_Position = projection * view * model * vec4(pos, 1.0);
+    vec3 position = pos;
+    vec3 normal = norm;
+    if (baked) {
+        int first, second;
+        float t;
+        bakedFrames(first, second, t);
+        position = mix(bakedTexel(bakedPositions, first).xyz, bakedTexel(bakedPositions, second).xyz, t);
+        normal = mix(bakedTexel(bakedNormals, first).xyz, bakedTexel(bakedNormals, second).xyz, t);
+    }
+    mat4 skin = mat4(1.0);
+    if (skinned) {
+        skin = palette[joints.x] * weights.x + palette[joints.y] * weights.y +
+               palette[joints.z] * weights.z + palette[joints.w] * weights.w;
+    }
+    vec4 worldPos = model * instanceTransform * skin * vec4(position, 1.0);
+    vs_out.fragPos = vec3(worldPos);
+    vs_out.normal = normalMatrix * instanceNormal * mat3(skin) * normal;
+    vs_out.fragPosLightSpace = lightSpaceMatrix * worldPos;
+    gl_Position = projection * view * worldPos;
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#version 330 core
+out vec4 fragColor;
+
+in vec2 texCoords;
+
+uniform sampler2D screenTexture;
+uniform sampler2D bloomTexture;
+uniform bool bloom;
+uniform bool tonemap;
+uniform float bloomIntensity;
+uniform float exposure;
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 aces(vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+    vec3 color = texture(screenTexture, texCoords).rgb;
+    if (bloom) {
+        color += texture(bloomTexture, texCoords).rgb * bloomIntensity;
+    }
+    if (tonemap) {
+        color = aces(color * exposure);
+    }
+    fragColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}